@@ -0,0 +1,741 @@
+// Author: Andrea Luzzati
+// Micro benchmarks of the software renderer building blocks.
+// Usage: benchmark [name]   (runs all the benchmarks when no name is given)
+// Build with SR_NO_SIMD defined to measure the plain glm implementations for comparison.
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include "texture.h"
+#include "residency.h"
+#include "meshfile.h"
+#include "scene.h"
+#include <glm/ext.hpp>
+
+// Returns the seconds elapsed since start
+double secondsSince(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+// Fills a texture with random colors
+void randomTexture(SrTexture& texture, const int width, const int height) {
+	texture.textureFromColor(width, height, vec4(0.0f));
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			texture.write(x, y, vec4(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, 1.0f));
+}
+
+// Sampling throughput (samples/second) of nearest, bilinear and trilinear filtering. The uvs walk
+// a 32x32 pixel tile at a time like the rasterizer does, one sample at a time and 4/8 at a time (sampleMany).
+void benchmarkSampling() {
+	SrTexture texture;
+	randomTexture(texture, 2048, 2048);
+	texture.generateMipmaps();
+	texture.trilinearCoefficient = 1.5f;
+	const int count = 1 << 22;
+	std::vector<vec2> uvs(count);
+	std::vector<vec4> results(count);
+	for (int i = 0; i < count; i++) {
+		int tile = i >> 10, x = i & 31, y = (i >> 5) & 31;
+		uvs[i] = vec2((tile % 64) * 32 + x, (tile / 64) * 32 + y) / 2048.0f * 1.3f;
+	}
+	const char* names[3] = { "nearest", "bilinear", "trilinear" };
+	for (int mode = 0; mode < 3; mode++) {
+		bool bilinear = mode > 0, trilinear = mode > 1;
+		double checksum = 0.0;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < count; i++)
+			checksum += texture.sample(uvs[i], true, bilinear, trilinear).x;
+		double single = count / secondsSince(start);
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < count; i += 4)
+			texture.sampleMany(&uvs[i], &results[i], 4, true, bilinear, trilinear);
+		double quad = count / secondsSince(start);
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < count; i += 8)
+			texture.sampleMany(&uvs[i], &results[i], 8, true, bilinear, trilinear);
+		double octo = count / secondsSince(start);
+		for (int i = 0; i < count; i++) checksum -= results[i].x;
+		std::cout << "sampling " << names[mode] << ": " << single / 1e6 << " Msamples/s single, "
+			<< quad / 1e6 << " Msamples/s by 4, " << octo / 1e6 << " Msamples/s by 8 (checksum " << checksum << ")" << std::endl;
+	}
+}
+
+// Cost of anisotropic filtering for a grazing footprint (16:1) with an increasing maximum tap count
+void benchmarkAnisotropic() {
+	SrTexture texture;
+	randomTexture(texture, 2048, 2048);
+	texture.generateMipmaps();
+	const int count = 1 << 20;
+	const int taps[5] = { 1, 2, 4, 8, 16 };
+	for (int t = 0; t < 5; t++) {
+		texture.setMaxAnisotropy(taps[t]);
+		double checksum = 0.0;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < count; i++) {
+			vec2 uv = vec2(i & 1023, i >> 10) / 1024.0f;
+			if (taps[t] > 1) texture.calculateAnisotropicFootprint(vec2(8.0f / 2048.0f, 0.0f), vec2(0.0f, 0.5f / 2048.0f));
+			else texture.calculateTrilinearCoefficient(4.0f / (2048.0f * 2048.0f)); // area of the same footprint
+			checksum += texture.sample(uv, true).x;
+		}
+		std::cout << "anisotropic max taps " << taps[t] << ": " << count / secondsSince(start) / 1e6
+			<< " Msamples/s (checksum " << checksum << ")" << std::endl;
+	}
+}
+
+// Mipmap chain generation time of a 4096x4096 texture with every filter
+void benchmarkMipmaps() {
+	const char* names[3] = { "box", "kaiser", "lanczos" };
+	for (int filter = 0; filter < 3; filter++) {
+		SrTexture texture;
+		randomTexture(texture, 4096, 4096);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		texture.generateMipmaps((SrTexture::MipmapFilter)filter);
+		std::cout << "mipmaps 4096x4096 " << names[filter] << ": " << secondsSince(start) * 1000.0 << " ms, "
+			<< texture.getMipmapCount() << " levels on " << srThreadCount() << " threads" << std::endl;
+	}
+}
+// Load time of a 2048x2048 RGBA picture (written to benchmark.png) with and without gamma correction
+void benchmarkImageLoad() {
+	std::vector<unsigned char> pixels(2048 * 2048 * 4);
+	for (size_t i = 0; i < pixels.size(); i++) pixels[i] = (unsigned char)rand();
+	stbi_write_png("benchmark.png", 2048, 2048, 4, &pixels[0], 2048 * 4);
+	const char* names[3] = { "linear", "gamma 2.2", "sRGB" };
+	for (int curve = 0; curve < 3; curve++) {
+		SrTexture texture;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		texture.textureFromImage("benchmark.png", curve > 0, curve == 2);
+		std::cout << "image 2048x2048 " << names[curve] << ": " << secondsSince(start) * 1000.0 << " ms" << std::endl;
+	}
+	remove("benchmark.png");
+}
+// Loads a demo environment cubemap (emap/<prefix><face>.buff for every mipmap prefix), returns false if a file is missing
+bool loadCubemap(SrTexture& cubemap, const std::vector<std::string>& prefixes, const int size) {
+	const char* faceMap[6] = { "front","back","right","left","top","bottom" };
+	for (int mip = 0; mip < (int)prefixes.size(); mip++)
+		for (int face = 0; face < 6; face++) {
+			std::string fname = "emap/" + prefixes[mip] + faceMap[face] + ".buff";
+			if (!cubemap.cubemapFromBuffer(fname.c_str(), size >> mip, size >> mip, face, mip)) return false;
+		}
+	return true;
+}
+// Loads the demo radiance cubemap (8 mipmaps of 512x512 faces)
+bool loadRadiance(SrTexture& radiance) {
+	std::vector<std::string> prefixes;
+	for (int mip = 0; mip < 8; mip++) prefixes.push_back("radiance-" + std::to_string(mip) + "-");
+	return loadCubemap(radiance, prefixes, 512);
+}
+
+// Environment lookups per second with the cubemap and the octahedral map converted from it
+void benchmarkEnvironment() {
+	SrTexture radiance, octahedral;
+	if (!loadRadiance(radiance)) {
+		std::cout << "environment: emap/radiance-*.buff not found, skipped" << std::endl;
+		return;
+	}
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	octahedral.octahedralFromCubemap(radiance, 1024);
+	std::cout << "environment: octahedral conversion " << secondsSince(start) << " s" << std::endl;
+	const int count = 1 << 20;
+	std::vector<vec3> directions(count);
+	for (int i = 0; i < count; i++)
+		directions[i] = normalize(vec3(rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f));
+	double checksum = 0.0;
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		checksum += radiance.sampleCubemap(directions[i], true, true, 2.5f).x;
+	double cubemap = count / secondsSince(start);
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		checksum -= octahedral.sampleOctahedral(directions[i], true, true, 2.5f).x;
+	double octahedralRate = count / secondsSince(start);
+	std::cout << "environment: cubemap " << cubemap / 1e6 << " Msamples/s, octahedral " << octahedralRate / 1e6
+		<< " Msamples/s (difference " << checksum / count << ")" << std::endl;
+}
+
+// Load time of the whole demo environment (radiance, irradiance and brdf lookup table buffer files)
+void benchmarkEmapLoad() {
+	SrTexture radiance, irradiance, brdflut;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	if (!loadRadiance(radiance) || !loadCubemap(irradiance, std::vector<std::string>(1, "irradiance-"), 32) ||
+		!brdflut.textureFromBuffer("brdf.buff", 512, 512, 2)) {
+		std::cout << "emap: environment buffer files not found, skipped" << std::endl;
+		return;
+	}
+	double seconds = secondsSince(start);
+	double megabytes = 0.0;
+	for (int mip = 0; mip < 8; mip++) megabytes += 6.0 * (512 >> mip) * (512 >> mip) * 3 * sizeof(float);
+	megabytes = (megabytes + 6.0 * 32 * 32 * 3 * sizeof(float) + 512.0 * 512 * 2 * sizeof(float)) / (1024.0 * 1024.0);
+	std::cout << "emap: loaded " << megabytes << " MB in " << seconds * 1000.0 << " ms (" << megabytes / seconds << " MB/s)" << std::endl;
+}
+// Diffuse lighting per second with the irradiance cubemap and with its spherical harmonics projection
+void benchmarkIrradiance() {
+	SrTexture irradiance;
+	if (!loadCubemap(irradiance, std::vector<std::string>(1, "irradiance-"), 32)) {
+		std::cout << "irradiance: emap/irradiance-*.buff not found, skipped" << std::endl;
+		return;
+	}
+	vec3 sh[9];
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	irradiance.cubemapToSH(sh);
+	std::cout << "irradiance: projection to spherical harmonics " << secondsSince(start) * 1000.0 << " ms" << std::endl;
+	const int count = 1 << 20;
+	std::vector<vec3> normals(count);
+	for (int i = 0; i < count; i++)
+		normals[i] = normalize(vec3(rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f));
+	std::vector<vec3> cubemap(count), harmonics(count);
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		cubemap[i] = irradiance.sampleCubemap(normals[i]).xyz;
+	double cubemapRate = count / secondsSince(start);
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		harmonics[i] = shEvaluate(sh, normals[i]);
+	double harmonicsRate = count / secondsSince(start);
+	double error = 0.0, magnitude = 0.0;
+	for (int i = 0; i < count; i++) {
+		error += length(cubemap[i] - harmonics[i]);
+		magnitude += length(cubemap[i]);
+	}
+	std::cout << "irradiance: cubemap " << cubemapRate / 1e6 << " Msamples/s, spherical harmonics " << harmonicsRate / 1e6
+		<< " Msamples/s (x" << harmonicsRate / cubemapRate << "), relative error " << error / magnitude << std::endl;
+}
+
+// Streaming of 8 2048x2048 textures (written to benchmark-*.srtex) under a 48 MB budget: every frame samples the
+// textures at a level following a camera zooming in and out, the residency manager streams the levels in between frames
+void benchmarkResidency() {
+	const int textureCount = 8;
+	std::vector<SrTexture> textures(textureCount);
+	std::vector<std::string> fnames(textureCount);
+	size_t fullMemory = 0;
+	for (int i = 0; i < textureCount; i++) {
+		SrTexture texture;
+		randomTexture(texture, 2048, 2048);
+		texture.generateMipmaps();
+		fnames[i] = "benchmark-" + std::to_string(i) + ".srtex";
+		fullMemory += texture.getMemoryUsage();
+		if (!texture.saveContainer(fnames[i].c_str())) {
+			std::cout << "residency: could not write " << fnames[i] << ", skipped" << std::endl;
+			return;
+		}
+	}
+	SrResidencyManager residency(48 << 20, 16 << 20);
+	for (int i = 0; i < textureCount; i++) {
+		textures[i].textureFromContainerStreamed(fnames[i].c_str());
+		residency.addTexture(&textures[i]);
+	}
+	double updateSeconds = 0.0;
+	size_t peakMemory = 0;
+	const int frames = 32;
+	for (int frame = 0; frame < frames; frame++) {
+		// The camera moves from far (level 6) to close (level 0) and back; only the first half of the textures is visible
+		int level = abs(frames / 2 - frame) * 6 / (frames / 2);
+		double checksum = 0.0;
+		for (int i = 0; i < textureCount / 2; i++) {
+			textures[i].trilinearCoefficient = (float)level;
+			for (int s = 0; s < 4096; s++)
+				checksum += textures[i].sample(vec2(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX)).x;
+		}
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		residency.update();
+		updateSeconds += secondsSince(start);
+		peakMemory = max(peakMemory, residency.getMemoryUsage());
+		if (frame % 8 == 0)
+			std::cout << "residency frame " << frame << ": requested level " << level << ", resident level " << textures[0].getResidentLevel()
+				<< ", " << residency.getMemoryUsage() / (1024.0 * 1024.0) << " MB (checksum " << checksum << ")" << std::endl;
+	}
+	size_t streamed, evicted;
+	residency.getStats(streamed, evicted);
+	std::cout << "residency: " << fullMemory / (1024.0 * 1024.0) << " MB of textures, peak " << peakMemory / (1024.0 * 1024.0)
+		<< " MB resident, " << streamed / (1024.0 * 1024.0) << " MB streamed, " << evicted / (1024.0 * 1024.0)
+		<< " MB released, " << updateSeconds / frames * 1000.0 << " ms per update" << std::endl;
+	for (int i = 0; i < textureCount; i++) {
+		textures[i].disposeData();
+		remove(fnames[i].c_str());
+	}
+}
+
+// Virtual texturing of a 4096x4096 texture (written to benchmark.srvt) with a 128 pages cache: a 256x256 feedback
+// buffer pans across the texture, the missing pages are read between frames. Sampling rate compared to the plain texture.
+void benchmarkVirtual() {
+	SrTexture texture, virtualTexture;
+	randomTexture(texture, 4096, 4096);
+	texture.generateMipmaps();
+	if (!texture.saveVirtual("benchmark.srvt", 128) || !virtualTexture.textureFromVirtual("benchmark.srvt", 128)) {
+		std::cout << "virtual: could not write benchmark.srvt, skipped" << std::endl;
+		return;
+	}
+	const int feedbackSize = 256, frames = 16;
+	std::vector<vec2> uvs(feedbackSize * feedbackSize);
+	double updateSeconds = 0.0;
+	for (int frame = 0; frame < frames; frame++) {
+		// A view covering a quarter of the texture at level 1, moving by 1/64 of the texture every frame
+		vec2 offset(frame / 64.0f, frame / 128.0f);
+		for (int i = 0; i < feedbackSize * feedbackSize; i++)
+			uvs[i] = offset + vec2(i % feedbackSize, i / feedbackSize) / (float)feedbackSize * 0.25f;
+		virtualTexture.clearVirtualFeedback(feedbackSize * feedbackSize);
+		virtualTexture.trilinearCoefficient = 1.0f;
+		for (int i = 0; i < feedbackSize * feedbackSize; i++)
+			virtualTexture.writeVirtualFeedback(i, uvs[i]);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		int loaded = virtualTexture.updateVirtualPages();
+		updateSeconds += secondsSince(start);
+		if (frame % 4 == 0) std::cout << "virtual frame " << frame << ": " << loaded << " pages read" << std::endl;
+	}
+	texture.trilinearCoefficient = virtualTexture.trilinearCoefficient = 1.5f;
+	double checksum = 0.0;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < uvs.size(); i++)
+		checksum += texture.sample(uvs[i], true).x;
+	double plainRate = uvs.size() / secondsSince(start);
+	start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < uvs.size(); i++)
+		checksum -= virtualTexture.sample(uvs[i], true).x;
+	double virtualRate = uvs.size() / secondsSince(start);
+	int residentPages;
+	size_t pagesLoaded;
+	virtualTexture.getVirtualStats(residentPages, pagesLoaded);
+	std::cout << "virtual: " << texture.getMemoryUsage() / (1024.0 * 1024.0) << " MB texture, " << virtualTexture.getMemoryUsage() / (1024.0 * 1024.0)
+		<< " MB page cache (" << residentPages << " pages resident, " << pagesLoaded << " read, " << updateSeconds / frames * 1000.0
+		<< " ms per update), sampling " << plainRate / 1e6 << " Msamples/s plain, " << virtualRate / 1e6
+		<< " Msamples/s virtual (difference " << checksum / uvs.size() << ")" << std::endl;
+	virtualTexture.disposeData();
+	remove("benchmark.srvt");
+}
+
+// Load throughput of a mesh buffer file (the demo mesh when available, otherwise 300000 random triangles written to
+// benchmark.buff, whose vertices are all different) and welding time of its vertices
+void benchmarkMeshLoad() {
+	const char* fname = "cerberus-mesh.buff";
+	FILE* pFile = srOpenFile(fname, "rb");
+	if (pFile != NULL) fclose(pFile);
+	else {
+		fname = "benchmark.buff";
+		std::vector<float> records(300000 * 3 * 15);
+		for (size_t i = 0; i < records.size(); i++) records[i] = rand() / (float)RAND_MAX;
+		pFile = srOpenFile(fname, "wb");
+		if (pFile == NULL || fwrite(&records[0], sizeof(float), records.size(), pFile) != records.size()) {
+			std::cout << "mesh: could not write " << fname << ", skipped" << std::endl;
+			if (pFile != NULL) fclose(pFile);
+			return;
+		}
+		fclose(pFile);
+	}
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	SrMesh mesh = loadMeshBuffer(fname);
+	double seconds = secondsSince(start);
+	double megabytes = mesh.size() * 3 * 60 / (1024.0 * 1024.0);
+	std::cout << "mesh: " << mesh.size() << " triangles, " << megabytes << " MB in " << seconds * 1000.0 << " ms ("
+		<< megabytes / seconds << " MB/s)" << std::endl;
+	start = std::chrono::high_resolution_clock::now();
+	SrIndexedMesh indexed = weldMesh(mesh);
+	double weldSeconds = secondsSince(start);
+	std::cout << "mesh: welded to " << indexed.vertices.size() << " vertices (" << (indexed.indices16.size() > 0 ? 16 : 32)
+		<< " bit indices) in " << weldSeconds * 1000.0 << " ms" << std::endl;
+	start = std::chrono::high_resolution_clock::now();
+	SrPackedMesh packed = packMesh(indexed);
+	double packSeconds = secondsSince(start);
+	// Largest decoding errors of the packed vertices
+	vec3 extent = packed.boundsScale * 65535.0f;
+	float positionError = 0.0f, normalError = 0.0f, uvError = 0.0f;
+	size_t flippedBitangents = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < packed.vertexCount; i++) {
+		SrVertex v = unpackVertex(packed, i), &o = indexed.vertices[i];
+		positionError = max(positionError, length(vec3(v.position.xyz - o.position.xyz)) / max(max(extent.x, extent.y), extent.z));
+		normalError = max(normalError, length(vec3(v.normal.xyz) - normalize(vec3(o.normal.xyz))));
+		uvError = max(uvError, length(v.uv - o.uv));
+		if (dot(vec3(v.bitangent.xyz), vec3(o.bitangent.xyz)) < 0.0f) flippedBitangents++;
+	}
+	double unpackSeconds = secondsSince(start);
+	size_t indexedBytes = indexed.vertices.size() * sizeof(SrVertex) + indexed.indices16.size() * 2 + indexed.indices32.size() * 4;
+	std::cout << "mesh: packed from " << indexedBytes / (1024.0 * 1024.0) << " MB to " << packed.getMemoryUsage() / (1024.0 * 1024.0)
+		<< " MB in " << packSeconds * 1000.0 << " ms, unpacked in " << unpackSeconds * 1000.0 << " ms (largest error: position "
+		<< positionError << " of the bounds, normal " << normalError << ", uv " << uvError << ", " << flippedBitangents << " bitangents flipped)" << std::endl;
+	// Startup with the container: mapping it and reading every index, against reordering and packing the welded mesh
+	start = std::chrono::high_resolution_clock::now();
+	packed = prepareMesh(indexed);
+	double prepareSeconds = secondsSince(start);
+	if (!saveMeshContainer(packed, "benchmark.srmesh")) {
+		std::cout << "mesh: could not write benchmark.srmesh, skipped" << std::endl;
+		if (std::string(fname) == "benchmark.buff") remove(fname);
+		return;
+	}
+	start = std::chrono::high_resolution_clock::now();
+	SrPackedMesh mapped;
+	bool loaded = meshFromContainer("benchmark.srmesh", mapped);
+	size_t checksum = 0;
+	for (size_t i = 0; loaded && i < mapped.getIndexCount(); i++) checksum += mapped.getIndex(i);
+	double containerSeconds = secondsSince(start);
+	std::cout << "mesh: container with " << mapped.clusterCount << " clusters mapped and read in " << containerSeconds * 1000.0
+		<< " ms (welding, reordering and packing " << (seconds + weldSeconds + prepareSeconds) * 1000.0 << " ms, checksum " << checksum << ")" << std::endl;
+	mapped = SrPackedMesh(); // unmaps the file
+	remove("benchmark.srmesh");
+	if (std::string(fname) == "benchmark.buff") remove(fname);
+}
+
+// Load throughput of a 2 million triangles grid written as a Wavefront OBJ file and as a binary glTF file
+void benchmarkMeshFormats() {
+	const int side = 1000; // quads per side
+	const int vertexCount = (side + 1) * (side + 1), triangles = side * side * 2;
+	std::vector<float> positions, normals, uvs;
+	std::vector<unsigned int> indices;
+	for (int y = 0; y <= side; y++)
+		for (int x = 0; x <= side; x++) {
+			float u = x / (float)side, v = y / (float)side, height = 0.05f * sin(u * 40.0f) * cos(v * 40.0f);
+			vec3 n = normalize(vec3(-2.0f * cos(u * 40.0f) * cos(v * 40.0f), 1.0f, 2.0f * sin(u * 40.0f) * sin(v * 40.0f)));
+			positions.insert(positions.end(), { u, height, v });
+			normals.insert(normals.end(), { n.x, n.y, n.z });
+			uvs.insert(uvs.end(), { u, v });
+		}
+	for (int y = 0; y < side; y++)
+		for (int x = 0; x < side; x++) {
+			unsigned int i = y * (side + 1) + x;
+			indices.insert(indices.end(), { i, i + side + 1, i + 1, i + 1, i + side + 1, i + side + 2 });
+		}
+	FILE* pFile = srOpenFile("benchmark.obj", "wb");
+	bool written = pFile != NULL;
+	for (int i = 0; written && i < vertexCount; i++)
+		fprintf(pFile, "v %f %f %f\nvt %f %f\nvn %f %f %f\n", positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2],
+			uvs[i * 2], 1.0f - uvs[i * 2 + 1], normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]);
+	for (int t = 0; written && t < triangles; t++)
+		fprintf(pFile, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", indices[t * 3] + 1, indices[t * 3] + 1, indices[t * 3] + 1, indices[t * 3 + 1] + 1,
+			indices[t * 3 + 1] + 1, indices[t * 3 + 1] + 1, indices[t * 3 + 2] + 1, indices[t * 3 + 2] + 1, indices[t * 3 + 2] + 1);
+	if (pFile != NULL) written = fclose(pFile) == 0 && written;
+	// The same grid in a .glb: JSON chunk and binary chunk with the positions, normals, uv and indices
+	size_t arrays[4] = { positions.size() * 4, normals.size() * 4, uvs.size() * 4, indices.size() * 4 };
+	std::string json = "{\"asset\":{\"version\":\"2.0\"},\"buffers\":[{\"byteLength\":" + std::to_string(arrays[0] + arrays[1] + arrays[2] + arrays[3]) +
+		"}],\"bufferViews\":[";
+	for (size_t a = 0, offset = 0; a < 4; offset += arrays[a], a++)
+		json += std::string(a > 0 ? "," : "") + "{\"buffer\":0,\"byteOffset\":" + std::to_string(offset) + ",\"byteLength\":" + std::to_string(arrays[a]) + "}";
+	json += "],\"accessors\":[{\"bufferView\":0,\"componentType\":5126,\"count\":" + std::to_string(vertexCount) + ",\"type\":\"VEC3\"},"
+		"{\"bufferView\":1,\"componentType\":5126,\"count\":" + std::to_string(vertexCount) + ",\"type\":\"VEC3\"},"
+		"{\"bufferView\":2,\"componentType\":5126,\"count\":" + std::to_string(vertexCount) + ",\"type\":\"VEC2\"},"
+		"{\"bufferView\":3,\"componentType\":5125,\"count\":" + std::to_string(indices.size()) + ",\"type\":\"SCALAR\"}],"
+		"\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1,\"TEXCOORD_0\":2},\"indices\":3}]}]}";
+	while (json.size() % 4 != 0) json += ' ';
+	unsigned int binBytes = (unsigned int)(arrays[0] + arrays[1] + arrays[2] + arrays[3]);
+	unsigned int header[5] = { 0x46546C67, 2, (unsigned int)(20 + json.size() + 8 + binBytes), (unsigned int)json.size(), 0x4E4F534A };
+	unsigned int binHeader[2] = { binBytes, 0x004E4942 };
+	pFile = written ? srOpenFile("benchmark.glb", "wb") : NULL;
+	written = pFile != NULL && fwrite(header, 4, 5, pFile) == 5 && fwrite(json.data(), 1, json.size(), pFile) == json.size() &&
+		fwrite(binHeader, 4, 2, pFile) == 2 && fwrite(&positions[0], 1, arrays[0], pFile) == arrays[0] &&
+		fwrite(&normals[0], 1, arrays[1], pFile) == arrays[1] && fwrite(&uvs[0], 1, arrays[2], pFile) == arrays[2] &&
+		fwrite(&indices[0], 1, arrays[3], pFile) == arrays[3];
+	if (pFile != NULL) written = fclose(pFile) == 0 && written;
+	if (!written) std::cout << "formats: could not write the benchmark files, skipped" << std::endl;
+	const char* fnames[2] = { "benchmark.obj", "benchmark.glb" };
+	for (int f = 0; f < 2 && written; f++) {
+		SrFileMapping file;
+		double megabytes = file.open(fnames[f]) ? file.size() / (1024.0 * 1024.0) : 0.0;
+		file.close();
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		SrIndexedMesh mesh = f == 0 ? loadObj(fnames[f]) : loadGlb(fnames[f]);
+		double seconds = secondsSince(start);
+		std::cout << "formats: " << fnames[f] << " " << megabytes << " MB, " << mesh.getIndexCount() / 3 << " triangles, "
+			<< mesh.vertices.size() << " vertices in " << seconds * 1000.0 << " ms (" << megabytes / seconds << " MB/s, "
+			<< mesh.getIndexCount() / 3 / seconds / 1e6 << " Mtriangles/s)" << std::endl;
+	}
+	remove("benchmark.obj");
+	remove("benchmark.glb");
+}
+
+// Tangent generation on a 2 million triangles grid whose uv are mirrored on its right half (the expected tangents are
+// +x on the left half and -x on the right half, the vertices of the middle column are split), then on a 20000
+// triangles one, whose split vertices still fit 16 bit indices
+void benchmarkTangents() {
+	for (int side = 1000; side >= 100; side /= 10) {
+		SrIndexedMesh mesh;
+		for (int y = 0; y <= side; y++)
+			for (int x = 0; x <= side; x++) {
+				SrVertex v;
+				v.position = vec4(x / (float)side, 0.0f, y / (float)side, 1.0f);
+				v.normal = vec4(0, -1, 0, 0);
+				v.color = vec4(1.0f);
+				v.uv = vec2(x <= side / 2 ? x / (float)side : 1.0f - x / (float)side, y / (float)side);
+				mesh.vertices.push_back(v);
+			}
+		for (int y = 0; y < side; y++)
+			for (int x = 0; x < side; x++) {
+				unsigned int i = y * (side + 1) + x;
+				mesh.indices32.insert(mesh.indices32.end(), { i, i + side + 1, i + 1, i + 1, i + side + 1, i + side + 2 });
+			}
+		size_t vertexCount = mesh.vertices.size();
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		generateTangents(mesh);
+		double seconds = secondsSince(start);
+		// Largest error against the expected tangent of the triangles of every vertex
+		float error = 0.0f;
+		for (size_t i = 0; i < mesh.getIndexCount(); i++) {
+			const SrVertex& v = mesh.vertices[mesh.getIndex(i)];
+			float x = (i / 6) % side < (size_t)side / 2 ? 1.0f : -1.0f;
+			error = max(error, length(vec3(v.tangent.xyz) - vec3(x, 0.0f, 0.0f)));
+		}
+		std::cout << "tangents: " << mesh.getIndexCount() / 3 << " triangles in " << seconds * 1000.0 << " ms, " << mesh.vertices.size() - vertexCount
+			<< " vertices split on the mirroring seam (" << (mesh.indices16.size() > 0 ? 16 : 32) << " bit indices, " << mesh.indices16.size() + mesh.indices32.size()
+			<< " indices), largest tangent error " << error << std::endl;
+	}
+}
+
+// Vertex cache (ACMR with a 16 vertices FIFO cache) and overdraw statistics of the demo mesh (otherwise 32 overlapping
+// spheres with their triangles shuffled) before and after the triangle reordering passes
+void benchmarkMeshOptimizer() {
+	SrIndexedMesh mesh = weldMesh(loadMeshBuffer("cerberus-mesh.buff"));
+	if (mesh.vertices.size() == 0) {
+		const int rings = 64, segments = 64;
+		SrMesh spheres;
+		for (int s = 0; s < 32; s++) {
+			vec4 center(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, 0.0f);
+			for (int i = 0; i < rings; i++)
+				for (int j = 0; j < segments; j++) {
+					vec4 p[4];
+					for (int k = 0; k < 4; k++) {
+						float theta = (i + (k >> 1)) * 3.14159265f / rings, phi = (j + (k & 1)) * 6.28318531f / segments;
+						p[k] = center + vec4(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi), 1.0f) * 0.25f;
+						p[k].w = 1.0f;
+					}
+					SrTriangle a, b;
+					a.a.position = p[0]; a.b.position = p[1]; a.c.position = p[2];
+					b.a.position = p[1]; b.b.position = p[3]; b.c.position = p[2];
+					spheres.push_back(a);
+					spheres.push_back(b);
+				}
+		}
+		for (size_t i = spheres.size() - 1; i > 0; i--) std::swap(spheres[i], spheres[rand() % (i + 1)]);
+		mesh = weldMesh(spheres);
+	}
+	std::cout << "meshopt: " << mesh.getIndexCount() / 3 << " triangles, ACMR " << meshACMR(mesh) << ", overdraw "
+		<< meshOverdraw(mesh) << std::endl;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	optimizeVertexCache(mesh);
+	std::cout << "meshopt: vertex cache order in " << secondsSince(start) * 1000.0 << " ms, ACMR " << meshACMR(mesh)
+		<< ", overdraw " << meshOverdraw(mesh) << std::endl;
+	start = std::chrono::high_resolution_clock::now();
+	optimizeOverdraw(mesh);
+	std::cout << "meshopt: overdraw order in " << secondsSince(start) * 1000.0 << " ms, ACMR " << meshACMR(mesh)
+		<< ", overdraw " << meshOverdraw(mesh) << std::endl;
+}
+
+// Levels of detail of the demo mesh (otherwise a 1 million triangles sphere): simplification time, triangles and
+// error of every level, and the level drawn at growing distances with the demo projection (1 pixel of error)
+void benchmarkLod() {
+	SrIndexedMesh mesh = weldMesh(loadMeshBuffer("cerberus-mesh.buff"));
+	if (mesh.vertices.size() == 0) {
+		const int rings = 500, segments = 1000;
+		for (int i = 0; i <= rings; i++)
+			for (int j = 0; j <= segments; j++) {
+				float theta = i * 3.14159265f / rings, phi = j * 6.28318531f / segments;
+				SrVertex v;
+				v.normal = vec4(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi), 0.0f);
+				v.position = vec4(vec3(v.normal.xyz) * 0.5f, 1.0f);
+				v.uv = vec2(j / (float)segments, i / (float)rings);
+				v.color = vec4(1.0f);
+				mesh.vertices.push_back(v);
+			}
+		for (int i = 0; i < rings; i++)
+			for (int j = 0; j < segments; j++) {
+				unsigned int a = i * (segments + 1) + j, b = a + segments + 1;
+				mesh.indices32.insert(mesh.indices32.end(), { a, a + 1, b, a + 1, b + 1, b });
+			}
+	}
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	std::vector<unsigned int> lodIndices;
+	std::vector<SrMeshLod> lods = buildMeshLods(mesh, lodIndices);
+	double seconds = secondsSince(start);
+	std::cout << "lod: " << lods.size() << " levels of detail in " << seconds * 1000.0 << " ms" << std::endl;
+	for (size_t l = 0; l < lods.size(); l++)
+		std::cout << "lod: level " << l << ": " << lods[l].indexCount / 3 << " triangles, " << lods[l].vertexCount << " vertices, error "
+			<< lods[l].error << std::endl;
+	SrPackedMesh packed = packMesh(mesh, std::vector<SrMeshCluster>(), lods, lodIndices);
+	SrGPU gpu(1024, 1024);
+	float projectionScale = 1.0f; // 90 degrees vertical field of view
+	for (float distance = 1.0f / 128.0f; distance <= 1.0f; distance *= 2.0f) {
+		int lod = gpu.selectLod(packed, packed.boundsCenter + vec3(0.0f, 0.0f, packed.boundsRadius + distance), projectionScale);
+		std::cout << "lod: at " << distance << " from the bounds, level " << lod << " (" << lods[lod].indexCount / 3 << " triangles)" << std::endl;
+	}
+}
+
+// Shaders of the instancing benchmark: the loop of draws sets benchmarkWorld and benchmarkTint before each draw, the
+// instanced draw reads them from the instance
+mat4 benchmarkViewProjection, benchmarkWorld;
+vec4 benchmarkTint;
+std::vector<SrInstance> benchmarkInstances;
+SrVsOutput benchmarkVertexShader(SrGPU*, SrVertex& input) {
+	SrVsOutput out;
+	out.worldPosition = benchmarkWorld * vec4(input.position.xyz, 1.0f);
+	out.position = benchmarkViewProjection * out.worldPosition;
+	out.normal = benchmarkWorld * input.normal;
+	out.tangent = benchmarkWorld * input.tangent;
+	out.color = input.color * benchmarkTint;
+	out.uv = input.uv;
+	return out;
+}
+SrVsOutput benchmarkInstanceVertexShader(SrGPU*, SrVertex& input, const SrInstance& instance) {
+	SrVsOutput out;
+	out.worldPosition = instance.world * vec4(input.position.xyz, 1.0f);
+	out.position = benchmarkViewProjection * out.worldPosition;
+	out.normal = instance.world * input.normal;
+	out.tangent = instance.world * input.tangent;
+	out.color = input.color * instance.params;
+	out.uv = input.uv;
+	return out;
+}
+vec4 benchmarkFragmentShader(SrGPU*, SrFsInput& input) {
+	return vec4(input.color.xyz * max(normalize(input.worldNormal).z, 0.1f), 1.0f);
+}
+// A field of 1024 copies of a 8000 triangles sphere drawn with a draw per copy and with one instanced draw (the
+// pictures must match)
+void benchmarkInstancing() {
+	const int rings = 40, segments = 100, side = 32;
+	SrIndexedMesh sphere;
+	for (int i = 0; i <= rings; i++)
+		for (int j = 0; j <= segments; j++) {
+			float theta = i * 3.14159265f / rings, phi = j * 6.28318531f / segments;
+			SrVertex v;
+			v.normal = vec4(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi), 0.0f);
+			v.position = vec4(vec3(v.normal.xyz) * 0.4f, 1.0f);
+			v.tangent = vec4(-sin(phi), 0.0f, cos(phi), 0.0f);
+			v.bitangent = vec4(cross(vec3(v.normal.xyz), vec3(v.tangent.xyz)), 0.0f);
+			v.uv = vec2(j / (float)segments, i / (float)rings);
+			v.color = vec4(1.0f);
+			sphere.vertices.push_back(v);
+		}
+	for (int i = 0; i < rings; i++)
+		for (int j = 0; j < segments; j++) {
+			unsigned short a = (unsigned short)(i * (segments + 1) + j), b = (unsigned short)(a + segments + 1);
+			sphere.indices16.insert(sphere.indices16.end(), { a, b, (unsigned short)(a + 1), (unsigned short)(a + 1), b, (unsigned short)(b + 1) });
+		}
+	SrPackedMesh mesh = packMesh(sphere);
+	benchmarkInstances.clear();
+	for (int y = 0; y < side; y++)
+		for (int x = 0; x < side; x++) {
+			SrInstance instance;
+			instance.world = mat4(1.0f);
+			instance.world[3] = vec4(x - side * 0.5f + 0.5f, y - side * 0.5f + 0.5f, 0.0f, 1.0f);
+			instance.params = vec4(x / (float)side, y / (float)side, 1.0f, 1.0f);
+			benchmarkInstances.push_back(instance);
+		}
+	// Orthographic view of the field from +z
+	benchmarkViewProjection = mat4(1.0f);
+	benchmarkViewProjection[0][0] = benchmarkViewProjection[1][1] = 2.0f / side;
+	benchmarkViewProjection[2][2] = -0.5f;
+	SrGPU gpu(512, 512);
+	gpu.vertexShaderProgram = benchmarkVertexShader;
+	gpu.instanceVertexShaderProgram = benchmarkInstanceVertexShader;
+	gpu.fragmentShaderProgram = benchmarkFragmentShader;
+	gpu.clearBuffers();
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (size_t k = 0; k < benchmarkInstances.size(); k++) {
+		benchmarkWorld = benchmarkInstances[k].world;
+		benchmarkTint = benchmarkInstances[k].params;
+		gpu.submitPackedMesh(mesh, SrGPU::CullMode::CLOCKWISE);
+	}
+	double loopSeconds = secondsSince(start);
+	std::vector<vec4> picture(512 * 512);
+	for (int y = 0; y < 512; y++)
+		for (int x = 0; x < 512; x++) picture[x + y * 512] = gpu.backBuffer->read(x, y);
+	gpu.clearBuffers();
+	start = std::chrono::high_resolution_clock::now();
+	gpu.submitInstancedMesh(mesh, benchmarkInstances, SrGPU::CullMode::CLOCKWISE);
+	double instancedSeconds = secondsSince(start);
+	size_t different = 0, covered = 0;
+	for (int y = 0; y < 512; y++)
+		for (int x = 0; x < 512; x++) {
+			different += gpu.backBuffer->read(x, y) != picture[x + y * 512];
+			covered += picture[x + y * 512] != vec4(0, 0, 0, 1);
+		}
+	std::cout << "instancing: " << benchmarkInstances.size() << " copies of " << mesh.getIndexCount() / 3 << " triangles, a draw per copy "
+		<< loopSeconds * 1000.0 << " ms, instanced " << instancedSeconds * 1000.0 << " ms (" << srThreadCount() << " threads, "
+		<< covered << " pixels covered, " << different << " different)" << std::endl;
+}
+
+// A city of 160x160 boxes seen from the street level, rendered through the scene hierarchy with frustum culling only
+// and with occlusion culling too (the pictures must match)
+void benchmarkScene() {
+	const int side = 160;
+	// Box with a vertex per face corner, for the flat normals
+	SrIndexedMesh box;
+	for (int face = 0; face < 6; face++) {
+		int axis = face >> 1;
+		float sign = (face & 1) ? -1.0f : 1.0f;
+		vec3 normal(0.0f), u(0.0f), v(0.0f);
+		normal[axis] = sign;
+		u[(axis + 1) % 3] = 1.0f;
+		v[(axis + 2) % 3] = 1.0f;
+		for (int c = 0; c < 4; c++) {
+			SrVertex vertex;
+			vertex.position = vec4(normal * 0.5f + u * ((c & 1) - 0.5f) + v * ((c >> 1) - 0.5f) + vec3(0.0f, 0.0f, 0.5f), 1.0f);
+			vertex.normal = vec4(normal, 0.0f);
+			vertex.tangent = vec4(u, 0.0f);
+			vertex.bitangent = vec4(v, 0.0f);
+			vertex.uv = vec2(c & 1, c >> 1);
+			vertex.color = vec4(1.0f);
+			box.vertices.push_back(vertex);
+		}
+		unsigned short first = (unsigned short)(face * 4);
+		box.indices16.insert(box.indices16.end(), { first, (unsigned short)(first + 1), (unsigned short)(first + 2),
+			(unsigned short)(first + 2), (unsigned short)(first + 1), (unsigned short)(first + 3) });
+	}
+	SrPackedMesh mesh = packMesh(box);
+	SrScene scene;
+	for (int y = 0; y < side; y++)
+		for (int x = 0; x < side; x++) {
+			SrInstance instance;
+			instance.world = mat4(1.0f);
+			instance.world[0][0] = instance.world[1][1] = 1.6f;
+			instance.world[2][2] = 1.0f + 8.0f * rand() / (float)RAND_MAX;
+			instance.world[3] = vec4((x - side * 0.5f) * 2.0f, (y - side * 0.5f) * 2.0f, 0.0f, 1.0f);
+			instance.params = vec4(x / (float)side, y / (float)side, 1.0f, 1.0f);
+			scene.addObject(mesh, instance);
+		}
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	scene.build();
+	double buildSeconds = secondsSince(start);
+	vec3 eye(1.0f, -40.0f, 2.0f);
+	benchmarkViewProjection = perspectiveFov(radians(90.0f), 256.0f, 256.0f, 0.1f, 1000.0f) * lookAt(eye, eye + vec3(0.3f, 1.0f, 0.0f), vec3(0, 0, 1));
+	SrGPU gpu(256, 256);
+	gpu.instanceVertexShaderProgram = benchmarkInstanceVertexShader;
+	gpu.fragmentShaderProgram = benchmarkFragmentShader;
+	std::vector<vec4> picture(256 * 256);
+	size_t different = 0;
+	for (int occlusion = 0; occlusion < 2; occlusion++) {
+		gpu.clearBuffers();
+		start = std::chrono::high_resolution_clock::now();
+		SrSceneStats stats = scene.render(gpu, benchmarkViewProjection, SrGPU::CullMode::NOCULLING, occlusion == 1);
+		double seconds = secondsSince(start);
+		for (int y = 0; y < 256; y++)
+			for (int x = 0; x < 256; x++) {
+				if (occlusion == 1) different += gpu.backBuffer->read(x, y) != picture[x + y * 256];
+				picture[x + y * 256] = gpu.backBuffer->read(x, y);
+			}
+		std::cout << "scene: " << (occlusion ? "frustum and occlusion culling " : "frustum culling ") << seconds * 1000.0 << " ms, "
+			<< stats.objectsDrawn << " of " << scene.getObjectCount() << " objects drawn (" << stats.trianglesDrawn << " triangles), "
+			<< stats.nodesVisited << " nodes visited, " << stats.frustumCulled << " frustum culled, " << stats.occlusionCulled << " occlusion culled" << std::endl;
+	}
+	std::cout << "scene: hierarchy built in " << buildSeconds * 1000.0 << " ms, " << different << " different pixels" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	std::string name = argc > 1 ? argv[1] : "";
+#ifdef SR_SSE
+	std::cout << "SIMD kernels enabled (" << SR_SIMD_LANES << " lanes)" << std::endl;
+#else
+	std::cout << "SIMD kernels disabled" << std::endl;
+#endif
+	if (name == "" || name == "sampling") benchmarkSampling();
+	if (name == "" || name == "anisotropic") benchmarkAnisotropic();
+	if (name == "" || name == "image") benchmarkImageLoad();
+	if (name == "" || name == "mipmaps") benchmarkMipmaps();
+	if (name == "" || name == "emap") benchmarkEmapLoad();
+	if (name == "" || name == "environment") benchmarkEnvironment();
+	if (name == "" || name == "irradiance") benchmarkIrradiance();
+	if (name == "" || name == "residency") benchmarkResidency();
+	if (name == "" || name == "virtual") benchmarkVirtual();
+	if (name == "" || name == "mesh") benchmarkMeshLoad();
+	if (name == "" || name == "meshopt") benchmarkMeshOptimizer();
+	if (name == "" || name == "formats") benchmarkMeshFormats();
+	if (name == "" || name == "tangents") benchmarkTangents();
+	if (name == "" || name == "lod") benchmarkLod();
+	if (name == "" || name == "instancing") benchmarkInstancing();
+	if (name == "" || name == "scene") benchmarkScene();
+	return 0;
+}
@@ -0,0 +1,302 @@
+// Author: Andrea Luzzati
+#ifndef SR_COMPRESSION_H
+#define SR_COMPRESSION_H
+#include <cstring> // for memset
+#include <cmath>   // for sqrt
+#include <cstdlib> // for abs
+
+/* Block compression codecs (BC1, BC4, BC5 and BC7) used by SrTexture to store textures in the same formats
+   GPUs use. Every format works on 4x4 texel blocks; the functions below encode/decode a single block from/to
+   16 RGBA8 texels stored left to right, top to bottom (rgbargbargba...).
+   - BC1: 8 bytes per block, RGB 5:6:5 endpoints with 2 bit indices (1-bit alpha in 3-color mode)
+   - BC4: 8 bytes per block, a single channel with 8 bit endpoints and 3 bit indices
+   - BC5: 16 bytes per block, two BC4 blocks for the red and green channels (normal maps)
+   - BC7: 16 bytes per block, high quality RGBA. The encoder only emits mode 6 (single subset, 7777.1 endpoints,
+     4 bit indices), the decoder handles the non-partitioned modes 4, 5 and 6. Partitioned modes are not
+     produced by this encoder and decode to zero like reserved modes do. */
+
+// Helpers to read/write an arbitrary number of bits from a block, least significant bit first
+static inline unsigned int bcReadBits(const unsigned char* block, int& pos, const int count) {
+	unsigned int value = 0;
+	for (int i = 0; i < count; i++, pos++)
+		value |= ((block[pos >> 3] >> (pos & 7)) & 1u) << i;
+	return value;
+}
+static inline void bcWriteBits(unsigned char* block, int& pos, unsigned int value, const int count) {
+	for (int i = 0; i < count; i++, pos++)
+		block[pos >> 3] |= ((value >> i) & 1u) << (pos & 7);
+}
+// Finds two endpoints along the principal axis of the block texels (channels values per texel, 16 texels)
+static void bcPrincipalEndpoints(const float* texels, const int channels, float* e0, float* e1) {
+	float mean[4] = { 0,0,0,0 }, cov[4][4], axis[4], tmp[4];
+	for (int t = 0; t < 16; t++)
+		for (int c = 0; c < channels; c++)
+			mean[c] += texels[t * channels + c] / 16.0f;
+	memset(cov, 0, sizeof(cov));
+	for (int t = 0; t < 16; t++)
+		for (int i = 0; i < channels; i++)
+			for (int j = 0; j < channels; j++)
+				cov[i][j] += (texels[t * channels + i] - mean[i]) * (texels[t * channels + j] - mean[j]);
+	// Power iteration starting from the channel with the largest spread
+	for (int c = 0; c < channels; c++) axis[c] = cov[c][c];
+	for (int it = 0; it < 8; it++) {
+		float norm = 0.0f;
+		for (int i = 0; i < channels; i++) {
+			tmp[i] = 0.0f;
+			for (int j = 0; j < channels; j++) tmp[i] += cov[i][j] * axis[j];
+			norm = tmp[i] * tmp[i] > norm ? tmp[i] * tmp[i] : norm;
+		}
+		if (norm == 0.0f) break;
+		norm = 1.0f / sqrtf(norm);
+		for (int c = 0; c < channels; c++) axis[c] = tmp[c] * norm;
+	}
+	float len = 0.0f;
+	for (int c = 0; c < channels; c++) len += axis[c] * axis[c];
+	if (len == 0.0f) { // flat block
+		for (int c = 0; c < channels; c++) e0[c] = e1[c] = mean[c];
+		return;
+	}
+	len = 1.0f / sqrtf(len);
+	for (int c = 0; c < channels; c++) axis[c] *= len;
+	float tMin = 0.0f, tMax = 0.0f;
+	for (int t = 0; t < 16; t++) {
+		float d = 0.0f;
+		for (int c = 0; c < channels; c++) d += (texels[t * channels + c] - mean[c]) * axis[c];
+		if (d < tMin) tMin = d;
+		if (d > tMax) tMax = d;
+	}
+	for (int c = 0; c < channels; c++) {
+		e0[c] = mean[c] + axis[c] * tMax;
+		e1[c] = mean[c] + axis[c] * tMin;
+		e0[c] = e0[c] < 0.0f ? 0.0f : (e0[c] > 255.0f ? 255.0f : e0[c]);
+		e1[c] = e1[c] < 0.0f ? 0.0f : (e1[c] > 255.0f ? 255.0f : e1[c]);
+	}
+}
+
+// BC1 ---------------------------------------------------------------------------------------------------------
+static void bc1Palette(unsigned short c0, unsigned short c1, unsigned char palette[4][4]) {
+	unsigned char r0 = (c0 >> 11) & 31, g0 = (c0 >> 5) & 63, b0 = c0 & 31;
+	unsigned char r1 = (c1 >> 11) & 31, g1 = (c1 >> 5) & 63, b1 = c1 & 31;
+	palette[0][0] = (r0 << 3) | (r0 >> 2); palette[0][1] = (g0 << 2) | (g0 >> 4); palette[0][2] = (b0 << 3) | (b0 >> 2);
+	palette[1][0] = (r1 << 3) | (r1 >> 2); palette[1][1] = (g1 << 2) | (g1 >> 4); palette[1][2] = (b1 << 3) | (b1 >> 2);
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	for (int c = 0; c < 3; c++) {
+		if (c0 > c1) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	palette[3][3] = c0 > c1 ? 255 : 0;
+}
+void bc1DecodeBlock(const unsigned char* block, unsigned char* rgba) {
+	unsigned char palette[4][4];
+	bc1Palette(block[0] | (block[1] << 8), block[2] | (block[3] << 8), palette);
+	unsigned int indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+	for (int t = 0; t < 16; t++)
+		memcpy(&rgba[t * 4], palette[(indices >> (t * 2)) & 3], 4);
+}
+void bc1EncodeBlock(const unsigned char* rgba, unsigned char* block) {
+	float texels[16 * 3], e0[3], e1[3];
+	for (int t = 0; t < 16; t++)
+		for (int c = 0; c < 3; c++)
+			texels[t * 3 + c] = rgba[t * 4 + c];
+	bcPrincipalEndpoints(texels, 3, e0, e1);
+	unsigned short c0 = ((int)(e0[0] * 31.0f / 255.0f + 0.5f) << 11) | ((int)(e0[1] * 63.0f / 255.0f + 0.5f) << 5) | (int)(e0[2] * 31.0f / 255.0f + 0.5f);
+	unsigned short c1 = ((int)(e1[0] * 31.0f / 255.0f + 0.5f) << 11) | ((int)(e1[1] * 63.0f / 255.0f + 0.5f) << 5) | (int)(e1[2] * 31.0f / 255.0f + 0.5f);
+	if (c0 < c1) { unsigned short s = c0; c0 = c1; c1 = s; } // c0 > c1 selects the opaque 4-color mode
+	unsigned char palette[4][4];
+	bc1Palette(c0, c1, palette);
+	unsigned int indices = 0;
+	if (c0 != c1) {
+		for (int t = 0; t < 16; t++) {
+			int best = 0, bestError = 0x7fffffff;
+			for (int i = 0; i < 4; i++) {
+				int error = 0;
+				for (int c = 0; c < 3; c++)
+					error += (palette[i][c] - rgba[t * 4 + c]) * (palette[i][c] - rgba[t * 4 + c]);
+				if (error < bestError) { bestError = error; best = i; }
+			}
+			indices |= best << (t * 2);
+		}
+	}
+	block[0] = c0 & 255; block[1] = c0 >> 8;
+	block[2] = c1 & 255; block[3] = c1 >> 8;
+	block[4] = indices & 255; block[5] = (indices >> 8) & 255;
+	block[6] = (indices >> 16) & 255; block[7] = indices >> 24;
+}
+
+// BC4 / BC5 ---------------------------------------------------------------------------------------------------
+static void bc4Palette(unsigned char r0, unsigned char r1, unsigned char palette[8]) {
+	palette[0] = r0;
+	palette[1] = r1;
+	if (r0 > r1)
+		for (int i = 1; i < 7; i++) palette[i + 1] = ((7 - i) * r0 + i * r1) / 7;
+	else {
+		for (int i = 1; i < 5; i++) palette[i + 1] = ((5 - i) * r0 + i * r1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+// Decodes a single channel block into rgba[t*stride] for the 16 texels
+void bc4DecodeBlock(const unsigned char* block, unsigned char* channel, const int stride = 4) {
+	unsigned char palette[8];
+	bc4Palette(block[0], block[1], palette);
+	unsigned long long indices = 0;
+	for (int i = 0; i < 6; i++) indices |= (unsigned long long)block[2 + i] << (i * 8);
+	for (int t = 0; t < 16; t++)
+		channel[t * stride] = palette[(indices >> (t * 3)) & 7];
+}
+// Encodes a single channel read from channel[t*stride] for the 16 texels
+void bc4EncodeBlock(const unsigned char* channel, unsigned char* block, const int stride = 4) {
+	unsigned char r0 = 0, r1 = 255, palette[8];
+	for (int t = 0; t < 16; t++) {
+		if (channel[t * stride] > r0) r0 = channel[t * stride];
+		if (channel[t * stride] < r1) r1 = channel[t * stride];
+	}
+	bc4Palette(r0, r1, palette);
+	unsigned long long indices = 0;
+	if (r0 != r1) {
+		for (int t = 0; t < 16; t++) {
+			int best = 0, bestError = 256;
+			for (int i = 0; i < 8; i++) {
+				int error = abs(palette[i] - channel[t * stride]);
+				if (error < bestError) { bestError = error; best = i; }
+			}
+			indices |= (unsigned long long)best << (t * 3);
+		}
+	}
+	block[0] = r0;
+	block[1] = r1;
+	for (int i = 0; i < 6; i++) block[2 + i] = (indices >> (i * 8)) & 255;
+}
+void bc5DecodeBlock(const unsigned char* block, unsigned char* rgba) {
+	bc4DecodeBlock(block, &rgba[0]);
+	bc4DecodeBlock(block + 8, &rgba[1]);
+}
+void bc5EncodeBlock(const unsigned char* rgba, unsigned char* block) {
+	bc4EncodeBlock(&rgba[0], block);
+	bc4EncodeBlock(&rgba[1], block + 8);
+}
+
+// BC7 ---------------------------------------------------------------------------------------------------------
+static const int bc7Weights2[4] = { 0, 21, 43, 64 };
+static const int bc7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+static inline unsigned char bc7Interpolate(int e0, int e1, int weight) {
+	return (unsigned char)(((64 - weight) * e0 + weight * e1 + 32) >> 6);
+}
+void bc7DecodeBlock(const unsigned char* block, unsigned char* rgba) {
+	int mode = 0;
+	while (mode < 8 && !(block[0] & (1 << mode))) mode++;
+	if (mode < 4 || mode > 6) { // partitioned or reserved mode
+		memset(rgba, 0, 64);
+		return;
+	}
+	int pos = mode + 1;
+	int e[2][4]; // endpoints (8 bit per channel)
+	if (mode == 6) {
+		for (int c = 0; c < 4; c++) {
+			e[0][c] = bcReadBits(block, pos, 7) << 1;
+			e[1][c] = bcReadBits(block, pos, 7) << 1;
+		}
+		int p0 = bcReadBits(block, pos, 1), p1 = bcReadBits(block, pos, 1);
+		for (int c = 0; c < 4; c++) { e[0][c] |= p0; e[1][c] |= p1; }
+		for (int t = 0; t < 16; t++) {
+			int index = bcReadBits(block, pos, t == 0 ? 3 : 4);
+			for (int c = 0; c < 4; c++)
+				rgba[t * 4 + c] = bc7Interpolate(e[0][c], e[1][c], bc7Weights4[index]);
+		}
+		return;
+	}
+	// Modes 4 and 5: separate color and alpha indices, with channel rotation
+	int rotation = bcReadBits(block, pos, 2);
+	int indexMode = mode == 4 ? bcReadBits(block, pos, 1) : 0;
+	int colorBits = mode == 4 ? 5 : 7, alphaBits = mode == 4 ? 6 : 8;
+	for (int c = 0; c < 3; c++) {
+		e[0][c] = bcReadBits(block, pos, colorBits) << (8 - colorBits);
+		e[1][c] = bcReadBits(block, pos, colorBits) << (8 - colorBits);
+		e[0][c] |= e[0][c] >> colorBits;
+		e[1][c] |= e[1][c] >> colorBits;
+	}
+	e[0][3] = bcReadBits(block, pos, alphaBits) << (8 - alphaBits);
+	e[1][3] = bcReadBits(block, pos, alphaBits) << (8 - alphaBits);
+	e[0][3] |= e[0][3] >> alphaBits;
+	e[1][3] |= e[1][3] >> alphaBits;
+	int primary[16], secondary[16];
+	int primaryBits = 2, secondaryBits = mode == 4 ? 3 : 2;
+	for (int t = 0; t < 16; t++) primary[t] = bcReadBits(block, pos, t == 0 ? primaryBits - 1 : primaryBits);
+	for (int t = 0; t < 16; t++) secondary[t] = bcReadBits(block, pos, t == 0 ? secondaryBits - 1 : secondaryBits);
+	const int* primaryWeights = bc7Weights2;
+	const int* secondaryWeights = mode == 4 ? bc7Weights3 : bc7Weights2;
+	for (int t = 0; t < 16; t++) {
+		int colorWeight = indexMode ? secondaryWeights[secondary[t]] : primaryWeights[primary[t]];
+		int alphaWeight = indexMode ? primaryWeights[primary[t]] : secondaryWeights[secondary[t]];
+		unsigned char* texel = &rgba[t * 4];
+		for (int c = 0; c < 3; c++)
+			texel[c] = bc7Interpolate(e[0][c], e[1][c], colorWeight);
+		texel[3] = bc7Interpolate(e[0][3], e[1][3], alphaWeight);
+		if (rotation > 0) { unsigned char s = texel[3]; texel[3] = texel[rotation - 1]; texel[rotation - 1] = s; }
+	}
+}
+void bc7EncodeBlock(const unsigned char* rgba, unsigned char* block) {
+	float texels[16 * 4], ef[2][4];
+	for (int t = 0; t < 64; t++) texels[t] = rgba[t];
+	bcPrincipalEndpoints(texels, 4, ef[0], ef[1]);
+	// Quantize the endpoints to 7 bits + shared p-bit choosing the p-bit with the lowest error
+	int q[2][4], p[2];
+	for (int k = 0; k < 2; k++) {
+		float bestError = 1e30f;
+		for (int pb = 0; pb < 2; pb++) {
+			int qq[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++) {
+				qq[c] = (int)((ef[k][c] - pb) * 0.5f + 0.5f);
+				qq[c] = qq[c] < 0 ? 0 : (qq[c] > 127 ? 127 : qq[c]);
+				float d = (float)((qq[c] << 1) | pb) - ef[k][c];
+				error += d * d;
+			}
+			if (error < bestError) {
+				bestError = error;
+				p[k] = pb;
+				memcpy(q[k], qq, sizeof(qq));
+			}
+		}
+	}
+	unsigned char palette[16][4];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			palette[i][c] = bc7Interpolate((q[0][c] << 1) | p[0], (q[1][c] << 1) | p[1], bc7Weights4[i]);
+	int indices[16];
+	for (int t = 0; t < 16; t++) {
+		int best = 0, bestError = 0x7fffffff;
+		for (int i = 0; i < 16; i++) {
+			int error = 0;
+			for (int c = 0; c < 4; c++)
+				error += (palette[i][c] - rgba[t * 4 + c]) * (palette[i][c] - rgba[t * 4 + c]);
+			if (error < bestError) { bestError = error; best = i; }
+		}
+		indices[t] = best;
+	}
+	// The first texel index is stored with 3 bits (its MSB must be 0): swap the endpoints otherwise
+	if (indices[0] & 8) {
+		for (int c = 0; c < 4; c++) { int s = q[0][c]; q[0][c] = q[1][c]; q[1][c] = s; }
+		int s = p[0]; p[0] = p[1]; p[1] = s;
+		for (int t = 0; t < 16; t++) indices[t] = 15 - indices[t];
+	}
+	memset(block, 0, 16);
+	int pos = 0;
+	bcWriteBits(block, pos, 1 << 6, 7); // mode 6
+	for (int c = 0; c < 4; c++) {
+		bcWriteBits(block, pos, q[0][c], 7);
+		bcWriteBits(block, pos, q[1][c], 7);
+	}
+	bcWriteBits(block, pos, p[0], 1);
+	bcWriteBits(block, pos, p[1], 1);
+	for (int t = 0; t < 16; t++)
+		bcWriteBits(block, pos, indices[t], t == 0 ? 3 : 4);
+}
+#endif
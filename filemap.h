@@ -0,0 +1,78 @@
+// Author: Andrea Luzzati
+#ifndef SR_FILEMAP_H
+#define SR_FILEMAP_H
+#include <cstddef>                     // for size_t
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX                       // keep windows.h from defining min and max (glm)
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>                   // for CreateFileMapping, MapViewOfFile
+#else
+#include <sys/mman.h>                  // for mmap
+#include <sys/stat.h>                  // for fstat
+#include <fcntl.h>                     // for open
+#include <unistd.h>                    // for close
+#endif
+
+/* Read-only view of a whole file mapped in memory: the pages are loaded by the OS on first access (and shared with
+   the page cache), so opening is immediate and the data is never copied. With copyOnWrite the view can be written,
+   modified pages becoming private to the process (the file is never modified). */
+class SrFileMapping {
+private:
+	unsigned char* view;
+	size_t bytes;
+public:
+	SrFileMapping() : view(NULL), bytes(0) {}
+	~SrFileMapping() { close(); }
+	// Not copyable: the copy would unmap the view a second time
+	SrFileMapping(const SrFileMapping&) = delete;
+	SrFileMapping& operator=(const SrFileMapping&) = delete;
+	// Maps the file fname, returns false if it cannot be opened or is empty
+	bool open(const char* fname, const bool copyOnWrite = false) {
+		close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		HANDLE mapping = NULL;
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+			mapping = CreateFileMappingA(file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (mapping == NULL) return false;
+		view = (unsigned char*)MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping); // the view keeps the mapping alive
+		if (view == NULL) return false;
+		bytes = (size_t)size.QuadPart;
+#else
+		int file = ::open(fname, O_RDONLY);
+		if (file < 0) return false;
+		struct stat info;
+		if (fstat(file, &info) != 0 || info.st_size <= 0) {
+			::close(file);
+			return false;
+		}
+		void* address = mmap(NULL, (size_t)info.st_size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, file, 0);
+		::close(file); // the mapping keeps the file alive
+		if (address == MAP_FAILED) return false;
+		view = (unsigned char*)address;
+		bytes = (size_t)info.st_size;
+#endif
+		return true;
+	}
+	// Unmaps the file, invalidating every pointer to its data
+	void close() {
+		if (view == NULL) return;
+#ifdef _WIN32
+		UnmapViewOfFile(view);
+#else
+		munmap(view, bytes);
+#endif
+		view = NULL;
+		bytes = 0;
+	}
+	bool isOpen() const { return view != NULL; }
+	unsigned char* data() const { return view; }
+	size_t size() const { return bytes; }
+};
+#endif
@@ -3,6 +3,7 @@
 #define SR_GPU_H
 #include "texture.h" // includes vector,glm,iostream,stb_image
 #include <limits>    // for float max (depthbuffer clearing)
+#include <memory>    // for shared_ptr
 
 using namespace glm;
 
@@ -24,6 +25,7 @@ struct SrVsOutput {
 	vec4 tangent;       // world space tangent
 	vec4 color;
 	vec2 uv;
+	int instanceID;     // set by the pipeline: the index of the instance of an instanced draw, 0 otherwise
 };
 struct SrFsInput {
 	vec3 worldPosition;
@@ -32,8 +34,116 @@ struct SrFsInput {
 	vec2 position; // screen space position
 	vec2 uv;
 	vec4 color;
+	int instanceID; // see SrVsOutput
+};
+/* Per-instance data of an instanced draw (see SrGPU::submitInstancedMesh): the world transform of the copy and free
+   parameters for the shaders (e.g. a material tint) */
+struct SrInstance {
+	mat4 world;
+	vec4 params;
 };
 typedef std::vector<SrTriangle> SrMesh;
+/* Indexed triangle list (see weldMesh): every three indices form a triangle of vertices. The indices are 16 bit
+   (indices16) when there are at most 65536 vertices, 32 bit (indices32) otherwise; the other array is empty. */
+struct SrIndexedMesh {
+	std::vector<SrVertex> vertices;
+	std::vector<unsigned short> indices16;
+	std::vector<unsigned int> indices32;
+	size_t getIndexCount() const { return indices16.size() > 0 ? indices16.size() : indices32.size(); }
+	unsigned int getIndex(const size_t i) const { return indices16.size() > 0 ? indices16[i] : indices32[i]; }
+};
+/* Compact vertex (24 bytes instead of the 88 of SrVertex, see packMesh) decoded by the vertex fetch of
+   SrGPU::submitPackedMesh: the position is quantized to 16 bits per axis within the mesh bounds, the normal and the
+   tangent are octahedral encoded in two 16 bit snorms each, the bitangent is cross(tangent, normal) times
+   bitangentSign, the uv are half floats and the color is rgba u8. */
+struct SrPackedVertex {
+	unsigned short position[3];
+	short bitangentSign;
+	short normal[2];
+	short tangent[2];
+	unsigned short uv[2];
+	unsigned char color[4];
+};
+/* Range of consecutive triangles of a mesh (see buildMeshClusters) with its bounding sphere and its normal cone: the
+   cluster faces away from a viewer at p when dot(center - p, coneAxis) >= coneCutoff * length(center - p) + radius */
+struct SrMeshCluster {
+	unsigned int firstTriangle;
+	unsigned int triangleCount;
+	float center[3];
+	float radius;
+	float coneAxis[3];
+	float coneCutoff; // 1 or more when the cluster is never back facing
+};
+/* Level of detail of a mesh (see buildMeshLods): indexCount indices from firstIndex, using the first vertexCount
+   vertices, whose surface is within error of the full detail one */
+struct SrMeshLod {
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	unsigned int vertexCount;
+	float error;
+};
+/* Indexed mesh of packed vertices (see SrIndexedMesh and packMesh), with the bounds to decode the positions and
+   optionally its clusters and its levels of detail. The arrays belong to storage, shared by the copies of the mesh: the vectors built by
+   packMesh or the file mapped by meshFromContainer. */
+struct SrPackedMesh {
+	const SrPackedVertex* vertices;
+	size_t vertexCount;
+	const unsigned short* indices16; // NULL with 32 bit indices
+	const unsigned int* indices32;   // NULL with 16 bit indices
+	size_t indexCount; // of all the levels of detail
+	const SrMeshCluster* clusters; // of the full detail triangles
+	size_t clusterCount;
+	const SrMeshLod* lods; // the first one is the full detail mesh
+	size_t lodCount;
+	vec3 boundsMin;    // position of the quantized position 0
+	vec3 boundsScale;  // position step of one quantization unit
+	vec3 boundsCenter; // bounding sphere
+	float boundsRadius;
+	std::shared_ptr<void> storage;
+	SrPackedMesh() : vertices(NULL), vertexCount(0), indices16(NULL), indices32(NULL), indexCount(0), clusters(NULL), clusterCount(0),
+		lods(NULL), lodCount(0), boundsMin(0.0f), boundsScale(0.0f), boundsCenter(0.0f), boundsRadius(0.0f) {}
+	size_t getIndexCount() const { return lodCount > 0 ? lods[0].indexCount : indexCount; }
+	unsigned int getIndex(const size_t i) const { return indices16 != NULL ? indices16[i] : indices32[i]; }
+	size_t getMemoryUsage() const {
+		return vertexCount * sizeof(SrPackedVertex) + indexCount * (indices16 != NULL ? 2 : 4) + clusterCount * sizeof(SrMeshCluster) + lodCount * sizeof(SrMeshLod);
+	}
+};
+// Converts a half float (IEEE 754 binary16) to float
+static inline float srHalfToFloat(const unsigned short h) {
+	unsigned int sign = (unsigned int)(h & 0x8000) << 16, exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF, bits;
+	if (exponent == 0x1F) bits = sign | 0x7F800000 | mantissa << 13; // inf, nan
+	else if (exponent != 0) bits = sign | (exponent + 112) << 23 | mantissa << 13;
+	else { // zero, subnormal
+		float f = mantissa * (1.0f / 16777216.0f);
+		return sign ? -f : f;
+	}
+	float f;
+	memcpy(&f, &bits, sizeof(float));
+	return f;
+}
+// Octahedral mapping of a direction (see SrTexture::octahedralEncode) quantized to two snorms in -32767,32767
+static inline void srOctahedralEncode(vec3 v, short e[2]) {
+	if (abs(v.x) + abs(v.y) + abs(v.z) <= 0.0f) v = vec3(0, 0, 1);
+	vec2 p = SrTexture::octahedralEncode(v) * 2.0f - vec2(1.0f);
+	for (int c = 0; c < 2; c++) e[c] = (short)floor(clamp(p[c], -1.0f, 1.0f) * 32767.0f + 0.5f);
+}
+// Decodes a unit vector quantized by srOctahedralEncode
+static inline vec3 srOctahedralDecode(const short* e) {
+	return SrTexture::octahedralDecode(vec2(e[0], e[1]) * (0.5f / 32767.0f) + vec2(0.5f));
+}
+// Vertex fetch of a packed mesh: decodes its i-th vertex
+static inline SrVertex unpackVertex(const SrPackedMesh& mesh, const size_t i) {
+	const SrPackedVertex& p = mesh.vertices[i];
+	SrVertex v;
+	v.position = vec4(mesh.boundsMin + vec3(p.position[0], p.position[1], p.position[2]) * mesh.boundsScale, 1.0f);
+	vec3 normal = srOctahedralDecode(p.normal), tangent = srOctahedralDecode(p.tangent);
+	v.normal = vec4(normal, 0.0f);
+	v.tangent = vec4(tangent, 0.0f);
+	v.bitangent = vec4(normalize(cross(tangent, normal)) * (float)p.bitangentSign, 0.0f);
+	v.color = vec4(p.color[0], p.color[1], p.color[2], p.color[3]) / 255.0f;
+	v.uv = vec2(srHalfToFloat(p.uv[0]), srHalfToFloat(p.uv[1]));
+	return v;
+}
 
 class SrGPU {
 private:
@@ -45,6 +155,8 @@ private:
 	bool verticalRasterTriangle(vec2 p1, vec2 p2, vec2 p3, SrVsOutput& svo1, SrVsOutput& svo2, SrVsOutput& svo3);
 	vec3 computeBarycentricCoefficients(SrVsOutput& svo1, SrVsOutput& svo2, SrVsOutput& svo3, vec2 ssp, float trisSSArea);
 	vec3 correctBarycentricCoefficients(SrVsOutput& svo1, SrVsOutput& svo2, SrVsOutput& svo3, vec3& baryCoeffs);
+	// Side of the texels of the virtual textures feedback buffer (see setFeedbackScale), at least 1
+	int feedbackScale;
 
 	
 public:
@@ -56,9 +168,17 @@ public:
 	SrTexture* depthBuffer; // TODO: would be better to make it private
 	std::vector<SrTexture*> samplers; // TODO: would be better to make it private
 	SrTexture* backBuffer; // TODO: would be better to make it 
+	/* Sets the size in pixels of the side of the texels of the virtual textures feedback buffer (see
+	   SrTexture::textureFromVirtual, 8 by default): the rasterizer records the pages requested by one pixel out of
+	   scale x scale. Values below 1 are clamped to 1 (every pixel). */
+	void setFeedbackScale(const int scale);
+	int getFeedbackScale();
 
 	// Vertex shader function pointer to allow for custom pipeline
 	SrVsOutput(*vertexShaderProgram)(SrGPU*,SrVertex&);
+	// Vertex shader of the instanced draws, receiving the data of the instance; it runs on the worker threads (NULL
+	// until set, the instanced draws are skipped without it)
+	SrVsOutput(*instanceVertexShaderProgram)(SrGPU*, SrVertex&, const SrInstance&);
 	// Fragment shader function pointer to allow for custom pipeline
 	vec4(*fragmentShaderProgram)(SrGPU*,SrFsInput&);
 	// Initialize the gpu with a given viewport size
@@ -66,10 +186,38 @@ public:
 	~SrGPU();
 	// Render a 3D mesh
 	void submitMesh(SrMesh& triangle, const CullMode culling = NOCULLING);
+	// Render an indexed 3D mesh: the vertex shader runs once per vertex, however many triangles share it
+	void submitIndexedMesh(SrIndexedMesh& mesh, const CullMode culling = NOCULLING);
+	// Render an indexed mesh of packed vertices (see packMesh), decoding every vertex once before the vertex shader
+	void submitPackedMesh(SrPackedMesh& mesh, const CullMode culling = NOCULLING);
+	/* Level of detail of a packed mesh to draw from viewPosition (in the space of the mesh): the coarsest one whose
+	   error, projected at the distance of the mesh bounds, stays within maxPixelError pixels of the backbuffer.
+	   projectionScale is the vertical scale of the projection matrix (matProjection[1][1], 1/tan(fovy/2)) */
+	int selectLod(const SrPackedMesh& mesh, const vec3& viewPosition, const float projectionScale, const float maxPixelError = 1.0f) const;
+	// Render the level of detail of a packed mesh selected as above, shading only its vertices; returns the level drawn
+	int submitPackedMesh(SrPackedMesh& mesh, const vec3& viewPosition, const float projectionScale, const float maxPixelError = 1.0f,
+		const CullMode culling = NOCULLING);
+	/* Render a copy of a mesh per instance through instanceVertexShaderProgram, the instance index reaching the
+	   fragment shader as instanceID. The vertices of the instances are shaded in parallel on the worker threads, a
+	   batch of instances at a time, then their triangles are drawn in instance order. */
+	void submitInstancedMesh(SrIndexedMesh& mesh, const std::vector<SrInstance>& instances, const CullMode culling = NOCULLING);
+	// Same as above for a packed mesh (full detail), its vertices are decoded once for all the instances
+	void submitInstancedMesh(SrPackedMesh& mesh, const std::vector<SrInstance>& instances, const CullMode culling = NOCULLING);
 	// Clear backbuffer and depthbuffer to initialize the rendering cycle
 	void clearBuffers(const vec4 color=vec4(0,0,0,1));
 	// Fills the screen through the fragment shader
 	void drawFillQuad();
+private:
+	// Culls and rasterizes a triangle of vertex shader outputs after the perspective division
+	void drawTriangle(SrVsOutput vso1, SrVsOutput vso2, SrVsOutput vso3, const CullMode culling);
+	// Draws the triangles of indexCount indices from firstIndex of an indexed mesh from the projected outputs of its vertices
+	template<class Mesh> void drawIndexedTriangles(const Mesh& mesh, std::vector<SrVsOutput>& outputs, const size_t firstIndex,
+		const size_t indexCount, const CullMode culling);
+	// Decodes and shades the first vertexCount vertices of a packed mesh, then draws indexCount indices from firstIndex
+	void drawPackedMesh(const SrPackedMesh& mesh, const size_t vertexCount, const size_t firstIndex, const size_t indexCount, const CullMode culling);
+	// Shades the vertices of a mesh for every instance and draws its triangles (see submitInstancedMesh)
+	template<class Mesh> void drawInstances(const Mesh& mesh, const SrVertex* vertices, const size_t vertexCount,
+		const std::vector<SrInstance>& instances, const CullMode culling);
 };
 
 
@@ -79,6 +227,14 @@ SrGPU::SrGPU(const int vpw, const int vph) {
 	depthBuffer = new SrTexture();
 	backBuffer->textureFromColor(vpw, vph, vec4(0, 0, 0, 1));
 	depthBuffer->textureFromColor(vpw, vph, vec4(std::numeric_limits<float>::max()));
+	feedbackScale = 8;
+	instanceVertexShaderProgram = NULL;
+}
+void SrGPU::setFeedbackScale(const int scale) {
+	feedbackScale = max(scale, 1);
+}
+int SrGPU::getFeedbackScale() {
+	return feedbackScale;
 }
 SrGPU::~SrGPU() {
 	delete backBuffer;
@@ -87,12 +243,14 @@ SrGPU::~SrGPU() {
 void SrGPU::clearBuffers(const vec4 col) {
 	backBuffer->clear(col);
 	depthBuffer->clear(vec4(std::numeric_limits<float>::max()));
+	int feedbackWidth = (backBuffer->getTextureWidth() + feedbackScale - 1) / feedbackScale;
+	int feedbackHeight = (backBuffer->getTextureHeight() + feedbackScale - 1) / feedbackScale;
+	for (std::vector<SrTexture*>::iterator it = samplers.begin(); it != samplers.end(); it++)
+		if ((*it)->isVirtual()) (*it)->clearVirtualFeedback(feedbackWidth * feedbackHeight);
 }
 void SrGPU::submitMesh(SrMesh& mesh, const SrGPU::CullMode culling) {
 	std::vector<SrTriangle>::iterator it;
-	vec2 size = vec2(backBuffer->getTextureWidth(), backBuffer->getTextureHeight());
 	SrVsOutput vso1, vso2, vso3;
-	SrFsInput fragmentInput;
 	for (it = mesh.begin(); it != mesh.end(); it++) {
 		vso1 = vertexShaderProgram(this,(*it).a);
 		vso2 = vertexShaderProgram(this,(*it).b);
@@ -102,16 +260,99 @@ void SrGPU::submitMesh(SrMesh& mesh, const SrGPU::CullMode culling) {
 		vso1.position = vec4(vso1.position.xyz * (1.0f / vso1.position.w), vso1.position.w);
 		vso2.position = vec4(vso2.position.xyz * (1.0f / vso2.position.w), vso2.position.w);
 		vso3.position = vec4(vso3.position.xyz * (1.0f / vso3.position.w), vso3.position.w);
+		vso1.instanceID = vso2.instanceID = vso3.instanceID = 0;
 
-		if (culling != CullMode::NOCULLING) {
-			vec3 viewRay(0, 0, culling == CullMode::CLOCKWISE ? 1 : -1);
-			vec3 normal = cross(vec3(vso3.position.xyz - vso1.position.xyz), vec3(vso2.position.xyz - vso1.position.xyz));
-			if (dot(viewRay, normal) < 0) continue;
-		}
-		
-		rasterizeTriangle(vso1, vso2, vso3);		
+		drawTriangle(vso1, vso2, vso3, culling);
 	}
 }
+void SrGPU::submitIndexedMesh(SrIndexedMesh& mesh, const SrGPU::CullMode culling) {
+	// Shade and project every vertex once
+	std::vector<SrVsOutput> outputs(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		outputs[i] = vertexShaderProgram(this, mesh.vertices[i]);
+		outputs[i].position = vec4(outputs[i].position.xyz * (1.0f / outputs[i].position.w), outputs[i].position.w);
+		outputs[i].instanceID = 0;
+	}
+	drawIndexedTriangles(mesh, outputs, 0, mesh.getIndexCount(), culling);
+}
+void SrGPU::submitPackedMesh(SrPackedMesh& mesh, const SrGPU::CullMode culling) {
+	drawPackedMesh(mesh, mesh.vertexCount, 0, mesh.getIndexCount(), culling);
+}
+int SrGPU::selectLod(const SrPackedMesh& mesh, const vec3& viewPosition, const float projectionScale, const float maxPixelError) const {
+	float distance = max(length(viewPosition - mesh.boundsCenter) - mesh.boundsRadius, 1e-6f);
+	float pixelsPerUnit = projectionScale * backBuffer->getTextureHeight() * 0.5f / distance;
+	int lod = 0;
+	while (lod + 1 < (int)mesh.lodCount && mesh.lods[lod + 1].error * pixelsPerUnit <= maxPixelError) lod++;
+	return lod;
+}
+int SrGPU::submitPackedMesh(SrPackedMesh& mesh, const vec3& viewPosition, const float projectionScale, const float maxPixelError,
+	const SrGPU::CullMode culling) {
+	if (mesh.lodCount == 0) {
+		submitPackedMesh(mesh, culling);
+		return 0;
+	}
+	int lod = selectLod(mesh, viewPosition, projectionScale, maxPixelError);
+	drawPackedMesh(mesh, mesh.lods[lod].vertexCount, mesh.lods[lod].firstIndex, mesh.lods[lod].indexCount, culling);
+	return lod;
+}
+void SrGPU::drawPackedMesh(const SrPackedMesh& mesh, const size_t vertexCount, const size_t firstIndex, const size_t indexCount,
+	const SrGPU::CullMode culling) {
+	std::vector<SrVsOutput> outputs(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++) {
+		SrVertex vertex = unpackVertex(mesh, i);
+		outputs[i] = vertexShaderProgram(this, vertex);
+		outputs[i].position = vec4(outputs[i].position.xyz * (1.0f / outputs[i].position.w), outputs[i].position.w);
+		outputs[i].instanceID = 0;
+	}
+	drawIndexedTriangles(mesh, outputs, firstIndex, indexCount, culling);
+}
+void SrGPU::submitInstancedMesh(SrIndexedMesh& mesh, const std::vector<SrInstance>& instances, const SrGPU::CullMode culling) {
+	if (instances.size() == 0 || instanceVertexShaderProgram == NULL) return;
+	drawInstances(mesh, mesh.vertices.size() > 0 ? &mesh.vertices[0] : NULL, mesh.vertices.size(), instances, culling);
+}
+void SrGPU::submitInstancedMesh(SrPackedMesh& mesh, const std::vector<SrInstance>& instances, const SrGPU::CullMode culling) {
+	if (instances.size() == 0 || instanceVertexShaderProgram == NULL) return;
+	// Decoded in chunks of 1024 vertices, so that the small meshes (e.g. of a scene, see SrScene) stay on this thread
+	std::vector<SrVertex> vertices(mesh.vertexCount);
+	srParallelFor((int)((mesh.vertexCount + 1023) / 1024), [&](int begin, int end, int worker) {
+		for (size_t i = (size_t)begin * 1024; i < min((size_t)end * 1024, mesh.vertexCount); i++) vertices[i] = unpackVertex(mesh, i);
+	});
+	drawInstances(mesh, vertices.size() > 0 ? &vertices[0] : NULL, vertices.size(), instances, culling);
+}
+template<class Mesh> void SrGPU::drawInstances(const Mesh& mesh, const SrVertex* vertices, const size_t vertexCount,
+	const std::vector<SrInstance>& instances, const SrGPU::CullMode culling) {
+	// The rasterizer shares the depth buffer and the sampler state, so only the vertices are shaded in parallel:
+	// two instances per worker at a time, bounding the memory of the outputs
+	const int batchSize = srThreadCount() * 2;
+	std::vector<std::vector<SrVsOutput> > outputs(min(batchSize, (int)instances.size()), std::vector<SrVsOutput>(vertexCount));
+	for (int first = 0; first < (int)instances.size(); first += batchSize) {
+		int count = min(batchSize, (int)instances.size() - first);
+		srParallelFor(count, [&](int begin, int end, int worker) {
+			for (int b = begin; b < end; b++)
+				for (size_t i = 0; i < vertexCount; i++) {
+					SrVertex vertex = vertices[i];
+					SrVsOutput& output = outputs[b][i];
+					output = instanceVertexShaderProgram(this, vertex, instances[first + b]);
+					output.position = vec4(output.position.xyz * (1.0f / output.position.w), output.position.w);
+					output.instanceID = first + b;
+				}
+		});
+		for (int b = 0; b < count; b++) drawIndexedTriangles(mesh, outputs[b], 0, mesh.getIndexCount(), culling);
+	}
+}
+template<class Mesh> void SrGPU::drawIndexedTriangles(const Mesh& mesh, std::vector<SrVsOutput>& outputs, const size_t firstIndex,
+	const size_t indexCount, const SrGPU::CullMode culling) {
+	for (size_t i = firstIndex; i + 2 < firstIndex + indexCount; i += 3)
+		drawTriangle(outputs[mesh.getIndex(i)], outputs[mesh.getIndex(i + 1)], outputs[mesh.getIndex(i + 2)], culling);
+}
+void SrGPU::drawTriangle(SrVsOutput vso1, SrVsOutput vso2, SrVsOutput vso3, const SrGPU::CullMode culling) {
+	if (culling != CullMode::NOCULLING) {
+		vec3 viewRay(0, 0, culling == CullMode::CLOCKWISE ? 1 : -1);
+		vec3 normal = cross(vec3(vso3.position.xyz - vso1.position.xyz), vec3(vso2.position.xyz - vso1.position.xyz));
+		if (dot(viewRay, normal) < 0) return;
+	}
+	rasterizeTriangle(vso1, vso2, vso3);
+}
 vec3 SrGPU::computeBarycentricCoefficients(SrVsOutput& svo1, SrVsOutput& svo2, SrVsOutput& svo3, vec2 ssp, float ABCArea) {
 	float CAPArea = length(cross(vec3(ssp - svo1.position.xy, 0.0f), vec3(svo3.position.xy - svo1.position.xy, 0.0f))) * 0.5f;
 	float ABPArea = length(cross(vec3(svo2.position.xy - svo1.position.xy, 0.0f), vec3(ssp - svo1.position.xy, 0.0f))) * 0.5f;
@@ -462,9 +703,16 @@ void SrGPU::standardRasterTriangle(vec2 p1, vec2 p2, vec2 p3, SrVsOutput& svo1,
 	float area = edgeFunction(p1, p2, p3);
 	vec2 p;
 	vec3 bary, pBary, bary0, pBary0, bary1, pBary1;
-	vec2 uv0, uv1;
+	vec2 uv0, uv1, dUVdx, dUVdy;
 	float z, puvac;
 	SrFsInput fsInput;
+	// The uv derivatives are only needed when a bound sampler uses anisotropic filtering
+	bool anisotropic = false, virtualFeedback = false;
+	for (std::vector<SrTexture*>::iterator it = samplers.begin(); it != samplers.end(); it++) {
+		anisotropic = anisotropic || (*it)->getMaxAnisotropy() > 1;
+		virtualFeedback = virtualFeedback || (*it)->isVirtual();
+	}
+	int feedbackWidth = (tw + feedbackScale - 1) / feedbackScale;
 	for (uint32_t j = miny; j <= maxy; j++) {
 		for (uint32_t i = minx; i <= maxx; i++) {
 			if (i < 0 || i >= tw || j < 0 || j >= th) continue;
@@ -488,9 +736,21 @@ void SrGPU::standardRasterTriangle(vec2 p1, vec2 p2, vec2 p3, SrVsOutput& svo1,
 					// calculate puvac, the estimated pixel uv area coverage for the pixel we want to draw
 					puvac = abs((uv1.x - uv0.x) * (uv1.y - uv0.y)) * 0.25f;
 					// the 0.25f is an adjustement introduced because the UV is calculated along the diagonal of a square of 2x2 pixels
+					if (anisotropic) { // uv Jacobian from the uvs of the next pixels along x and y
+						pBary0 = _correctBarycentricCoefficients(svo1, svo2, svo3, _computeBarycentricCoefficients(p1, p2, p3, p + vec2(1, 0), area));
+						pBary1 = _correctBarycentricCoefficients(svo1, svo2, svo3, _computeBarycentricCoefficients(p1, p2, p3, p + vec2(0, 1), area));
+						dUVdx = pBary0.x * svo1.uv + pBary0.y * svo2.uv + pBary0.z * svo3.uv - fsInput.uv;
+						dUVdy = pBary1.x * svo1.uv + pBary1.y * svo2.uv + pBary1.z * svo3.uv - fsInput.uv;
+					}
 					// Update all mipmap interpolation coefficients of the bound samplers to try to achieve the most similar puvac (aka mipmapping)
-					for (std::vector<SrTexture*>::iterator it = samplers.begin(); it != samplers.end(); it++)
+					for (std::vector<SrTexture*>::iterator it = samplers.begin(); it != samplers.end(); it++) {
 						(*it)->calculateTrilinearCoefficient(puvac);
+						if (anisotropic) (*it)->calculateAnisotropicFootprint(dUVdx, dUVdy);
+					}
+					// Record the virtual texture pages requested at the feedback buffer resolution
+					if (virtualFeedback && i % feedbackScale == 0 && j % feedbackScale == 0)
+						for (std::vector<SrTexture*>::iterator it = samplers.begin(); it != samplers.end(); it++)
+							if ((*it)->isVirtual()) (*it)->writeVirtualFeedback(i / feedbackScale + j / feedbackScale * feedbackWidth, fsInput.uv);
 					
 					// Also compute the UVs of the other pixels
 					fsInput.worldPosition = (bary.x * svo1.worldPosition + bary.y * svo2.worldPosition + bary.z * svo3.worldPosition).xyz;
@@ -498,6 +758,7 @@ void SrGPU::standardRasterTriangle(vec2 p1, vec2 p2, vec2 p3, SrVsOutput& svo1,
 					fsInput.worldTangent = (bary.x * svo1.tangent + bary.y * svo2.tangent + bary.z * svo3.tangent).xyz;
 					fsInput.position = p / bufferSize * 2.0f - vec2(1.0f, 1.0f);
 					fsInput.color = pBary.x * svo1.color + pBary.y * svo2.color + pBary.z * svo3.color;
+					fsInput.instanceID = svo1.instanceID;
 					backBuffer->write(i, j, fragmentShaderProgram(this, fsInput));
 				}
 			}
@@ -511,6 +772,7 @@ void SrGPU::drawFillQuad() {
 	input.worldNormal = vec3(0, 0, 0);
 	input.worldPosition = vec3(0, 0, 0);
 	input.worldTangent = vec3(0, 0, 0);
+	input.instanceID = 0;
 	for(int x=0;x<w;x++)
 		for (int y = 0; y < h; y++) {
 			input.position = vec2((float)x / (float)w * 2.0f - 1.0f, (float)y / (float)h * 2.0f - 1.0f);
@@ -0,0 +1,269 @@
+// Author: Andrea Luzzati
+#ifndef SR_IBL_H
+#define SR_IBL_H
+#include "texture.h"                   // includes vector,glm,iostream,stb_image
+#include "parallel.h"                  // for srParallelFor
+#include <string>                      // for string
+#include <chrono>                      // for the bake timing
+
+using namespace glm;
+
+/* Image based lighting bake: from a single HDR equirectangular environment picture generates the textures used by
+   the PBR shading, that is the GGX prefiltered radiance cubemap (one roughness per mipmap level), the irradiance
+   cubemap and the BRDF integration lookup table (scale and bias to F0 indexed by NdotV and roughness).
+   Everything is computed with importance sampling on all the cores and can be cached to a file. */
+
+// Point i of the count points Hammersley low discrepancy set
+vec2 iblHammersley(unsigned int i, const unsigned int count) {
+	unsigned int bits = i;
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return vec2((float)i / (float)count, (float)bits * 2.3283064365386963e-10f);
+}
+// GGX importance sampled half vector in tangent space (normal along +z) for the given perceptual roughness
+vec3 iblImportanceSampleGGX(vec2 xi, const float roughness) {
+	float a = roughness * roughness;
+	float phi = 2.0f * 3.14159265359f * xi.x;
+	float cosTheta = sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+	float sinTheta = sqrt(1.0f - cosTheta * cosTheta);
+	return vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+}
+// Computes a tangent and bitangent orthogonal to the (unit) normal N
+void iblTangentFrame(vec3 N, vec3& tangent, vec3& bitangent) {
+	vec3 up = abs(N.z) < 0.999f ? vec3(0.0f, 0.0f, 1.0f) : vec3(1.0f, 0.0f, 0.0f);
+	tangent = normalize(cross(up, N));
+	bitangent = cross(N, tangent);
+}
+/* Loads an equirectangular HDR picture (any format stb_image reads, .hdr for float data) as the first level of a
+   cubemap with size x size faces, z being the up axis. Every texel averages 2x2 bilinear samples of the picture.
+   Returns false if the picture could not be loaded. */
+bool environmentFromEquirectangular(SrTexture& environment, const char* fname, const int size) {
+	int width, height, channels;
+	float* pixels = stbi_loadf(fname, &width, &height, &channels, 3);
+	if (pixels == NULL) return false;
+	environment.disposeData();
+	environment.cubemapFromColor(size, vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	srParallelFor(6 * size, [&](int begin, int end, int worker) {
+		for (int row = begin; row < end; row++) {
+			int face = row / size, y = row % size;
+			for (int x = 0; x < size; x++) {
+				vec3 color(0.0f);
+				for (int s = 0; s < 4; s++) {
+					vec3 dir = SrTexture::cubemapTexelDirection(face, x * 2 + (s & 1), y * 2 + (s >> 1), size * 2);
+					// Longitude wraps around, latitude is clamped at the poles
+					float u = (atan2(dir.y, dir.x) / (2.0f * 3.14159265359f) + 0.5f) * width - 0.5f;
+					float v = acos(clamp(dir.z, -1.0f, 1.0f)) / 3.14159265359f * height - 0.5f;
+					int x0 = (int)floor(u), y0 = (int)floor(v);
+					float fx = u - (float)x0, fy = v - (float)y0;
+					int xa = (x0 % width + width) % width, xb = (xa + 1) % width;
+					int ya = clamp(y0, 0, height - 1), yb = clamp(y0 + 1, 0, height - 1);
+					const float* p00 = &pixels[(xa + ya * width) * 3], * p10 = &pixels[(xb + ya * width) * 3];
+					const float* p01 = &pixels[(xa + yb * width) * 3], * p11 = &pixels[(xb + yb * width) * 3];
+					vec3 c00(p00[0], p00[1], p00[2]), c10(p10[0], p10[1], p10[2]), c01(p01[0], p01[1], p01[2]), c11(p11[0], p11[1], p11[2]);
+					color += lerp(lerp(c00, c10, fx), lerp(c01, c11, fx), fy);
+				}
+				environment.cubemapWrite(face, x, y, vec4(color * 0.25f, 1.0f));
+			}
+		}
+	});
+	stbi_image_free(pixels);
+	return true;
+}
+/* Prefilters the environment (a cubemap with its mipmap chain, see generateCubemapMipmaps) with the GGX distribution
+   to a radiance cubemap of mipmapCount levels: level l has faces of size >> l and roughness l / (mipmapCount - 1),
+   matching the trilinear coefficient used by the PBR shader. Every texel is filtered with sampleCount importance
+   samples, assuming N = V = R; each sample reads the environment mipmap whose texel covers the solid angle of the
+   sample (filtered importance sampling), which removes the noise of bright spots with few samples. */
+void prefilterRadiance(SrTexture& environment, SrTexture& radiance, const int size, const int mipmapCount, const int sampleCount) {
+	radiance.disposeData();
+	float environmentSize = (float)environment.getCubemapSize();
+	float texelSolidAngle = 4.0f * 3.14159265359f / (6.0f * environmentSize * environmentSize);
+	for (int level = 0; level < mipmapCount; level++) {
+		int levelSize = max(size >> level, 1);
+		float roughness = (float)level / (float)max(mipmapCount - 1, 1);
+		radiance.cubemapFromColor(levelSize, vec4(0.0f), level);
+		// The samples are the same for every texel in tangent space: the light direction L (whose z is the NdotL
+		// weight) and the environment mipmap level to read
+		std::vector<vec4> samples;
+		float a2 = roughness * roughness * roughness * roughness;
+		for (int i = 0; i < sampleCount && level > 0; i++) {
+			vec3 H = iblImportanceSampleGGX(iblHammersley(i, sampleCount), roughness);
+			vec3 L = H * (2.0f * H.z) - vec3(0.0f, 0.0f, 1.0f);
+			if (L.z <= 0.0f) continue;
+			// pdf of L is D * NdotH / (4 * VdotH) = D / 4 since N = V
+			float d = H.z * H.z * (a2 - 1.0f) + 1.0f;
+			float pdf = a2 / (3.14159265359f * d * d) * 0.25f;
+			float sampleSolidAngle = 1.0f / ((float)sampleCount * pdf + 0.0001f);
+			float mipmap = max(0.5f * log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f);
+			samples.push_back(vec4(L, mipmap));
+		}
+		srParallelFor(6 * levelSize, [&](int begin, int end, int worker) {
+			for (int row = begin; row < end; row++) {
+				int face = row / levelSize, y = row % levelSize;
+				for (int x = 0; x < levelSize; x++) {
+					vec3 N = SrTexture::cubemapTexelDirection(face, x, y, levelSize);
+					if (level == 0) { // A mirror: read the environment at the resolution of the level
+						radiance.cubemapWrite(face, x, y, environment.sampleCubemap(N, true, true, log2(environmentSize / (float)levelSize)), level);
+						continue;
+					}
+					vec3 T, B, color(0.0f);
+					float weight = 0.0f;
+					iblTangentFrame(N, T, B);
+					for (size_t i = 0; i < samples.size(); i++) {
+						float NdotL = samples[i].z;
+						vec3 L = T * samples[i].x + B * samples[i].y + N * NdotL;
+						color += environment.sampleCubemap(L, true, true, samples[i].w).xyz * NdotL;
+						weight += NdotL;
+					}
+					radiance.cubemapWrite(face, x, y, vec4(color / max(weight, 0.0001f), 1.0f), level);
+				}
+			}
+		});
+	}
+}
+/* Computes the irradiance cubemap of the environment (divided by pi, so that the diffuse color is irradiance * albedo)
+   projecting the environment to spherical harmonics and convolving them with the clamped cosine lobe. */
+void irradianceFromEnvironment(SrTexture& environment, SrTexture& irradiance, const int size) {
+	// A 64x64 level is enough for the 9 coefficients
+	int level = 0;
+	while (level < environment.getMipmapCount() - 1 && environment.getCubemapSize(level) > 64) level++;
+	vec3 sh[9];
+	environment.cubemapToSH(sh, level);
+	shConvolveIrradiance(sh);
+	irradiance.disposeData();
+	irradiance.cubemapFromColor(size, vec4(0.0f));
+	for (int face = 0; face < 6; face++)
+		for (int y = 0; y < size; y++)
+			for (int x = 0; x < size; x++)
+				irradiance.cubemapWrite(face, x, y, vec4(max(shEvaluate(sh, SrTexture::cubemapTexelDirection(face, x, y, size)), vec3(0.0f)), 1.0f));
+}
+/* Generates the split sum BRDF integration lookup table: the texel at uv = (NdotV, roughness) stores in r and g the
+   scale and bias to F0 of the GGX specular reflectance (specular = radiance * (F0 * r + g)). */
+void integrateBrdf(SrTexture& brdflut, const int size, const int sampleCount) {
+	brdflut.textureFromColor(size, size, vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	srParallelFor(size, [&](int begin, int end, int worker) {
+		for (int y = begin; y < end; y++) {
+			// Texel i is sampled at uv = i / size (see sampleMipmap)
+			float roughness = (float)y / (float)size;
+			float k = roughness * roughness * 0.5f; // Schlick-GGX geometry term remapping for image based lighting
+			for (int x = 0; x < size; x++) {
+				float NdotV = max((float)x / (float)size, 0.001f);
+				vec3 V(sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+				float scale = 0.0f, bias = 0.0f;
+				for (int i = 0; i < sampleCount; i++) {
+					vec3 H = iblImportanceSampleGGX(iblHammersley(i, sampleCount), roughness);
+					float VdotH = dot(V, H);
+					vec3 L = H * (2.0f * VdotH) - V;
+					if (L.z <= 0.0f || VdotH <= 0.0f) continue;
+					float G = NdotV / (NdotV * (1.0f - k) + k) * L.z / (L.z * (1.0f - k) + k);
+					float visibility = G * VdotH / (H.z * NdotV);
+					float fresnel = pow(1.0f - VdotH, 5.0f);
+					scale += (1.0f - fresnel) * visibility;
+					bias += fresnel * visibility;
+				}
+				brdflut.write(x, y, vec4(scale / (float)sampleCount, bias / (float)sampleCount, 0.0f, 1.0f));
+			}
+		}
+	});
+}
+/* Cache file of the baked textures: "SRIB", size in bytes and modification time of the source picture (to detect a
+   changed environment), version and bake settings, then the float rgba texels of the radiance levels and faces, of
+   the irradiance faces and of the lookup table. */
+static const int iblCacheVersion = 2;
+bool saveEnvironmentCache(const char* fname, const long long source[2], const int sampleCount, SrTexture& radiance, SrTexture& irradiance, SrTexture& brdflut) {
+	FILE* pFile = srOpenFile(fname, "wb");
+	if (pFile == NULL) return false;
+	int header[7] = { iblCacheVersion, radiance.getCubemapSize(), radiance.getMipmapCount(), irradiance.getCubemapSize(), brdflut.getTextureWidth(), sampleCount, 0 };
+	bool success = fwrite("SRIB", 1, 4, pFile) == 4 && fwrite(source, sizeof(long long), 2, pFile) == 2 && fwrite(header, sizeof(int), 7, pFile) == 7;
+	std::vector<vec4> texels;
+	for (int level = 0; success && level < radiance.getMipmapCount() + 1; level++) {
+		SrTexture& cubemap = level < radiance.getMipmapCount() ? radiance : irradiance;
+		int mipmap = level < radiance.getMipmapCount() ? level : 0, size = cubemap.getCubemapSize(mipmap);
+		for (int face = 0; success && face < 6; face++) {
+			texels.resize(size * size);
+			for (int y = 0; y < size; y++)
+				for (int x = 0; x < size; x++)
+					texels[x + y * size] = cubemap.cubemapRead(face, x, y, mipmap);
+			success = fwrite(&texels[0], sizeof(vec4), texels.size(), pFile) == texels.size();
+		}
+	}
+	texels.resize(brdflut.getTextureWidth() * brdflut.getTextureHeight());
+	for (int y = 0; y < brdflut.getTextureHeight(); y++)
+		for (int x = 0; x < brdflut.getTextureWidth(); x++)
+			texels[x + y * brdflut.getTextureWidth()] = brdflut.read(x, y);
+	success = success && fwrite(&texels[0], sizeof(vec4), texels.size(), pFile) == texels.size();
+	success = fclose(pFile) == 0 && success; // fclose flushes the buffered texels, it can fail too
+	return success;
+}
+// Loads a cache file saved with the given settings, returns false if missing, stale (existing source stamp differs) or different
+bool loadEnvironmentCache(const char* fname, const long long source[2], const int radianceSize, const int radianceMipmaps,
+	const int irradianceSize, const int brdfLutSize, const int sampleCount, SrTexture& radiance, SrTexture& irradiance, SrTexture& brdflut) {
+	FILE* pFile = srOpenFile(fname, "rb");
+	if (pFile == NULL) return false;
+	char magic[4];
+	long long cachedSource[2];
+	int header[7];
+	int expected[7] = { iblCacheVersion, radianceSize, radianceMipmaps, irradianceSize, brdfLutSize, sampleCount, 0 };
+	if (fread(magic, 1, 4, pFile) != 4 || memcmp(magic, "SRIB", 4) != 0 || fread(cachedSource, sizeof(long long), 2, pFile) != 2 ||
+		fread(header, sizeof(int), 7, pFile) != 7 || memcmp(header, expected, sizeof(header)) != 0 ||
+		(source[0] >= 0 && (cachedSource[0] != source[0] || cachedSource[1] != source[1]))) {
+		fclose(pFile);
+		return false;
+	}
+	radiance.disposeData();
+	irradiance.disposeData();
+	std::vector<vec4> texels;
+	bool ok = true;
+	for (int level = 0; level < radianceMipmaps + 1 && ok; level++) {
+		SrTexture& cubemap = level < radianceMipmaps ? radiance : irradiance;
+		int mipmap = level < radianceMipmaps ? level : 0;
+		int size = level < radianceMipmaps ? max(radianceSize >> level, 1) : irradianceSize;
+		cubemap.cubemapFromColor(size, vec4(0.0f), mipmap);
+		for (int face = 0; face < 6 && ok; face++) {
+			texels.resize(size * size);
+			ok = fread(&texels[0], sizeof(vec4), texels.size(), pFile) == texels.size();
+			for (int y = 0; y < size && ok; y++)
+				for (int x = 0; x < size; x++)
+					cubemap.cubemapWrite(face, x, y, texels[x + y * size], mipmap);
+		}
+	}
+	brdflut.textureFromColor(brdfLutSize, brdfLutSize, vec4(0.0f));
+	texels.resize(brdfLutSize * brdfLutSize);
+	ok = ok && fread(&texels[0], sizeof(vec4), texels.size(), pFile) == texels.size();
+	for (int y = 0; y < brdfLutSize && ok; y++)
+		for (int x = 0; x < brdfLutSize; x++)
+			brdflut.write(x, y, texels[x + y * brdfLutSize]);
+	fclose(pFile);
+	if (!ok) {
+		radiance.disposeData();
+		irradiance.disposeData();
+		brdflut.disposeData();
+	}
+	return ok;
+}
+/* Bakes the radiance, irradiance and BRDF lookup table from the HDR equirectangular picture hdrFname, reusing the
+   cache file cacheFname when it was baked from the same picture with the same settings (the cache is also used
+   alone when the picture is missing) and writing it otherwise. Returns false if neither can be loaded. */
+bool bakeEnvironment(const char* hdrFname, const char* cacheFname, SrTexture& radiance, SrTexture& irradiance, SrTexture& brdflut,
+	const int radianceSize = 512, const int radianceMipmaps = 8, const int irradianceSize = 32, const int brdfLutSize = 512, const int sampleCount = 128) {
+	long long source[2];
+	srFileStamp(hdrFname, source);
+	if (loadEnvironmentCache(cacheFname, source, radianceSize, radianceMipmaps, irradianceSize, brdfLutSize, sampleCount, radiance, irradiance, brdflut))
+		return true;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	SrTexture environment;
+	if (!environmentFromEquirectangular(environment, hdrFname, radianceSize)) return false;
+	environment.generateCubemapMipmaps();
+	prefilterRadiance(environment, radiance, radianceSize, radianceMipmaps, sampleCount);
+	irradianceFromEnvironment(environment, irradiance, irradianceSize);
+	integrateBrdf(brdflut, brdfLutSize, sampleCount);
+	std::cout << "Environment " << hdrFname << " baked in " <<
+		std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() << " s on " << srThreadCount() << " threads" << std::endl;
+	if (!saveEnvironmentCache(cacheFname, source, sampleCount, radiance, irradiance, brdflut))
+		std::cout << "Could not write the environment cache " << cacheFname << std::endl;
+	return true;
+}
+#endif
@@ -4,6 +4,8 @@
 #include "gpu.h"
 #include <glm/ext.hpp>
 #include "utils.h"
+#include "ibl.h"
+#include "meshfile.h"
 #include <string>
 
 
@@ -16,6 +18,10 @@ float znear, zfar;
 float resWidth, resHeight;
 float fovx, fovy;
 float drawingBackground;
+bool octahedralEnvironment = true; // sample the radiance from the octahedral map instead of the cubemap
+bool shIrradiance = true; // evaluate the irradiance from its spherical harmonics instead of sampling the cubemap
+bool bakedEnvironment = false; // the environment was baked from emap/environment.hdr instead of loaded from the .buff files
+vec3 irradianceSH[9];
 mat4 matWorld, matView, matProjection;
 SrVsOutput basicVertexShader(SrGPU* gpu, SrVertex& input);
 vec4 PBRFragmentShader(SrGPU* gpu, SrFsInput& input);
@@ -24,42 +30,79 @@ int main(int argc, char** argv) {
 	resHeight = 1024.0f;
 	float aspect = resWidth / resHeight;
 
-	// Load all the textures
+	/* Load all the assets. The textures and the mesh are decoded in parallel on the asset loading pool while the
+	   environment is prepared and the gpu is set up; the futures are waited for right before they are needed.
+	   The .srtex containers written by the texconvert tool are mapped in memory and used as they are, otherwise
+	   the pictures are decoded and mipmapped */
+	std::chrono::high_resolution_clock::time_point loadingStart = std::chrono::high_resolution_clock::now();
 	SrTexture albedo, normal, mro, radiance, irradiance, brdflut;
-	albedo.textureFromImage("cerberus-albedo.png");
-	normal.textureFromImage("cerberus-normal.png",false);
-	mro.textureFromImage("cerberus-mro.png",false); // metallic-roughness-occlusion
-	brdflut.textureFromBuffer("brdf.buff", 512, 512, 2);
-	albedo.generateMipmaps();
-	normal.generateMipmaps();
-	mro.generateMipmaps();
-
-
-	// Load the radiance and irradiancec environment cubemaps 
-	std::string inFname;
-	const char* faceMap[6] = { "front","back","right","left","top","bottom" };
-	float f = 1.0f;
-	for (int mip = 0; mip < 8; mip++) {
-		for (int face = 0; face < 6; face++) {
-			inFname = "emap\\radiance-";
-			inFname.append(std::to_string(mip));
-			inFname.append("-");
-			inFname.append(faceMap[face]);
-			inFname.append(".buff");
-			radiance.cubemapFromBuffer(inFname.c_str(), 512 * f, 512 * f, face, mip);
-			if( mip == 0 ) { // Load the irradiance, which has no mipmaps
-				inFname = "emap\\irradiance-";
-				inFname.append(faceMap[face]);
-				inFname.append(".buff");
-				irradiance.cubemapFromBuffer(inFname.c_str(), 32, 32, face, 0);
+	std::vector<std::future<bool> > texturesLoaded;
+	texturesLoaded.push_back(srAsync([&albedo] {
+		if (albedo.textureFromContainer("cerberus-albedo.srtex")) return true;
+		bool loaded = albedo.textureFromImage("cerberus-albedo.png");
+		albedo.generateMipmaps();
+		return loaded;
+	}));
+	// Normal and metallic-roughness-occlusion maps are block compressed (BC5/BC7) when the files produced by
+	// the texcompress tool are available, otherwise they are loaded and mipmapped from the pictures
+	texturesLoaded.push_back(srAsync([&normal] {
+		if (normal.textureFromContainer("cerberus-normal.srtex") || normal.textureFromCompressed("cerberus-normal.srbc")) return true;
+		bool loaded = normal.textureFromImage("cerberus-normal.png", false);
+		normal.generateMipmaps();
+		return loaded;
+	}));
+	texturesLoaded.push_back(srAsync([&mro] {
+		if (mro.textureFromContainer("cerberus-mro.srtex") || mro.textureFromCompressed("cerberus-mro.srbc")) return true;
+		bool loaded = mro.textureFromImage("cerberus-mro.png", false); // metallic-roughness-occlusion
+		mro.generateMipmaps();
+		return loaded;
+	}));
+	// Map the cerberus gun mesh container in memory. Without it, the mesh buffer is welded so that the vertex shader
+	// runs once per unique vertex, its outer triangles are moved first so that the depth test skips the shading of
+	// more hidden fragments, its simplified levels of detail are built for the distant frames and its vertices are
+	// packed (about 4 times smaller, decoded by the vertex fetch); the result is cached to the container, so only the
+	// first startup pays the conversion (and the first one after the mesh buffer changes)
+	std::future<SrPackedMesh> meshLoaded = srAsync([] {
+		SrPackedMesh mesh;
+		long long source[2];
+		srFileStamp("cerberus-mesh.buff", source);
+		if (meshFromContainer("cerberus.srmesh", mesh, source)) return mesh;
+		SrIndexedMesh indexed = weldMesh(loadMeshBuffer("cerberus-mesh.buff"));
+		mesh = prepareMesh(indexed);
+		if (mesh.getIndexCount() > 0 && !saveMeshContainer(mesh, "cerberus.srmesh", source)) std::cout << "Could not write cerberus.srmesh" << std::endl;
+		return mesh;
+	});
+
+	// Bake the radiance and irradiance environment cubemaps and the brdf lookup table from a single HDR picture
+	// (the result is cached to a file, so only the first startup pays the bake), or load the pre-baked files
+	bakedEnvironment = bakeEnvironment("emap\\environment.hdr", "emap\\environment.srib", radiance, irradiance, brdflut);
+	bool environmentContainers = !bakedEnvironment && radiance.textureFromContainer("emap\\radiance.srtex") &&
+		irradiance.textureFromContainer("emap\\irradiance.srtex") && brdflut.textureFromContainer("emap\\brdf.srtex");
+	std::vector<std::future<bool> > environmentLoaded;
+	if (!bakedEnvironment && !environmentContainers) {
+		environmentLoaded.push_back(brdflut.textureFromBufferAsync("brdf.buff", 512, 512, 2));
+		// One task per cubemap: the faces of a cubemap cannot be loaded concurrently
+		environmentLoaded.push_back(srAsync([&radiance] {
+			const char* faceMap[6] = { "front","back","right","left","top","bottom" };
+			bool loaded = true;
+			for (int mip = 0; mip < 8; mip++)
+				for (int face = 0; face < 6; face++) {
+					std::string inFname = "emap\\radiance-" + std::to_string(mip) + "-" + faceMap[face] + ".buff";
+					loaded = radiance.cubemapFromBuffer(inFname.c_str(), 512 >> mip, 512 >> mip, face, mip) && loaded;
+				}
+			return loaded;
+		}));
+		environmentLoaded.push_back(srAsync([&irradiance] { // The irradiance has no mipmaps
+			const char* faceMap[6] = { "front","back","right","left","top","bottom" };
+			bool loaded = true;
+			for (int face = 0; face < 6; face++) {
+				std::string inFname = std::string("emap\\irradiance-") + faceMap[face] + ".buff";
+				loaded = irradiance.cubemapFromBuffer(inFname.c_str(), 32, 32, face, 0) && loaded;
 			}
-		}
-		f /= 2.0f;
+			return loaded;
+		}));
 	}
 
-	// Load the cerberus gun mesh
-	SrMesh meshCerberus = loadMeshBuffer("cerberus-mesh.buff");
-
 	// Initialize the software renderer virtual GPU
 	SrGPU gpu(resWidth, resHeight);
 	matWorld = mat4(1.0f);
@@ -73,9 +116,32 @@ int main(int argc, char** argv) {
 	gpu.samplers.push_back(&radiance);
 	gpu.samplers.push_back(&irradiance);
 	gpu.samplers.push_back(&brdflut);
+	SrTexture radianceOctahedral;
+	gpu.samplers.push_back(&radianceOctahedral);
 	gpu.vertexShaderProgram = basicVertexShader;
 	gpu.fragmentShaderProgram = PBRFragmentShader;
 
+	// Wait for the environment, then derive the octahedral radiance and the irradiance spherical harmonics
+	for (size_t i = 0; i < environmentLoaded.size(); i++)
+		if (!environmentLoaded[i].get()) std::cout << "Environment not completely loaded" << std::endl;
+	// Convert the radiance cubemap to an octahedral map: a single 2D lookup per sample instead of a face selection
+	if (!environmentContainers || !radianceOctahedral.textureFromContainer("emap\\radiance-octahedral.srtex"))
+		radianceOctahedral.octahedralFromCubemap(radiance, 1024);
+	// Project the irradiance cubemap to spherical harmonics: the diffuse lighting becomes a few multiply-adds per pixel
+	irradiance.cubemapToSH(irradianceSH);
+
+	// Wait for the material textures and the mesh
+	for (size_t i = 0; i < texturesLoaded.size(); i++)
+		if (!texturesLoaded[i].get()) std::cout << "Material texture not loaded" << std::endl;
+	SrPackedMesh meshCerberus = meshLoaded.get();
+	std::cout << "Mesh: " << meshCerberus.getIndexCount() / 3 << " triangles, " << meshCerberus.vertexCount << " unique vertices, "
+		<< meshCerberus.lodCount << " levels of detail, " << meshCerberus.getMemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+	// Anisotropic filtering keeps the gun barrel sharp at grazing angles
+	albedo.setMaxAnisotropy(8);
+	normal.setMaxAnisotropy(8);
+	mro.setMaxAnisotropy(8);
+	std::cout << "Assets loaded in " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadingStart).count() * 1000.0 << " ms" << std::endl;
+
 
 	/* Rendering --
 	 * Generate an offline animation by saving the backbuffer to a picture file for each frame.
@@ -85,6 +151,9 @@ int main(int argc, char** argv) {
 	 * (this technique can also be used to create an offline animation for complex scenes 
 	 * that require too much rendering time to be in real time) */
 	std::string screenshotFname;
+	size_t trianglesDrawn = 0;
+	int framesDrawn = 0;
+	SrTexture::resetBlockCacheStats();
 	float dist;
 	float tMax = 200.0f;
 	for (float t = 0.0f; t < tMax;  t += 1.0f) {
@@ -107,7 +176,11 @@ int main(int argc, char** argv) {
 		drawingBackground = true;
 		gpu.drawFillQuad();
 		drawingBackground = false;
-		gpu.submitMesh(meshCerberus,SrGPU::CullMode::COUNTERCLOCKWISE);
+		// Draw the coarsest level of detail of the gun whose error stays within a pixel at the camera distance
+		vec3 meshEye = vec3(inverse(matWorld) * vec4(eye, 1.0f));
+		int lod = gpu.submitPackedMesh(meshCerberus, meshEye, abs(matProjection[1][1]), 1.0f, SrGPU::CullMode::COUNTERCLOCKWISE);
+		trianglesDrawn += meshCerberus.lodCount > 0 ? meshCerberus.lods[lod].indexCount / 3 : meshCerberus.getIndexCount() / 3;
+		framesDrawn++;
 
 		// Save the screenshot
 		screenshotFname = "output-frame-";
@@ -115,6 +188,13 @@ int main(int argc, char** argv) {
 		screenshotFname.append(".png");
 		gpu.backBuffer->toImage(screenshotFname.c_str());
 	}
+	if (framesDrawn > 0)
+		std::cout << "Levels of detail: " << trianglesDrawn / framesDrawn << " triangles per frame on average, out of "
+			<< meshCerberus.getIndexCount() / 3 << std::endl;
+	size_t blockCacheHits, blockCacheMisses;
+	SrTexture::getBlockCacheStats(blockCacheHits, blockCacheMisses);
+	if (blockCacheHits + blockCacheMisses > 0)
+		std::cout << "Decoded block cache: " << blockCacheHits << " hits, " << blockCacheMisses << " misses" << std::endl;
 	return 0;
 }
 
@@ -141,13 +221,14 @@ vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness) {
 }
 // Many thanks to Joey De Vries for his helpful work
 vec4 PBRFragmentShader( SrGPU* gpu, SrFsInput& input) {
-	SrTexture* albedoSampler, * normalSampler, * mroSampler, * radianceSampler, * irradianceSampler, * brdflutSampler;
+	SrTexture* albedoSampler, * normalSampler, * mroSampler, * radianceSampler, * irradianceSampler, * brdflutSampler, * radianceOctahedralSampler;
 	albedoSampler = gpu->samplers[0];
 	normalSampler = gpu->samplers[1];
 	mroSampler = gpu->samplers[2];
 	radianceSampler = gpu->samplers[3];
 	irradianceSampler = gpu->samplers[4];
 	brdflutSampler = gpu->samplers[5];
+	radianceOctahedralSampler = gpu->samplers[6];
 
 	// Calculate view ray (view world direction)
 	float x = znear / cos(fovx*0.5f);
@@ -157,7 +238,7 @@ vec4 PBRFragmentShader( SrGPU* gpu, SrFsInput& input) {
 	vec3 N = normalize(input.worldNormal);
 	vec3 V = normalize(-forward * znear + up * input.position.y * h + right * input.position.x * w);
 	if (drawingBackground) // display environment background
-		return vec4(linearToSrgb(tonemap(radianceSampler->sampleCubemap(V).xyz)) , 1.0f);
+		return vec4(linearToSrgb(tonemap(octahedralEnvironment ? radianceOctahedralSampler->sampleOctahedral(V).xyz : radianceSampler->sampleCubemap(V).xyz)) , 1.0f);
 	
 	vec3 albedo = albedoSampler->sample(input.uv,true).rgb;
 	vec3 mro = mroSampler->sample(input.uv,true).rgb;
@@ -180,20 +261,30 @@ vec4 PBRFragmentShader( SrGPU* gpu, SrFsInput& input) {
 	vec3 ks = fresnelSchlickRoughness(mdnvz, F0, roughness);
 	vec3 kd = (vec3(1.0f) - ks) * (1.0f - metallic);
 
-	// Compute the diffuse color component with the irradiance cubemap
-	vec3 irradiance = irradianceSampler->sampleCubemap(-N);
+	// Compute the diffuse color component with the irradiance spherical harmonics (or cubemap). The pre-baked
+	// irradiance files are mirrored with respect to the radiance ones
+	vec3 irradianceDir = bakedEnvironment ? N : -N;
+	vec3 irradiance = shIrradiance ? shEvaluate(irradianceSH, irradianceDir) : irradianceSampler->sampleCubemap(irradianceDir).xyz;
 	vec3 diffuse = irradiance * albedo;
 	
 	// Compute the specular color component with the radiance cubemap
 	float trilinearCoefficient = (radianceSampler->getMipmapCount()-1) * roughness;
-	vec3 radiance = radianceSampler->sampleCubemap(R, true, true, trilinearCoefficient);
-
-	// TODO: brdf coefficients are fishy
-	vec2 brdfuv = float2(1.0f-mdnvz,1.0f-roughness); 
-	vec2 brdf = brdflutSampler->sample(brdfuv).rg;
-	float brdfx = brdf.x;
-	brdfuv = float2(mdnvz, roughness);
-	float brdfy = brdflutSampler->sample(brdfuv).y;
+	vec3 radiance = octahedralEnvironment ? radianceOctahedralSampler->sampleOctahedral(R, true, true, trilinearCoefficient) :
+		radianceSampler->sampleCubemap(R, true, true, trilinearCoefficient);
+
+	// TODO: brdf coefficients of the pre-baked lookup table are fishy
+	float brdfx, brdfy;
+	if (bakedEnvironment) { // the baked lookup table is indexed by (NdotV, roughness), see integrateBrdf
+		vec2 brdf = brdflutSampler->sample(vec2(mdnvz, roughness)).rg;
+		brdfx = brdf.x;
+		brdfy = brdf.y;
+	}
+	else {
+		vec2 brdfuv = float2(1.0f - mdnvz, 1.0f - roughness);
+		brdfx = brdflutSampler->sample(brdfuv).r;
+		brdfuv = float2(mdnvz, roughness);
+		brdfy = brdflutSampler->sample(brdfuv).y;
+	}
 	vec3 specular = radiance * (ks*brdfx+brdfy);  
 	vec3 ambient = (kd * diffuse + specular) * occlusion; 
 	return vec4(linearToSrgb(tonemap(ambient)), 1.0f);
@@ -0,0 +1,54 @@
+// Author: Andrea Luzzati
+// Offline tool to convert meshes to .srmesh containers, loaded at runtime with meshFromContainer by mapping the file
+// in memory: the vertices are welded, the triangles reordered for the vertex cache and the overdraw, simplified to
+// levels of detail, split in clusters and packed once here instead of at every startup.
+// Usage: meshconvert <input.buff|input.obj|input.glb> <output.srmesh> [noclusters] [nolods] [tangents]
+//          input.buff: mesh buffer file (see loadMeshBuffer), input.obj: Wavefront OBJ file (see loadObj),
+//          input.glb: binary glTF file (see loadGlb)
+//          noclusters: do not store the clusters of the mesh
+//          nolods: do not store the levels of detail of the mesh (see buildMeshLods)
+//          tangents: replace the tangents of the input with the ones computed from the uv (see generateTangents)
+#include <iostream>
+#include <string>
+#include <chrono>
+#include "meshfile.h"
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		std::cout << "usage: meshconvert <input.buff|input.obj|input.glb> <output.srmesh> [noclusters] [nolods] [tangents]" << std::endl;
+		return 1;
+	}
+	std::string input = argv[1];
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	SrIndexedMesh mesh;
+	std::string extension = input.size() > 4 ? input.substr(input.size() - 4) : "";
+	if (extension == ".obj") mesh = loadObj(argv[1]);
+	else if (extension == ".glb") mesh = loadGlb(argv[1]);
+	else mesh = weldMesh(loadMeshBuffer(argv[1]));
+	if (mesh.getIndexCount() == 0) {
+		std::cout << "no triangles in " << argv[1] << std::endl;
+		return 1;
+	}
+	bool clusters = true, lods = true;
+	for (int a = 3; a < argc; a++) {
+		if (std::string(argv[a]) == "noclusters") clusters = false;
+		else if (std::string(argv[a]) == "nolods") lods = false;
+		else if (std::string(argv[a]) == "tangents") generateTangents(mesh);
+	}
+	float acmr = meshACMR(mesh);
+	SrPackedMesh packed = prepareMesh(mesh, clusters, lods);
+	long long source[2];
+	srFileStamp(argv[1], source);
+	if (!saveMeshContainer(packed, argv[2], source)) {
+		std::cout << "could not write " << argv[2] << std::endl;
+		return 1;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << argv[2] << ": " << packed.getIndexCount() / 3 << " triangles, " << packed.vertexCount << " vertices, "
+		<< packed.clusterCount << " clusters, " << packed.lodCount << " levels of detail, " << packed.getMemoryUsage() << " bytes (ACMR " << acmr << " -> " << meshACMR(mesh)
+		<< ", " << seconds << " s)" << std::endl;
+	for (size_t l = 1; l < packed.lodCount; l++)
+		std::cout << "  level of detail " << l << ": " << packed.lods[l].indexCount / 3 << " triangles, " << packed.lods[l].vertexCount
+			<< " vertices, error " << packed.lods[l].error << std::endl;
+	return 0;
+}
@@ -0,0 +1,630 @@
+// Author: Andrea Luzzati
+#ifndef SR_MESHFILE_H
+#define SR_MESHFILE_H
+#include "utils.h"         // includes gpu,texture,filemap,parallel
+#include "meshopt.h"       // for the reordering passes, the clusters and the levels of detail
+#include <climits>         // for INT_MAX
+#include <string>          // for the JSON strings
+
+using namespace glm;
+
+/* .srmesh container: a packed mesh (see SrPackedMesh) ready to draw, welded and reordered offline (see meshconvert),
+   mapped in memory at load time so that its arrays are used straight from the file.
+   Layout: "SRMS", int[5] {version, index size (2 or 4), sizeof(SrPackedVertex), sizeof(SrMeshCluster), sizeof(SrMeshLod)},
+   long long[4] {vertex, index, cluster, lod count}, float[10] {bounds min, bounds scale, bounds center, bounds radius},
+   long long[4] offsets of the vertex, index, cluster and lod arrays (64 bytes aligned), long long[2] size in bytes and
+   modification time of the source file (see srFileStamp, -1 if unknown), then the arrays. */
+static const int srMeshContainerVersion = 3;
+static const size_t srMeshContainerHeaderBytes = 4 + 5 * sizeof(int) + 4 * sizeof(long long) + 10 * sizeof(float) + 6 * sizeof(long long);
+
+/* Prepares an indexed mesh to draw: reorders its triangles for the vertex cache and the overdraw, optionally builds
+   its levels of detail and splits it in clusters, then packs it (the reordering is done in place) */
+SrPackedMesh prepareMesh(SrIndexedMesh& mesh, const bool clusters = true, const bool lods = true) {
+	optimizeVertexCache(mesh);
+	optimizeOverdraw(mesh);
+	std::vector<unsigned int> lodIndices;
+	std::vector<SrMeshLod> meshLods = lods ? buildMeshLods(mesh, lodIndices) : std::vector<SrMeshLod>();
+	return packMesh(mesh, clusters ? buildMeshClusters(mesh) : std::vector<SrMeshCluster>(), meshLods, lodIndices);
+}
+/* Saves a packed mesh to a .srmesh container, returns false if the file could not be written. source is the stamp
+   of the file the mesh was converted from (see srFileStamp), checked by meshFromContainer when the container is a cache. */
+bool saveMeshContainer(const SrPackedMesh& mesh, const char* fname, const long long* source = NULL) {
+	FILE* pFile = srOpenFile(fname, "wb");
+	if (pFile == NULL) return false;
+	int indexSize = mesh.indices16 != NULL ? 2 : 4;
+	int header[5] = { srMeshContainerVersion, indexSize, (int)sizeof(SrPackedVertex), (int)sizeof(SrMeshCluster), (int)sizeof(SrMeshLod) };
+	long long counts[4] = { (long long)mesh.vertexCount, (long long)mesh.indexCount, (long long)mesh.clusterCount, (long long)mesh.lodCount };
+	float bounds[10] = { mesh.boundsMin.x, mesh.boundsMin.y, mesh.boundsMin.z, mesh.boundsScale.x, mesh.boundsScale.y, mesh.boundsScale.z,
+		mesh.boundsCenter.x, mesh.boundsCenter.y, mesh.boundsCenter.z, mesh.boundsRadius };
+	const void* arrays[4] = { mesh.vertices, mesh.indices16 != NULL ? (const void*)mesh.indices16 : (const void*)mesh.indices32, mesh.clusters, mesh.lods };
+	size_t sizes[4] = { mesh.vertexCount * sizeof(SrPackedVertex), mesh.indexCount * indexSize, mesh.clusterCount * sizeof(SrMeshCluster),
+		mesh.lodCount * sizeof(SrMeshLod) };
+	long long stamp[2] = { source != NULL ? source[0] : -1, source != NULL ? source[1] : -1 };
+	long long offsets[4], offset = (long long)srMeshContainerHeaderBytes;
+	for (int a = 0; a < 4; a++) {
+		offsets[a] = (offset + 63) & ~63LL;
+		offset = offsets[a] + (long long)sizes[a];
+	}
+	bool success = fwrite("SRMS", 1, 4, pFile) == 4 && fwrite(header, sizeof(int), 5, pFile) == 5 && fwrite(counts, sizeof(long long), 4, pFile) == 4 &&
+		fwrite(bounds, sizeof(float), 10, pFile) == 10 && fwrite(offsets, sizeof(long long), 4, pFile) == 4 && fwrite(stamp, sizeof(long long), 2, pFile) == 2;
+	static const unsigned char padding[64] = { 0 };
+	long long position = (long long)srMeshContainerHeaderBytes;
+	for (int a = 0; success && a < 4; a++) {
+		size_t pad = (size_t)(offsets[a] - position);
+		success = fwrite(padding, 1, pad, pFile) == pad && (sizes[a] == 0 || fwrite(arrays[a], 1, sizes[a], pFile) == sizes[a]);
+		position = offsets[a] + (long long)sizes[a];
+	}
+	fclose(pFile);
+	return success;
+}
+// True if the count indices (2 or 4 bytes each) from first are all below limit, scanned in parallel chunks
+static bool srIndicesBelow(const unsigned char* indices, const int indexSize, const size_t first, const size_t count, const size_t limit) {
+	std::vector<char> valid(srThreadCount(), 1);
+	srParallelFor((int)((count + 65535) / 65536), [&](int begin, int end, int worker) {
+		size_t from = first + (size_t)begin * 65536, to = first + min((size_t)end * 65536, count);
+		unsigned int largest = 0;
+		if (indexSize == 2) for (size_t i = from; i < to; i++) largest = max(largest, (unsigned int)((const unsigned short*)indices)[i]);
+		else for (size_t i = from; i < to; i++) largest = max(largest, ((const unsigned int*)indices)[i]);
+		if (to > from && largest >= limit) valid[worker] = 0;
+	});
+	for (size_t w = 0; w < valid.size(); w++)
+		if (!valid[w]) return false;
+	return true;
+}
+/* Loads a .srmesh container by mapping it in memory: the mesh arrays point straight into the read only mapping,
+   which lives as long as the copies of the mesh. Everything the drawing reads is validated so that a truncated,
+   corrupt or stale container is rejected: the arrays must fit in the file, the indices must address the vertices and
+   the ranges of the clusters and of the levels of detail (and the indices of each level) must fit in the totals.
+   With source (see srFileStamp) the container is a cache: it is stale, and rejected, if it was converted from a
+   different version of an existing source file. */
+bool meshFromContainer(const char* fname, SrPackedMesh& mesh, const long long* source = NULL) {
+	std::shared_ptr<SrFileMapping> mapping = std::make_shared<SrFileMapping>();
+	if (!mapping->open(fname)) return false;
+	const unsigned char* file = mapping->data();
+	int header[5];
+	long long counts[4], offsets[4], stamp[2];
+	float bounds[10];
+	bool success = mapping->size() >= srMeshContainerHeaderBytes && memcmp(file, "SRMS", 4) == 0;
+	if (success) {
+		memcpy(header, file + 4, sizeof(header));
+		memcpy(counts, file + 4 + sizeof(header), sizeof(counts));
+		memcpy(bounds, file + 4 + sizeof(header) + sizeof(counts), sizeof(bounds));
+		memcpy(offsets, file + 4 + sizeof(header) + sizeof(counts) + sizeof(bounds), sizeof(offsets));
+		memcpy(stamp, file + 4 + sizeof(header) + sizeof(counts) + sizeof(bounds) + sizeof(offsets), sizeof(stamp));
+		success = header[0] == srMeshContainerVersion && (header[1] == 2 || header[1] == 4) &&
+			header[2] == (int)sizeof(SrPackedVertex) && header[3] == (int)sizeof(SrMeshCluster) && header[4] == (int)sizeof(SrMeshLod) &&
+			counts[1] % 3 == 0;
+		if (success && source != NULL && source[0] >= 0 && (stamp[0] != source[0] || stamp[1] != source[1]))
+			return false; // a cache converted from another version of the source, not an invalid container
+		size_t elementSizes[4] = { sizeof(SrPackedVertex), (size_t)header[1], sizeof(SrMeshCluster), sizeof(SrMeshLod) };
+		for (int a = 0; success && a < 4; a++)
+			success = counts[a] >= 0 && offsets[a] >= 0 && (offsets[a] & 63) == 0 && (size_t)counts[a] <= mapping->size() / elementSizes[a] &&
+				(size_t)offsets[a] + (size_t)counts[a] * elementSizes[a] <= mapping->size();
+		for (long long l = 0; success && l < counts[3]; l++) {
+			SrMeshLod lod;
+			memcpy(&lod, file + offsets[3] + l * sizeof(SrMeshLod), sizeof(SrMeshLod));
+			success = lod.firstIndex % 3 == 0 && lod.indexCount % 3 == 0 && (long long)lod.firstIndex + lod.indexCount <= counts[1] &&
+				lod.vertexCount <= counts[0] && srIndicesBelow(file + offsets[1], header[1], lod.firstIndex, lod.indexCount, lod.vertexCount);
+		}
+		for (long long c = 0; success && c < counts[2]; c++) {
+			SrMeshCluster cluster;
+			memcpy(&cluster, file + offsets[2] + c * sizeof(SrMeshCluster), sizeof(SrMeshCluster));
+			success = ((long long)cluster.firstTriangle + cluster.triangleCount) * 3 <= counts[1];
+		}
+		success = success && srIndicesBelow(file + offsets[1], header[1], 0, (size_t)counts[1], (size_t)counts[0]);
+	}
+	if (!success) {
+		std::cout << "Invalid mesh container " << fname << std::endl;
+		return false;
+	}
+	mesh = SrPackedMesh();
+	mesh.vertices = (const SrPackedVertex*)(file + offsets[0]);
+	mesh.vertexCount = (size_t)counts[0];
+	if (header[1] == 2) mesh.indices16 = (const unsigned short*)(file + offsets[1]);
+	else mesh.indices32 = (const unsigned int*)(file + offsets[1]);
+	mesh.indexCount = (size_t)counts[1];
+	mesh.clusters = counts[2] > 0 ? (const SrMeshCluster*)(file + offsets[2]) : NULL;
+	mesh.clusterCount = (size_t)counts[2];
+	mesh.lods = counts[3] > 0 ? (const SrMeshLod*)(file + offsets[3]) : NULL;
+	mesh.lodCount = (size_t)counts[3];
+	mesh.boundsMin = vec3(bounds[0], bounds[1], bounds[2]);
+	mesh.boundsScale = vec3(bounds[3], bounds[4], bounds[5]);
+	mesh.boundsCenter = vec3(bounds[6], bounds[7], bounds[8]);
+	mesh.boundsRadius = bounds[9];
+	mesh.storage = mapping;
+	return true;
+}
+
+// Number parsers of the mesh loaders, reading up to end (the mapped files are not null terminated)
+static inline const char* srSkipBlanks(const char* s, const char* end) {
+	while (s < end && (*s == ' ' || *s == '\t' || *s == '\r')) s++;
+	return s;
+}
+static inline const char* srParseInt(const char* s, const char* end, long long& value) {
+	bool negative = s < end && *s == '-';
+	if (s < end && (*s == '-' || *s == '+')) s++;
+	const char* digits = s;
+	value = 0;
+	for (; s < end && *s >= '0' && *s <= '9'; s++) value = value * 10 + (*s - '0');
+	if (negative) value = -value;
+	return s > digits ? s : NULL;
+}
+// Decimal number (sign, digits, fraction, exponent), exact for integers and within one unit of the last place of a float
+static inline const char* srParseNumber(const char* s, const char* end, double& value) {
+	bool negative = s < end && *s == '-';
+	if (s < end && (*s == '-' || *s == '+')) s++;
+	const char* digits = s;
+	unsigned long long mantissa = 0;
+	int exponent = 0, significant = 0;
+	for (; s < end && *s >= '0' && *s <= '9'; s++)
+		if (significant < 19) mantissa = mantissa * 10 + (*s - '0'), significant += mantissa > 0;
+		else exponent++;
+	if (s < end && *s == '.')
+		for (s++; s < end && *s >= '0' && *s <= '9'; s++)
+			if (significant < 19) mantissa = mantissa * 10 + (*s - '0'), significant += mantissa > 0, exponent--;
+	if (s == digits || (s == digits + 1 && *digits == '.')) return NULL;
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		long long e;
+		const char* after = srParseInt(s + 1, end, e);
+		if (after == NULL) return NULL;
+		exponent += (int)max(min(e, 1000LL), -1000LL);
+		s = after;
+	}
+	double v = (double)mantissa;
+	if (exponent != 0) v = exponent > 0 ? v * pow(10.0, exponent) : v / pow(10.0, -exponent);
+	value = negative ? -v : v;
+	return s;
+}
+static inline const char* srParseFloat(const char* s, const char* end, float& value) {
+	double v;
+	s = srParseNumber(s, end, v);
+	value = (float)v;
+	return s;
+}
+
+/* Loads a Wavefront OBJ file (positions, uv, normals and polygonal faces, fan triangulated; materials and groups are
+   ignored) straight into an indexed mesh, one vertex per distinct position/uv/normal triplet. The uv v axis is
+   flipped (OBJ has its origin at the bottom left of the picture); missing normals are the area weighted average of
+   the faces around the position and the tangents are computed from the uv (see generateTangents). Returns an empty
+   mesh (reporting the reason) if the file is missing or malformed.
+   The file is mapped in memory and parsed in parallel chunks of whole lines; the corners of the faces are then
+   turned into vertices per position, in parallel, numbering the vertices in order of first use. */
+SrIndexedMesh loadObj(const char* fname) {
+	SrIndexedMesh mesh;
+	SrFileMapping file;
+	if (!file.open(fname)) {
+		std::cout << "could not open " << fname << std::endl;
+		return mesh;
+	}
+	// Chunk of whole lines, parsed on its own: the indices of the face corners (-1 when missing) are absolute or,
+	// for the negative OBJ indices, relative to the first element of the chunk (relative bits 1,2,4 for v,t,n)
+	struct objChunk {
+		const char* begin;
+		const char* end;
+		std::vector<vec3> positions, normals;
+		std::vector<vec2> uvs;
+		std::vector<int> corners; // v,t,n
+		std::vector<unsigned char> relative;
+		std::vector<int> faceSizes;
+		bool valid;
+		size_t cornerBase, triangleBase; // of the chunk in the whole file
+	};
+	const char* data = (const char*)file.data(), * dataEnd = data + file.size();
+	int chunkCount = (int)min((size_t)srThreadCount() * 8, file.size() / 65536 + 1);
+	std::vector<objChunk> chunks(chunkCount);
+	const char* begin = data;
+	for (int c = 0; c < chunkCount; c++) {
+		const char* end = c == chunkCount - 1 ? dataEnd : data + file.size() * (c + 1) / chunkCount;
+		if (end < begin) end = begin;
+		while (end < dataEnd && end[-1] != '\n') end++;
+		chunks[c].begin = begin;
+		chunks[c].end = end;
+		begin = end;
+	}
+	srParallelFor(chunkCount, [&](int first, int last, int worker) {
+		for (int c = first; c < last; c++) {
+			objChunk& chunk = chunks[c];
+			chunk.valid = true;
+			const char* s = chunk.begin, * end = chunk.end;
+			while (s < end && chunk.valid) {
+				s = srSkipBlanks(s, end);
+				const char* lineEnd = (const char*)memchr(s, '\n', end - s);
+				if (lineEnd == NULL) lineEnd = end;
+				if (lineEnd - s >= 2 && s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+					vec3 v;
+					s++;
+					for (int k = 0; k < 3 && s != NULL; k++) s = srParseFloat(srSkipBlanks(s, lineEnd), lineEnd, v[k]);
+					chunk.valid = s != NULL;
+					chunk.positions.push_back(v);
+				}
+				else if (lineEnd - s >= 3 && s[0] == 'v' && s[1] == 't' && (s[2] == ' ' || s[2] == '\t')) {
+					vec2 uv;
+					s += 2;
+					for (int k = 0; k < 2 && s != NULL; k++) s = srParseFloat(srSkipBlanks(s, lineEnd), lineEnd, uv[k]);
+					chunk.valid = s != NULL;
+					chunk.uvs.push_back(vec2(uv.x, 1.0f - uv.y));
+				}
+				else if (lineEnd - s >= 3 && s[0] == 'v' && s[1] == 'n' && (s[2] == ' ' || s[2] == '\t')) {
+					vec3 n;
+					s += 2;
+					for (int k = 0; k < 3 && s != NULL; k++) s = srParseFloat(srSkipBlanks(s, lineEnd), lineEnd, n[k]);
+					chunk.valid = s != NULL;
+					chunk.normals.push_back(n);
+				}
+				else if (lineEnd - s >= 2 && s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+					// v, v/t, v//n or v/t/n, negative indices count back from the last element
+					int corners = 0;
+					s = srSkipBlanks(s + 1, lineEnd);
+					while (chunk.valid && s < lineEnd && *s != '#') {
+						long long index[3] = { 0, 0, 0 };
+						s = srParseInt(s, lineEnd, index[0]);
+						for (int k = 1; k < 3 && s != NULL && s < lineEnd && *s == '/'; k++)
+							s = (s + 1 < lineEnd && s[1] == '/') ? s + 1 : srParseInt(s + 1, lineEnd, index[k]);
+						chunk.valid = s != NULL && index[0] != 0 && (s == lineEnd || *s == ' ' || *s == '\t' || *s == '\r');
+						size_t counts[3] = { chunk.positions.size(), chunk.uvs.size(), chunk.normals.size() };
+						unsigned char relative = 0;
+						for (int k = 0; k < 3; k++) {
+							if (index[k] < 0) relative |= 1 << k;
+							long long resolved = index[k] > 0 ? index[k] - 1 : (index[k] < 0 ? (long long)counts[k] + index[k] : -1);
+							chunk.valid = chunk.valid && resolved < INT_MAX && resolved > INT_MIN;
+							chunk.corners.push_back((int)resolved);
+						}
+						chunk.relative.push_back(relative);
+						corners++;
+						if (s != NULL) s = srSkipBlanks(s, lineEnd);
+					}
+					chunk.valid = chunk.valid && corners >= 3;
+					chunk.faceSizes.push_back(corners);
+				}
+				s = lineEnd + 1;
+			}
+		}
+	});
+	// Global positions of the chunk elements, corners and triangles
+	size_t counts[3] = { 0, 0, 0 }, cornerCount = 0, triangleCount = 0;
+	std::vector<size_t> bases(chunkCount * 3);
+	for (int c = 0; c < chunkCount; c++) {
+		if (!chunks[c].valid) {
+			std::cout << "invalid OBJ file " << fname << std::endl;
+			return mesh;
+		}
+		bases[c * 3] = counts[0];
+		bases[c * 3 + 1] = counts[1];
+		bases[c * 3 + 2] = counts[2];
+		counts[0] += chunks[c].positions.size();
+		counts[1] += chunks[c].uvs.size();
+		counts[2] += chunks[c].normals.size();
+		chunks[c].cornerBase = cornerCount;
+		chunks[c].triangleBase = triangleCount;
+		cornerCount += chunks[c].relative.size();
+		for (size_t f = 0; f < chunks[c].faceSizes.size(); f++) triangleCount += chunks[c].faceSizes[f] - 2;
+	}
+	if (counts[0] >= INT_MAX || cornerCount >= INT_MAX) {
+		std::cout << "OBJ file " << fname << " too large" << std::endl;
+		return mesh;
+	}
+	std::vector<vec3> positions(counts[0]), normals(counts[2]);
+	std::vector<vec2> uvs(counts[1]);
+	std::vector<int> corners(cornerCount * 3);
+	std::vector<char> validChunks(chunkCount, 1);
+	srParallelFor(chunkCount, [&](int first, int last, int worker) {
+		for (int c = first; c < last; c++) {
+			objChunk& chunk = chunks[c];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + bases[c * 3]);
+			std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + bases[c * 3 + 1]);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + bases[c * 3 + 2]);
+			// Resolve the relative indices and check the ranges
+			for (size_t i = 0; i < chunk.relative.size(); i++)
+				for (int k = 0; k < 3; k++) {
+					long long index = chunk.corners[i * 3 + k];
+					bool relative = (chunk.relative[i] & (1 << k)) != 0;
+					if (relative) index += (long long)bases[c * 3 + k];
+					if (index < (k == 0 || relative ? 0 : -1) || index >= (long long)counts[k]) validChunks[c] = 0;
+					corners[(chunk.cornerBase + i) * 3 + k] = (int)index;
+				}
+		}
+	});
+	for (int c = 0; c < chunkCount; c++)
+		if (!validChunks[c]) {
+			std::cout << "invalid OBJ file " << fname << " (index out of range)" << std::endl;
+			return mesh;
+		}
+	// Corners grouped by position (counting sort, keeping the file order), deduplicated in parallel: every corner
+	// points to the first one with its uv and normal, the unique corners are numbered in file order
+	std::vector<unsigned int> groupStart(counts[0] + 1, 0), grouped(cornerCount), firstCorner(cornerCount);
+	for (size_t i = 0; i < cornerCount; i++) groupStart[corners[i * 3] + 1]++;
+	for (size_t v = 0; v < counts[0]; v++) groupStart[v + 1] += groupStart[v];
+	std::vector<unsigned int> fill(groupStart.begin(), groupStart.end() - 1);
+	for (size_t i = 0; i < cornerCount; i++) grouped[fill[corners[i * 3]]++] = (unsigned int)i;
+	std::vector<unsigned int>().swap(fill);
+	srParallelFor((int)counts[0], [&](int first, int last, int worker) {
+		std::vector<unsigned int> distinct;
+		for (int v = first; v < last; v++) {
+			distinct.clear();
+			for (unsigned int g = groupStart[v]; g < groupStart[v + 1]; g++) {
+				unsigned int i = grouped[g];
+				size_t d = 0;
+				while (d < distinct.size() && (corners[distinct[d] * 3 + 1] != corners[i * 3 + 1] || corners[distinct[d] * 3 + 2] != corners[i * 3 + 2])) d++;
+				if (d == distinct.size()) distinct.push_back(i);
+				firstCorner[i] = distinct[d];
+			}
+		}
+	});
+	std::vector<unsigned int>().swap(grouped);
+	std::vector<unsigned int> vertexOf(cornerCount);
+	unsigned int vertexCount = 0;
+	for (size_t i = 0; i < cornerCount; i++)
+		if (firstCorner[i] == i) vertexOf[i] = vertexCount++;
+	// Vertices, normals from the faces where missing
+	bool missingNormals = false;
+	for (size_t i = 0; i < cornerCount && !missingNormals; i++) missingNormals = corners[i * 3 + 2] < 0;
+	std::vector<vec3> faceNormals;
+	std::vector<unsigned int> indices(triangleCount * 3);
+	srParallelFor(chunkCount, [&](int first, int last, int worker) {
+		for (int c = first; c < last; c++) {
+			const objChunk& chunk = chunks[c];
+			size_t corner = chunk.cornerBase, index = chunk.triangleBase * 3;
+			for (size_t f = 0; f < chunk.faceSizes.size(); f++) {
+				for (int k = 2; k < chunk.faceSizes[f]; k++) {
+					indices[index++] = vertexOf[firstCorner[corner]];
+					indices[index++] = vertexOf[firstCorner[corner + k - 1]];
+					indices[index++] = vertexOf[firstCorner[corner + k]];
+				}
+				corner += chunk.faceSizes[f];
+			}
+		}
+	});
+	if (missingNormals) {
+		faceNormals.resize(counts[0], vec3(0.0f));
+		for (int c = 0; c < chunkCount; c++) {
+			size_t corner = chunks[c].cornerBase;
+			for (size_t f = 0; f < chunks[c].faceSizes.size(); f++) {
+				for (int k = 2; k < chunks[c].faceSizes[f]; k++) {
+					int a = corners[corner * 3], b = corners[(corner + k - 1) * 3], d = corners[(corner + k) * 3];
+					vec3 n = cross(positions[b] - positions[a], positions[d] - positions[a]); // twice the area
+					faceNormals[a] += n;
+					faceNormals[b] += n;
+					faceNormals[d] += n;
+				}
+				corner += chunks[c].faceSizes[f];
+			}
+		}
+	}
+	std::vector<objChunk>().swap(chunks);
+	mesh.vertices.resize(vertexCount);
+	srParallelFor((int)cornerCount, [&](int first, int last, int worker) {
+		for (int i = first; i < last; i++) {
+			if (firstCorner[i] != (unsigned int)i) continue;
+			SrVertex& v = mesh.vertices[vertexOf[i]];
+			const int* c = &corners[(size_t)i * 3];
+			vec3 n = c[2] >= 0 ? normals[c[2]] : faceNormals[c[0]];
+			v.position = vec4(positions[c[0]], 1.0f);
+			v.normal = vec4(length(n) > 0.0f ? normalize(n) : vec3(0, 0, 1), 0.0f);
+			v.uv = c[1] >= 0 ? uvs[c[1]] : vec2(0.0f);
+			v.color = vec4(1.0f);
+		}
+	});
+	if (vertexCount <= 65536) mesh.indices16.assign(indices.begin(), indices.end());
+	else mesh.indices32.swap(indices);
+	generateTangents(mesh);
+	return mesh;
+}
+
+// Minimal JSON document (the scene description of the glTF files)
+struct SrJson {
+	enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } type;
+	double number;
+	std::string string;
+	std::vector<SrJson> items;     // of arrays and objects
+	std::vector<std::string> keys; // of objects
+	SrJson() : type(NUL), number(0.0) {}
+	// Member of an object, NULL if missing
+	const SrJson* get(const char* key) const {
+		for (size_t i = 0; type == OBJECT && i < keys.size(); i++)
+			if (keys[i] == key) return &items[i];
+		return NULL;
+	}
+	// Number member of an object, fallback if missing
+	double get(const char* key, const double fallback) const {
+		const SrJson* member = get(key);
+		return member != NULL && member->type == NUMBER ? member->number : fallback;
+	}
+};
+// Parses the JSON value at s, returns the end of the value or NULL if malformed
+static const char* srParseJson(const char* s, const char* end, SrJson& value, const int depth = 0) {
+	while (s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')) s++;
+	if (s >= end || depth > 64) return NULL;
+	if (*s == '{' || *s == '[') {
+		bool object = *s == '{';
+		value.type = object ? SrJson::OBJECT : SrJson::ARRAY;
+		for (s++;;) {
+			while (s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n' || *s == ',')) s++;
+			if (s >= end) return NULL;
+			if (*s == (object ? '}' : ']')) return s + 1;
+			if (object) {
+				SrJson key;
+				s = srParseJson(s, end, key, depth + 1);
+				while (s != NULL && s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')) s++;
+				if (s == NULL || key.type != SrJson::STRING || s >= end || *s != ':') return NULL;
+				s++;
+				value.keys.push_back(key.string);
+			}
+			value.items.push_back(SrJson());
+			s = srParseJson(s, end, value.items.back(), depth + 1);
+			if (s == NULL) return NULL;
+		}
+	}
+	if (*s == '"') {
+		value.type = SrJson::STRING;
+		for (s++; s < end && *s != '"'; s++) {
+			if (*s != '\\') value.string += *s;
+			else if (++s >= end) return NULL;
+			else if (*s == 'u') { // non ascii characters are not needed by the loaders
+				if (end - s < 5) return NULL;
+				value.string += '?';
+				s += 4;
+			}
+			else value.string += *s == 'n' ? '\n' : *s == 't' ? '\t' : *s == 'r' ? '\r' : *s == 'b' ? '\b' : *s == 'f' ? '\f' : *s;
+		}
+		return s < end ? s + 1 : NULL;
+	}
+	if (end - s >= 4 && memcmp(s, "true", 4) == 0) { value.type = SrJson::BOOLEAN; value.number = 1.0; return s + 4; }
+	if (end - s >= 5 && memcmp(s, "false", 5) == 0) { value.type = SrJson::BOOLEAN; return s + 5; }
+	if (end - s >= 4 && memcmp(s, "null", 4) == 0) return s + 4;
+	value.type = SrJson::NUMBER;
+	return srParseNumber(s, end, value.number);
+}
+/* Reads the glTF accessor index of a binary buffer as count x components floats (integer components are converted,
+   normalized when the accessor says so) or, with integer set, as unsigned integers. Returns false if the accessor
+   is missing, sparse, of a different number of components or out of the buffer. */
+template<class T> static bool glbReadAccessor(const SrJson& root, const SrJson* index, const unsigned char* bin, const size_t binBytes,
+	const int components, std::vector<T>& out) {
+	const SrJson* accessors = root.get("accessors"), * views = root.get("bufferViews");
+	if (index == NULL || index->type != SrJson::NUMBER || accessors == NULL || views == NULL) return false;
+	size_t a = (size_t)index->number;
+	if (a >= accessors->items.size()) return false;
+	const SrJson& accessor = accessors->items[a];
+	const SrJson* typeName = accessor.get("type");
+	const char* types[5] = { "SCALAR", "VEC2", "VEC3", "VEC4", "" };
+	int t = 0;
+	while (t < 4 && (typeName == NULL || typeName->string != types[t])) t++;
+	double view = accessor.get("bufferView", -1.0), count = accessor.get("count", 0.0);
+	int componentType = (int)accessor.get("componentType", 0.0);
+	if (t + 1 != components || accessor.get("sparse") != NULL || view < 0.0 || view >= views->items.size() || count < 0.0 || count > INT_MAX) return false;
+	const SrJson& bufferView = views->items[(size_t)view];
+	int componentBytes = componentType == 5126 || componentType == 5125 ? 4 : componentType == 5123 || componentType == 5122 ? 2 : 1;
+	if (componentType < 5120 || componentType > 5126 || componentType == 5124) return false;
+	size_t elementBytes = componentBytes * components, stride = (size_t)max(bufferView.get("byteStride", (double)elementBytes), 0.0);
+	size_t viewOffset = (size_t)max(bufferView.get("byteOffset", 0.0), 0.0), offset = viewOffset + (size_t)max(accessor.get("byteOffset", 0.0), 0.0);
+	size_t viewEnd = viewOffset + (size_t)max(bufferView.get("byteLength", 0.0), 0.0);
+	if (bufferView.get("buffer", 0.0) != 0.0 || stride < elementBytes || viewEnd > binBytes ||
+		(count > 0 && offset + stride * ((size_t)count - 1) + elementBytes > viewEnd)) return false;
+	const SrJson* normalizedFlag = accessor.get("normalized");
+	bool normalized = normalizedFlag != NULL && normalizedFlag->number != 0.0;
+	out.resize((size_t)count * components);
+	srParallelFor((int)count, [&](int first, int last, int worker) {
+		for (int i = first; i < last; i++)
+			for (int c = 0; c < components; c++) {
+				const unsigned char* p = bin + offset + stride * i + componentBytes * c;
+				double v;
+				switch (componentType) {
+				case 5120: v = normalized ? max(*(const signed char*)p / 127.0, -1.0) : *(const signed char*)p; break;
+				case 5121: v = normalized ? *p / 255.0 : *p; break;
+				case 5122: { short x; memcpy(&x, p, 2); v = normalized ? max(x / 32767.0, -1.0) : x; } break;
+				case 5123: { unsigned short x; memcpy(&x, p, 2); v = normalized ? x / 65535.0 : x; } break;
+				case 5125: { unsigned int x; memcpy(&x, p, 4); v = x; } break;
+				default: { float x; memcpy(&x, p, 4); v = x; } break;
+				}
+				out[(size_t)i * components + c] = (T)v;
+			}
+	});
+	return true;
+}
+/* Loads the triangles of every mesh of a binary glTF file (.glb) into one indexed mesh: positions, normals, uv,
+   tangents (the bitangent from the tangent handedness) and colors (white when missing). The node transforms and the
+   materials are ignored, the primitives that are not triangle lists are skipped. Missing normals are the area
+   weighted average of the triangles around the vertex, missing tangents are computed from the uv (see
+   generateTangents). The file is mapped in memory and the attributes converted in parallel. Returns an empty mesh
+   (reporting the reason) if the file is missing, malformed or uses unsupported features (external or compressed
+   buffers, sparse accessors). */
+SrIndexedMesh loadGlb(const char* fname) {
+	SrIndexedMesh mesh;
+	SrFileMapping file;
+	if (!file.open(fname)) {
+		std::cout << "could not open " << fname << std::endl;
+		return mesh;
+	}
+	// Header, JSON chunk, binary chunk
+	const unsigned char* data = file.data();
+	unsigned int header[5] = { 0, 0, 0, 0, 0 };
+	if (file.size() >= 20) memcpy(header, data, sizeof(header));
+	SrJson root;
+	bool valid = header[0] == 0x46546C67 && header[1] == 2 && header[2] >= 20 && header[2] <= file.size() && header[3] <= header[2] - 20 && header[4] == 0x4E4F534A &&
+		srParseJson((const char*)data + 20, (const char*)data + 20 + header[3], root) != NULL && root.type == SrJson::OBJECT;
+	const unsigned char* bin = NULL;
+	size_t binBytes = 0, binChunk = 20 + (((size_t)header[3] + 3) & ~(size_t)3);
+	if (valid && binChunk + 8 <= header[2]) {
+		unsigned int chunk[2];
+		memcpy(chunk, data + binChunk, sizeof(chunk));
+		valid = chunk[1] == 0x004E4942 && chunk[0] <= header[2] - binChunk - 8;
+		bin = data + binChunk + 8;
+		binBytes = chunk[0];
+	}
+	const SrJson* meshes = root.get("meshes");
+	for (size_t m = 0; valid && meshes != NULL && m < meshes->items.size(); m++) {
+		const SrJson* primitives = meshes->items[m].get("primitives");
+		for (size_t p = 0; valid && primitives != NULL && p < primitives->items.size(); p++) {
+			const SrJson& primitive = primitives->items[p];
+			const SrJson* attributes = primitive.get("attributes");
+			if (primitive.get("mode", 4.0) != 4.0 || attributes == NULL) continue;
+			std::vector<float> positions, normals, uvs, tangents, colors;
+			std::vector<unsigned int> indices;
+			valid = glbReadAccessor(root, attributes->get("POSITION"), bin, binBytes, 3, positions);
+			size_t count = positions.size() / 3;
+			bool hasNormals = attributes->get("NORMAL") != NULL, hasUvs = attributes->get("TEXCOORD_0") != NULL;
+			bool hasTangents = attributes->get("TANGENT") != NULL, hasColors = attributes->get("COLOR_0") != NULL;
+			int colorComponents = 4;
+			if (hasColors) {
+				const SrJson* accessors = root.get("accessors");
+				const SrJson* index = attributes->get("COLOR_0");
+				if (accessors != NULL && index->type == SrJson::NUMBER && (size_t)index->number < accessors->items.size()) {
+					const SrJson* type = accessors->items[(size_t)index->number].get("type");
+					if (type != NULL && type->string == "VEC3") colorComponents = 3;
+				}
+			}
+			valid = valid && (!hasNormals || glbReadAccessor(root, attributes->get("NORMAL"), bin, binBytes, 3, normals)) &&
+				(!hasUvs || glbReadAccessor(root, attributes->get("TEXCOORD_0"), bin, binBytes, 2, uvs)) &&
+				(!hasTangents || glbReadAccessor(root, attributes->get("TANGENT"), bin, binBytes, 4, tangents)) &&
+				(!hasColors || glbReadAccessor(root, attributes->get("COLOR_0"), bin, binBytes, colorComponents, colors)) &&
+				normals.size() / 3 == (hasNormals ? count : 0) && uvs.size() / 2 == (hasUvs ? count : 0) &&
+				tangents.size() / 4 == (hasTangents ? count : 0) && colors.size() / colorComponents == (hasColors ? count : 0);
+			if (valid && primitive.get("indices") != NULL) valid = glbReadAccessor(root, primitive.get("indices"), bin, binBytes, 1, indices);
+			else for (size_t i = 0; i < count; i++) indices.push_back((unsigned int)i);
+			for (size_t i = 0; valid && i < indices.size(); i++) valid = indices[i] < count;
+			if (!valid || indices.size() < 3) continue;
+			indices.resize(indices.size() / 3 * 3);
+			// Primitive as an indexed mesh, completed and appended to the mesh
+			SrIndexedMesh part;
+			part.vertices.resize(count);
+			part.indices32.swap(indices);
+			srParallelFor((int)count, [&](int first, int last, int worker) {
+				for (int i = first; i < last; i++) {
+					SrVertex& v = part.vertices[i];
+					v.position = vec4(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2], 1.0f);
+					v.normal = hasNormals ? vec4(normalize(vec3(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2])), 0.0f) : vec4(0.0f);
+					v.uv = hasUvs ? vec2(uvs[i * 2], uvs[i * 2 + 1]) : vec2(0.0f);
+					v.color = vec4(1.0f);
+					for (int c = 0; hasColors && c < colorComponents; c++) v.color[c] = colors[i * colorComponents + c];
+					if (hasTangents) {
+						vec3 tangent = normalize(vec3(tangents[i * 4], tangents[i * 4 + 1], tangents[i * 4 + 2]));
+						v.tangent = vec4(tangent, 0.0f);
+						v.bitangent = vec4(cross(vec3(v.normal.xyz), tangent) * (tangents[i * 4 + 3] < 0.0f ? -1.0f : 1.0f), 0.0f);
+					}
+				}
+			});
+			if (!hasNormals) {
+				for (size_t i = 0; i < part.indices32.size(); i += 3) {
+					SrVertex* t[3] = { &part.vertices[part.indices32[i]], &part.vertices[part.indices32[i + 1]], &part.vertices[part.indices32[i + 2]] };
+					vec3 n = cross(vec3(t[1]->position.xyz - t[0]->position.xyz), vec3(t[2]->position.xyz - t[0]->position.xyz));
+					for (int k = 0; k < 3; k++) t[k]->normal += vec4(n, 0.0f);
+				}
+				for (size_t i = 0; i < count; i++)
+					part.vertices[i].normal = vec4(length(part.vertices[i].normal) > 0.0f ? normalize(vec3(part.vertices[i].normal.xyz)) : vec3(0, 0, 1), 0.0f);
+			}
+			if (!hasTangents) generateTangents(part); // may split vertices and switch to 16 bit indices
+			size_t base = mesh.vertices.size();
+			mesh.vertices.insert(mesh.vertices.end(), part.vertices.begin(), part.vertices.end());
+			for (size_t i = 0; i < part.getIndexCount(); i++) mesh.indices32.push_back((unsigned int)(part.getIndex(i) + base));
+		}
+	}
+	if (!valid) {
+		std::cout << "invalid or unsupported glTF file " << fname << std::endl;
+		return SrIndexedMesh();
+	}
+	if (mesh.vertices.size() <= 65536) {
+		mesh.indices16.assign(mesh.indices32.begin(), mesh.indices32.end());
+		std::vector<unsigned int>().swap(mesh.indices32);
+	}
+	return mesh;
+}
+#endif
@@ -0,0 +1,557 @@
+// Author: Andrea Luzzati
+#ifndef SR_MESHOPT_H
+#define SR_MESHOPT_H
+#include "gpu.h"       // for SrIndexedMesh
+#include <algorithm>   // for stable_sort
+#include <cmath>       // for pow
+#include <climits>     // for UINT_MAX
+
+using namespace glm;
+
+/* Triangle reordering passes for indexed meshes (see weldMesh) and the statistics to verify them.
+   optimizeVertexCache orders the triangles so that the vertices they share are still in the post-transform cache
+   of a GPU, optimizeOverdraw then moves the outer clusters of triangles first so that the depth test rejects more
+   of the occluded fragments. Both keep the triangles and their winding, only their order changes.
+   simplifyMesh and buildMeshLods reduce the triangles instead, for the levels of detail drawn far from the viewer. */
+
+// Index of the triangle t corner c of an indexed mesh
+static inline unsigned int meshIndex(const SrIndexedMesh& mesh, const size_t t, const int c) {
+	return mesh.getIndex(t * 3 + c);
+}
+// Replaces the triangles of the mesh with the triangles order[0], order[1]...
+static void reorderTriangles(SrIndexedMesh& mesh, const std::vector<int>& order) {
+	std::vector<unsigned int> indices(order.size() * 3);
+	for (size_t t = 0; t < order.size(); t++)
+		for (int c = 0; c < 3; c++) indices[t * 3 + c] = meshIndex(mesh, order[t], c);
+	for (size_t i = 0; i < indices.size(); i++) {
+		if (mesh.indices16.size() > 0) mesh.indices16[i] = (unsigned short)indices[i];
+		else mesh.indices32[i] = indices[i];
+	}
+}
+
+/* Average cache miss ratio: vertices transformed per triangle with a FIFO post-transform cache of cacheSize
+   vertices (0.5 is the ideal for large regular meshes, 3 means no reuse at all) */
+float meshACMR(const SrIndexedMesh& mesh, const int cacheSize = 16) {
+	size_t triangles = mesh.getIndexCount() / 3;
+	if (triangles == 0) return 0.0f;
+	std::vector<size_t> cachedAt(mesh.vertices.size(), 0); // miss count when the vertex entered the cache, +1
+	size_t misses = 0;
+	for (size_t i = 0; i < triangles * 3; i++) {
+		unsigned int v = mesh.getIndex(i);
+		if (cachedAt[v] == 0 || misses + 1 - cachedAt[v] > (size_t)cacheSize) cachedAt[v] = ++misses; // FIFO: evicted after cacheSize misses
+	}
+	return (float)misses / (float)triangles;
+}
+
+/* Average overdraw: fragments passing the depth test over the covered pixels, rendering the triangles in order with
+   back face culling (counterclockwise front faces) from the 6 axis directions at resolution x resolution pixels
+   (1 means every pixel is shaded once, the ideal) */
+float meshOverdraw(const SrIndexedMesh& mesh, const int resolution = 256) {
+	if (mesh.vertices.size() == 0) return 0.0f;
+	vec3 low(mesh.vertices[0].position.xyz), high = low;
+	for (size_t v = 0; v < mesh.vertices.size(); v++) {
+		low = min(low, vec3(mesh.vertices[v].position.xyz));
+		high = max(high, vec3(mesh.vertices[v].position.xyz));
+	}
+	float extent = max(max(high.x - low.x, high.y - low.y), max(high.z - low.z, 1e-20f));
+	std::vector<float> depth(resolution * resolution);
+	size_t shaded = 0, covered = 0;
+	for (int view = 0; view < 6; view++) {
+		int axis = view >> 1;
+		float direction = (view & 1) ? -1.0f : 1.0f; // the camera looks along +axis or -axis
+		std::fill(depth.begin(), depth.end(), 3.4e38f);
+		for (size_t t = 0; t < mesh.getIndexCount() / 3; t++) {
+			vec3 p[3];
+			for (int c = 0; c < 3; c++) {
+				vec3 q = (vec3(mesh.vertices[meshIndex(mesh, t, c)].position.xyz) - low) / extent;
+				// screen x, y from the other two axes (a right handed frame looking along the view direction)
+				p[c] = vec3(q[(axis + 1) % 3] * (resolution - 1), q[(axis + 2) % 3] * (resolution - 1), q[axis] * direction);
+				if (direction < 0.0f) p[c].x = (resolution - 1) - p[c].x;
+			}
+			float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+			if (area >= 0.0f) continue; // back facing or degenerate
+			int x0 = max((int)ceil(min(min(p[0].x, p[1].x), p[2].x)), 0), x1 = min((int)floor(max(max(p[0].x, p[1].x), p[2].x)), resolution - 1);
+			int y0 = max((int)ceil(min(min(p[0].y, p[1].y), p[2].y)), 0), y1 = min((int)floor(max(max(p[0].y, p[1].y), p[2].y)), resolution - 1);
+			for (int y = y0; y <= y1; y++)
+				for (int x = x0; x <= x1; x++) {
+					// barycentric coordinates from the edge functions
+					float w0 = ((p[2].x - p[1].x) * (y - p[1].y) - (p[2].y - p[1].y) * (x - p[1].x)) / area;
+					float w1 = ((p[0].x - p[2].x) * (y - p[2].y) - (p[0].y - p[2].y) * (x - p[2].x)) / area;
+					float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) continue;
+					float z = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+					float& d = depth[x + y * resolution];
+					if (z >= d) continue;
+					if (d == 3.4e38f) covered++;
+					shaded++;
+					d = z;
+				}
+		}
+	}
+	return covered > 0 ? (float)shaded / (float)covered : 0.0f;
+}
+
+/* Orders the triangles for the post-transform vertex cache with Tom Forsyth's linear-speed algorithm: the next
+   triangle is the one with the best score among the triangles of the vertices in a simulated LRU cache of cacheSize
+   vertices, the vertex score favouring the recently used vertices and the ones with few triangles left to draw.
+   vertexCacheOrder returns the new triangle order of the indices of vertexCount vertices. */
+template<class Index> static std::vector<int> vertexCacheOrder(const Index* indices, const int triangles, const int vertexCount, const int cacheSize) {
+	// Triangles of every vertex (adjacency), the ones not emitted yet first
+	std::vector<int> adjacencyStart(vertexCount + 1, 0), adjacency(triangles * 3), valence(vertexCount, 0);
+	for (int i = 0; i < triangles * 3; i++) valence[indices[i]]++;
+	for (int v = 0; v < vertexCount; v++) adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+	std::vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+	for (int i = 0; i < triangles * 3; i++) adjacency[fill[indices[i]]++] = i / 3;
+	// Vertex score tables by cache position and by remaining valence
+	std::vector<float> cacheScore(cacheSize + 3), valenceScore(64);
+	for (int p = 0; p < cacheSize + 3; p++)
+		cacheScore[p] = p < 3 ? 0.75f : (p < cacheSize ? pow(1.0f - (float)(p - 3) / (float)(cacheSize - 3), 1.5f) : 0.0f);
+	for (int n = 1; n < 64; n++) valenceScore[n] = 2.0f / sqrt((float)n);
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount), triangleScore(triangles, 0.0f);
+	auto score = [&](const int v) {
+		if (valence[v] == 0) return -1.0f;
+		return (cachePosition[v] >= 0 ? cacheScore[cachePosition[v]] : 0.0f) + valenceScore[min(valence[v], 63)];
+	};
+	for (int v = 0; v < vertexCount; v++) vertexScore[v] = score(v);
+	for (int i = 0; i < triangles * 3; i++) triangleScore[i / 3] += vertexScore[indices[i]];
+	std::vector<bool> emitted(triangles, false);
+	std::vector<int> order, cache, nextCache;
+	order.reserve(triangles);
+	int best = 0, cursor = 0;
+	while ((int)order.size() < triangles) {
+		if (best < 0) { // no candidate in the cache: continue with the next triangle not emitted yet
+			while (emitted[cursor]) cursor++;
+			best = cursor;
+		}
+		order.push_back(best);
+		emitted[best] = true;
+		// Remove the triangle from the adjacency of its vertices and move them to the front of the cache
+		nextCache.clear();
+		for (int c = 0; c < 3; c++) {
+			int v = (int)indices[best * 3 + c];
+			int* begin = &adjacency[adjacencyStart[v]];
+			int* end = begin + valence[v];
+			*std::find(begin, end, best) = end[-1];
+			valence[v]--;
+			nextCache.push_back(v);
+		}
+		for (size_t i = 0; i < cache.size(); i++)
+			if (std::find(nextCache.begin(), nextCache.begin() + 3, cache[i]) == nextCache.begin() + 3) nextCache.push_back(cache[i]);
+		// The vertices pushed past the cache size fall out of it, their score is updated once more below
+		for (size_t i = 0; i < nextCache.size(); i++) cachePosition[nextCache[i]] = i < (size_t)cacheSize ? (int)i : -1;
+		// Update the scores of the vertices in the cache and of their triangles, picking the best one
+		best = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < nextCache.size(); i++) {
+			int v = nextCache[i];
+			float updated = score(v);
+			float delta = updated - vertexScore[v];
+			vertexScore[v] = updated;
+			for (int a = adjacencyStart[v]; a < adjacencyStart[v] + valence[v]; a++) {
+				int t = adjacency[a];
+				triangleScore[t] += delta;
+				if (triangleScore[t] > bestScore && i < (size_t)cacheSize) {
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+		if (nextCache.size() > (size_t)cacheSize) nextCache.resize(cacheSize);
+		cache.swap(nextCache);
+	}
+	return order;
+}
+void optimizeVertexCache(SrIndexedMesh& mesh, const int cacheSize = 32) {
+	const int triangles = (int)(mesh.getIndexCount() / 3);
+	if (triangles == 0) return;
+	if (mesh.indices16.size() > 0) reorderTriangles(mesh, vertexCacheOrder(&mesh.indices16[0], triangles, (int)mesh.vertices.size(), cacheSize));
+	else reorderTriangles(mesh, vertexCacheOrder(&mesh.indices32[0], triangles, (int)mesh.vertices.size(), cacheSize));
+}
+// Same as above on a list of triangle indices of vertexCount vertices (the levels of detail of buildMeshLods)
+void optimizeVertexCache(std::vector<unsigned int>& indices, const size_t vertexCount, const int cacheSize = 32) {
+	const int triangles = (int)(indices.size() / 3);
+	if (triangles == 0) return;
+	std::vector<int> order = vertexCacheOrder(&indices[0], triangles, (int)vertexCount, cacheSize);
+	std::vector<unsigned int> reordered(triangles * 3);
+	for (int t = 0; t < triangles; t++)
+		for (int c = 0; c < 3; c++) reordered[t * 3 + c] = indices[order[t] * 3 + c];
+	indices.swap(reordered);
+}
+
+/* Reorders the clusters of triangles of a vertex cache optimized mesh so that the outer ones draw first (view
+   independent overdraw reduction, after Sander et al. "Fast triangle reordering for vertex locality and reduced
+   overdraw"). The order is split in clusters where the cache restarts, and further wherever the cluster keeps an
+   ACMR within threshold times the mesh ACMR; the clusters are sorted by the distance of their centroid from the
+   mesh centroid along their average normal, the farthest first. */
+void optimizeOverdraw(SrIndexedMesh& mesh, const float threshold = 1.05f, const int cacheSize = 16) {
+	const int triangles = (int)(mesh.getIndexCount() / 3);
+	if (triangles == 0) return;
+	float meshAcmr = meshACMR(mesh, cacheSize);
+	// Cluster boundaries: simulate the FIFO cache restarting at every boundary
+	std::vector<int> clusterStart;
+	std::vector<size_t> cachedAt(mesh.vertices.size(), 0);
+	size_t misses = 0, clusterMisses = 0;
+	for (int t = 0; t < triangles; t++) {
+		int triangleMisses = 0;
+		for (int c = 0; c < 3; c++) {
+			unsigned int v = meshIndex(mesh, t, c);
+			if (cachedAt[v] == 0 || misses + 1 - cachedAt[v] > (size_t)cacheSize) {
+				cachedAt[v] = ++misses;
+				triangleMisses++;
+			}
+		}
+		int clusterTriangles = clusterStart.size() > 0 ? t - clusterStart.back() : 0;
+		// Hard boundary where the order restarts (no vertex in the cache), soft one when the cluster is efficient
+		bool boundary = clusterStart.size() == 0 || triangleMisses == 3 ||
+			(clusterTriangles >= 16 && (float)clusterMisses / (float)clusterTriangles <= meshAcmr * threshold);
+		if (boundary) {
+			clusterStart.push_back(t);
+			clusterMisses = 0;
+			if (triangleMisses < 3) { // restart the cache at the soft boundary
+				misses += cacheSize + 1;
+				for (int c = 0; c < 3; c++) cachedAt[meshIndex(mesh, t, c)] = ++misses;
+				triangleMisses = 3;
+			}
+		}
+		clusterMisses += triangleMisses;
+	}
+	clusterStart.push_back(triangles);
+	// Area weighted centroids and normals of the mesh and of every cluster
+	int clusters = (int)clusterStart.size() - 1;
+	std::vector<vec3> centroid(clusters, vec3(0.0f)), normal(clusters, vec3(0.0f));
+	std::vector<float> area(clusters, 0.0f);
+	vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (int k = 0; k < clusters; k++) {
+		for (int t = clusterStart[k]; t < clusterStart[k + 1]; t++) {
+			vec3 a(mesh.vertices[meshIndex(mesh, t, 0)].position.xyz), b(mesh.vertices[meshIndex(mesh, t, 1)].position.xyz);
+			vec3 c(mesh.vertices[meshIndex(mesh, t, 2)].position.xyz);
+			vec3 n = cross(b - a, c - a); // twice the area along the normal
+			float doubleArea = length(n);
+			centroid[k] += (a + b + c) * (doubleArea / 3.0f);
+			normal[k] += n;
+			area[k] += doubleArea;
+		}
+		meshCentroid += centroid[k];
+		meshArea += area[k];
+	}
+	if (meshArea <= 0.0f) return;
+	meshCentroid /= meshArea;
+	std::vector<float> key(clusters);
+	for (int k = 0; k < clusters; k++) {
+		vec3 c = area[k] > 0.0f ? centroid[k] / area[k] : meshCentroid;
+		float n = length(normal[k]);
+		key[k] = n > 0.0f ? dot(c - meshCentroid, normal[k] / n) : -3.4e38f;
+	}
+	std::vector<int> clusterOrder(clusters);
+	for (int k = 0; k < clusters; k++) clusterOrder[k] = k;
+	std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](int a, int b) { return key[a] > key[b]; });
+	std::vector<int> order;
+	order.reserve(triangles);
+	for (int k = 0; k < clusters; k++)
+		for (int t = clusterStart[clusterOrder[k]]; t < clusterStart[clusterOrder[k] + 1]; t++) order.push_back(t);
+	reorderTriangles(mesh, order);
+}
+
+/* Splits the triangles in clusters of consecutive triangles (see SrMeshCluster) with at most maxTriangles triangles
+   and maxVertices distinct vertices each, for coarse culling. Run it after the reordering passes, whose local
+   triangle order keeps the clusters compact. */
+std::vector<SrMeshCluster> buildMeshClusters(const SrIndexedMesh& mesh, const int maxTriangles = 128, const int maxVertices = 64) {
+	std::vector<SrMeshCluster> clusters;
+	const size_t triangles = mesh.getIndexCount() / 3;
+	std::vector<unsigned int> lastCluster(mesh.vertices.size(), 0); // cluster index + 1 that last used the vertex
+	size_t first = 0;
+	int vertices = 0;
+	for (size_t t = 0; t <= triangles; t++) {
+		int added = 0;
+		for (int c = 0; t < triangles && c < 3; c++)
+			if (lastCluster[meshIndex(mesh, t, c)] != clusters.size() + 1) added++;
+		if (t < triangles && t - first < (size_t)maxTriangles && vertices + added <= maxVertices) {
+			for (int c = 0; c < 3; c++) lastCluster[meshIndex(mesh, t, c)] = (unsigned int)clusters.size() + 1;
+			vertices += added;
+			continue;
+		}
+		if (t == first) break; // no triangles
+		// Close the cluster [first, t): bounds sphere around the box center, normal cone around the average normal
+		SrMeshCluster cluster;
+		cluster.firstTriangle = (unsigned int)first;
+		cluster.triangleCount = (unsigned int)(t - first);
+		vec3 low(mesh.vertices[meshIndex(mesh, first, 0)].position.xyz), high = low, axis(0.0f);
+		for (size_t u = first; u < t; u++) {
+			vec3 p[3];
+			for (int c = 0; c < 3; c++) {
+				p[c] = vec3(mesh.vertices[meshIndex(mesh, u, c)].position.xyz);
+				low = min(low, p[c]);
+				high = max(high, p[c]);
+			}
+			vec3 n = cross(p[1] - p[0], p[2] - p[0]);
+			if (length(n) > 0.0f) axis += normalize(n);
+		}
+		vec3 center = (low + high) * 0.5f;
+		float radius = 0.0f, minDot = 1.0f;
+		axis = length(axis) > 0.0f ? normalize(axis) : vec3(0.0f, 0.0f, 1.0f);
+		for (size_t u = first; u < t; u++) {
+			vec3 p[3];
+			for (int c = 0; c < 3; c++) {
+				p[c] = vec3(mesh.vertices[meshIndex(mesh, u, c)].position.xyz);
+				radius = max(radius, length(p[c] - center));
+			}
+			vec3 n = cross(p[1] - p[0], p[2] - p[0]);
+			if (length(n) > 0.0f) minDot = min(minDot, dot(normalize(n), axis));
+		}
+		for (int c = 0; c < 3; c++) {
+			cluster.center[c] = center[c];
+			cluster.coneAxis[c] = axis[c];
+		}
+		cluster.radius = radius;
+		// A cone wider than a half space can always be seen from the front
+		cluster.coneCutoff = minDot <= 0.0f ? 1.0f : sqrt(1.0f - minDot * minDot);
+		clusters.push_back(cluster);
+		first = t;
+		vertices = 0;
+		if (t < triangles) t--; // the triangle starts the next cluster
+	}
+	return clusters;
+}
+
+/* Plane quadric of the simplifier (Garland and Heckbert, "Surface simplification using quadric error metrics"): the
+   sum of the squared distances of a point from the planes of the triangles around a vertex, weighted by their area */
+struct SrQuadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2, weight;
+};
+static inline void addQuadric(SrQuadric& q, const SrQuadric& r) {
+	q.a2 += r.a2; q.ab += r.ab; q.ac += r.ac; q.ad += r.ad; q.b2 += r.b2; q.bc += r.bc; q.bd += r.bd;
+	q.c2 += r.c2; q.cd += r.cd; q.d2 += r.d2; q.weight += r.weight;
+}
+// Adds the plane dot(normal, p) + d = 0 with the given weight
+static inline void addPlaneQuadric(SrQuadric& q, const vec3& normal, const float d, const double weight) {
+	double a = normal.x, b = normal.y, c = normal.z;
+	SrQuadric plane = { a * a * weight, a * b * weight, a * c * weight, a * d * weight, b * b * weight, b * c * weight, b * d * weight,
+		c * c * weight, c * d * weight, (double)d * d * weight, weight };
+	addQuadric(q, plane);
+}
+// Mean squared distance of p from the planes of the quadric
+static inline double quadricError(const SrQuadric& q, const vec3& p) {
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + q.d2 + 2.0 * (q.ab * x * y + q.ac * x * z + q.bc * y * z + q.ad * x + q.bd * y + q.cd * z);
+	return q.weight > 0.0 ? max(e, 0.0) / q.weight : 0.0;
+}
+
+/* Simplifies the triangles of indices (of the vertices of mesh) towards targetIndexCount indices with half edge
+   collapses in order of quadric error: a vertex moves onto a neighbour, so the simplified triangles use a subset of
+   the vertices. The vertices on the borders and on the attribute seams (more vertices at the same position) never
+   move, and the collapses that would flip a triangle or make the surface non manifold are skipped, so the target
+   may not be reached. The collapses run in passes of independent collapses (no shared triangles), the cheapest
+   first. Returns the distance of the simplified surface from the original one (the root of the largest error). */
+float simplifyMesh(const SrIndexedMesh& mesh, std::vector<unsigned int>& indices, const size_t targetIndexCount) {
+	const size_t vertexCount = mesh.vertices.size();
+	auto position = [&](const unsigned int v) { return vec3(mesh.vertices[v].position.xyz); };
+	// Vertices at the same position share the first of them (representative), the ones on seams are locked
+	std::vector<unsigned int> sorted(vertexCount), positionOf(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) sorted[v] = (unsigned int)v;
+	std::sort(sorted.begin(), sorted.end(), [&](const unsigned int a, const unsigned int b) {
+		vec3 p = position(a), q = position(b);
+		if (p.x != q.x) return p.x < q.x;
+		if (p.y != q.y) return p.y < q.y;
+		if (p.z != q.z) return p.z < q.z;
+		return a < b;
+	});
+	std::vector<bool> locked(vertexCount, false);
+	for (size_t i = 0, j; i < vertexCount; i = j) {
+		for (j = i + 1; j < vertexCount && position(sorted[j]) == position(sorted[i]); j++);
+		for (size_t k = i; k < j; k++) {
+			positionOf[sorted[k]] = sorted[i];
+			locked[sorted[k]] = j - i > 1;
+		}
+	}
+	// Border and non manifold edges (a directed edge between positions used once, without its opposite) are locked
+	std::vector<unsigned long long> edges(indices.size());
+	for (size_t i = 0; i < indices.size(); i++) {
+		unsigned long long a = positionOf[indices[i]], b = positionOf[indices[i - i % 3 + (i + 1) % 3]];
+		edges[i] = a << 32 | b;
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0, j; i < edges.size(); i = j) {
+		for (j = i + 1; j < edges.size() && edges[j] == edges[i]; j++);
+		unsigned long long opposite = edges[i] << 32 | edges[i] >> 32;
+		std::pair<std::vector<unsigned long long>::iterator, std::vector<unsigned long long>::iterator> range =
+			std::equal_range(edges.begin(), edges.end(), opposite);
+		if (j - i != 1 || range.second - range.first != 1) locked[edges[i] >> 32] = locked[edges[i] & 0xFFFFFFFFULL] = true;
+	}
+	// Quadrics of the planes around every position
+	std::vector<SrQuadric> quadrics(vertexCount, SrQuadric());
+	for (size_t t = 0; t < indices.size() / 3; t++) {
+		vec3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+		vec3 n = cross(p1 - p0, p2 - p0);
+		float doubleArea = length(n);
+		if (doubleArea <= 0.0f) continue;
+		n /= doubleArea;
+		for (int c = 0; c < 3; c++) addPlaneQuadric(quadrics[positionOf[indices[t * 3 + c]]], n, -dot(n, p0), doubleArea * 0.5);
+	}
+	struct collapse {
+		unsigned int from, to;
+		double cost;
+	};
+	std::vector<collapse> collapses;
+	std::vector<double> bestCost(vertexCount);
+	std::vector<unsigned int> bestTarget(vertexCount), adjacencyStart(vertexCount + 1), adjacency, remap(vertexCount), fromRing, toRing;
+	std::vector<unsigned char> state(vertexCount); // 0 free, 1 around a collapse of the pass, 2 collapsed
+	double largestCost = 0.0;
+	while (indices.size() > targetIndexCount) {
+		// Triangles around every position
+		std::fill(adjacencyStart.begin(), adjacencyStart.end(), 0);
+		for (size_t i = 0; i < indices.size(); i++) adjacencyStart[positionOf[indices[i]] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++) adjacencyStart[v + 1] += adjacencyStart[v];
+		adjacency.resize(indices.size());
+		std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++) adjacency[fill[positionOf[indices[i]]]++] = (unsigned int)(i / 3);
+		// Cheapest collapse of every free vertex along the edges of its triangles
+		std::fill(bestCost.begin(), bestCost.end(), -1.0);
+		for (size_t i = 0; i < indices.size(); i++) {
+			unsigned int from = indices[i];
+			if (locked[from]) continue;
+			for (int e = 1; e < 3; e++) {
+				unsigned int to = indices[i - i % 3 + (i + e) % 3];
+				SrQuadric q = quadrics[from];
+				addQuadric(q, quadrics[positionOf[to]]);
+				double cost = quadricError(q, position(to));
+				if (bestCost[from] < 0.0 || cost < bestCost[from]) {
+					bestCost[from] = cost;
+					bestTarget[from] = to;
+				}
+			}
+		}
+		collapses.clear();
+		for (size_t v = 0; v < vertexCount; v++)
+			if (bestCost[v] >= 0.0) collapses.push_back({ (unsigned int)v, bestTarget[v], bestCost[v] });
+		std::sort(collapses.begin(), collapses.end(), [](const collapse& a, const collapse& b) { return a.cost < b.cost; });
+		// Collapse the cheapest vertices whose triangles are untouched in this pass
+		std::fill(state.begin(), state.end(), 0);
+		size_t removedTriangles = 0, collapsed = 0;
+		for (size_t k = 0; k < collapses.size() && indices.size() - removedTriangles * 3 > targetIndexCount; k++) {
+			unsigned int from = collapses[k].from, to = collapses[k].to, target = positionOf[to];
+			if (state[from] != 0 || state[target] != 0) continue;
+			vec3 pTo = position(to);
+			bool allowed = true;
+			size_t edgeTriangles = 0;
+			fromRing.clear();
+			for (unsigned int a = adjacencyStart[from]; allowed && a < adjacencyStart[from + 1]; a++) {
+				const unsigned int* triangle = &indices[adjacency[a] * 3];
+				bool onEdge = false;
+				for (int c = 0; c < 3; c++) {
+					unsigned int p = positionOf[triangle[c]];
+					if (p == target) {
+						onEdge = true;
+						allowed = triangle[c] == to; // the target vertex keeps the attributes of the triangles
+					}
+					else if (p != from) fromRing.push_back(p);
+				}
+				if (onEdge) {
+					edgeTriangles++;
+					continue;
+				}
+				// The triangles that keep their area must not flip
+				vec3 before[3], after[3];
+				for (int c = 0; c < 3; c++) {
+					before[c] = position(triangle[c]);
+					after[c] = triangle[c] == from ? pTo : before[c];
+				}
+				vec3 normalBefore = cross(before[1] - before[0], before[2] - before[0]), normalAfter = cross(after[1] - after[0], after[2] - after[0]);
+				allowed = dot(normalBefore, normalAfter) > 0.0f;
+			}
+			if (!allowed) continue;
+			// Link condition: the two ends share only the opposite vertices of the triangles of the edge
+			toRing.clear();
+			for (unsigned int a = adjacencyStart[target]; a < adjacencyStart[target + 1]; a++)
+				for (int c = 0; c < 3; c++) {
+					unsigned int p = positionOf[indices[adjacency[a] * 3 + c]];
+					if (p != target && p != from) toRing.push_back(p);
+				}
+			std::sort(fromRing.begin(), fromRing.end());
+			fromRing.erase(std::unique(fromRing.begin(), fromRing.end()), fromRing.end());
+			std::sort(toRing.begin(), toRing.end());
+			toRing.erase(std::unique(toRing.begin(), toRing.end()), toRing.end());
+			size_t shared = 0;
+			for (size_t i = 0, j = 0; i < fromRing.size() && j < toRing.size();) {
+				if (fromRing[i] == toRing[j]) shared++, i++, j++;
+				else if (fromRing[i] < toRing[j]) i++;
+				else j++;
+			}
+			if (shared != edgeTriangles) continue;
+			// Collapse, locking the vertices around it for the rest of the pass
+			remap[from] = to;
+			state[from] = 2;
+			state[target] = 1;
+			for (size_t i = 0; i < fromRing.size(); i++) state[fromRing[i]] = max(state[fromRing[i]], (unsigned char)1);
+			addQuadric(quadrics[target], quadrics[from]);
+			largestCost = max(largestCost, collapses[k].cost);
+			removedTriangles += edgeTriangles;
+			collapsed++;
+		}
+		if (collapsed == 0) break;
+		// Move the collapsed vertices and remove the triangles of the collapsed edges
+		size_t kept = 0;
+		for (size_t t = 0; t < indices.size() / 3; t++) {
+			unsigned int v[3];
+			for (int c = 0; c < 3; c++) {
+				v[c] = indices[t * 3 + c];
+				if (state[v[c]] == 2) v[c] = remap[v[c]];
+			}
+			if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) continue;
+			for (int c = 0; c < 3; c++) indices[kept++] = v[c];
+		}
+		indices.resize(kept);
+	}
+	return (float)sqrt(largestCost);
+}
+
+/* Builds the levels of detail of a mesh (see SrMeshLod), each with about half the triangles of the previous one
+   (see simplifyMesh), until there are maxLods of them or the simplification stops making progress. The level 0 is
+   the mesh itself, the indices of the others are returned in lodIndices, stored after the ones of the mesh (see
+   packMesh). The vertices are renumbered so that every level uses a prefix of them, the coarsest level the shortest
+   one. The error of a level adds up the errors of the simplifications before it. */
+std::vector<SrMeshLod> buildMeshLods(SrIndexedMesh& mesh, std::vector<unsigned int>& lodIndices, const int maxLods = 6) {
+	std::vector<SrMeshLod> lods;
+	lodIndices.clear();
+	const size_t indexCount = mesh.getIndexCount();
+	if (indexCount == 0) return lods;
+	std::vector<std::vector<unsigned int> > levels(1, std::vector<unsigned int>(indexCount));
+	for (size_t i = 0; i < indexCount; i++) levels[0][i] = mesh.getIndex(i);
+	std::vector<float> errors(1, 0.0f);
+	while ((int)levels.size() < maxLods) {
+		std::vector<unsigned int> simplified = levels.back();
+		float error = simplifyMesh(mesh, simplified, simplified.size() / 6 * 3);
+		if (simplified.size() * 10 > levels.back().size() * 9) break; // less than 10% fewer triangles
+		optimizeVertexCache(simplified, mesh.vertices.size());
+		errors.push_back(errors.back() + error);
+		levels.push_back(simplified);
+	}
+	// Number the vertices in order of first use from the coarsest level, the unused ones last
+	std::vector<unsigned int> remap(mesh.vertices.size(), UINT_MAX);
+	std::vector<unsigned int> vertexCounts(levels.size());
+	unsigned int next = 0;
+	for (int k = (int)levels.size() - 1; k >= 0; k--) {
+		for (size_t i = 0; i < levels[k].size(); i++)
+			if (remap[levels[k][i]] == UINT_MAX) remap[levels[k][i]] = next++;
+		vertexCounts[k] = next;
+	}
+	for (size_t v = 0; v < remap.size(); v++)
+		if (remap[v] == UINT_MAX) remap[v] = next++;
+	std::vector<SrVertex> vertices(mesh.vertices.size());
+	for (size_t v = 0; v < remap.size(); v++) vertices[remap[v]] = mesh.vertices[v];
+	mesh.vertices.swap(vertices);
+	for (size_t i = 0; i < mesh.indices16.size(); i++) mesh.indices16[i] = (unsigned short)remap[mesh.indices16[i]];
+	for (size_t i = 0; i < mesh.indices32.size(); i++) mesh.indices32[i] = remap[mesh.indices32[i]];
+	for (size_t k = 0; k < levels.size(); k++) {
+		SrMeshLod lod;
+		lod.firstIndex = k == 0 ? 0 : (unsigned int)(indexCount + lodIndices.size());
+		lod.indexCount = (unsigned int)levels[k].size();
+		lod.vertexCount = vertexCounts[k];
+		lod.error = errors[k];
+		lods.push_back(lod);
+		for (size_t i = 0; k > 0 && i < levels[k].size(); i++) lodIndices.push_back(remap[levels[k][i]]);
+	}
+	return lods;
+}
+#endif
@@ -0,0 +1,102 @@
+// Author: Andrea Luzzati
+#ifndef SR_PARALLEL_H
+#define SR_PARALLEL_H
+#include <thread>                      // for thread, hardware_concurrency
+#include <vector>                      // for vector
+#include <deque>                       // for the task queue
+#include <functional>                  // for function
+#include <future>                      // for future, packaged_task
+#include <memory>                      // for shared_ptr
+#include <mutex>                       // for mutex
+#include <condition_variable>          // for condition_variable
+
+// Number of workers used by the parallel loops (one per hardware thread)
+int srThreadCount() {
+	static const int count = std::thread::hardware_concurrency() > 0 ? (int)std::thread::hardware_concurrency() : 1;
+	return count;
+}
+/* Pool of worker threads running tasks in submission order, used for the asynchronous asset loading (see srAsync).
+   The tasks must not wait for other tasks of the pool. */
+class SrThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > tasks;
+	std::mutex mutex;
+	std::condition_variable available;
+	bool stopping;
+	static bool& workerFlag() {
+		static thread_local bool worker = false;
+		return worker;
+	}
+	void work() {
+		workerFlag() = true;
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				available.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if (tasks.empty()) return; // stopping with no tasks left
+				task = tasks.front();
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+public:
+	SrThreadPool(const int threads) : stopping(false) {
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(&SrThreadPool::work, this));
+	}
+	// Runs the tasks still queued, then stops the workers
+	~SrThreadPool() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		available.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+	// Queues func() and returns the future of its result (exceptions are rethrown by future::get)
+	template<typename F> std::future<decltype(std::declval<F>()())> submit(F func) {
+		typedef decltype(std::declval<F>()()) R;
+		std::shared_ptr<std::packaged_task<R()> > task(new std::packaged_task<R()>(func));
+		std::future<R> result = task->get_future();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			tasks.push_back([task] { (*task)(); });
+		}
+		available.notify_one();
+		return result;
+	}
+	// Returns true when called by a worker of any pool
+	static bool insideWorker() { return workerFlag(); }
+};
+// The asset loading pool, with one worker per hardware thread
+SrThreadPool& srThreadPool() {
+	static SrThreadPool pool(srThreadCount());
+	return pool;
+}
+// Runs func() on the asset loading pool, returning the future of its result
+template<typename F> std::future<decltype(std::declval<F>()())> srAsync(F func) {
+	return srThreadPool().submit(func);
+}
+/* Splits the range [0, count) in contiguous chunks, one per worker, and calls func(begin, end, worker) for every chunk
+   on its own thread (the calling thread runs the first chunk). worker is in [0, srThreadCount()) so that it can index
+   per-worker accumulators, to be reduced once srParallelFor returns. Called by a pool worker (see srAsync), it runs
+   the chunks on the calling thread. */
+template<typename F> void srParallelFor(const int count, F func) {
+	int workers = count < srThreadCount() ? count : srThreadCount();
+	// Inside a pool worker the loop runs serially: the pool already keeps every core busy
+	if (workers <= 1 || SrThreadPool::insideWorker()) {
+		if (count > 0) func(0, count, 0);
+		return;
+	}
+	std::vector<std::thread> threads;
+	for (int w = 1; w < workers; w++)
+		threads.push_back(std::thread(func, (int)((long long)count * w / workers), (int)((long long)count * (w + 1) / workers), w));
+	func(0, count / workers, 0);
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+}
+#endif
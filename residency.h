@@ -0,0 +1,142 @@
+// Author: Andrea Luzzati
+#ifndef SR_RESIDENCY_H
+#define SR_RESIDENCY_H
+#include "texture.h" // includes vector,glm,iostream
+
+/* Keeps the mipmap levels of a set of streamed textures (see SrTexture::textureFromContainerStreamed) in memory
+   within a budget. While rendering, every texture records the finest level its sampler asked for (LOD feedback);
+   update, called between frames, streams in the requested levels and releases the ones no longer needed. When the
+   requests exceed the budget, the levels of the least recently used textures are released first, then the finest
+   requested levels are dropped starting from the largest; the sampler falls back to the finest resident level. */
+class SrResidencyManager {
+private:
+	struct residentTexture {
+		SrTexture* texture;
+		int lastUsedFrame; // last frame the texture was sampled in
+		int targetLevel;   // finest level to keep in memory
+	};
+	std::vector<residentTexture> textures;
+	size_t budget;
+	size_t bytesPerUpdate;
+	int frame;
+	size_t streamedBytes;
+	size_t evictedBytes;
+	// Memory of the levels of a texture from mipmapLevel to the last one
+	static size_t chainMemory(SrTexture* texture, const int mipmapLevel);
+public:
+	/* Initialize the manager with a memory budget in bytes. bytesPerUpdate limits the data streamed in by every
+	   update (0 for no limit), so that the levels of a new view are spread over a few frames. */
+	SrResidencyManager(const size_t memoryBudget, const size_t bytesPerUpdate = 0);
+	// Adds a streamed texture to the managed set (the texture must outlive the manager or be removed first)
+	void addTexture(SrTexture* texture);
+	void removeTexture(SrTexture* texture);
+	// Streams in and releases levels following the LOD feedback of the last frame, then resets the feedback
+	void update();
+	// Get the memory used by the managed textures, in bytes
+	size_t getMemoryUsage();
+	size_t getBudget();
+	void setBudget(const size_t memoryBudget);
+	// Get the total bytes streamed in and released since the manager was created
+	void getStats(size_t& streamed, size_t& evicted);
+};
+
+
+// RESIDENCY MANAGER IMPLEMENTATION
+SrResidencyManager::SrResidencyManager(const size_t memoryBudget, const size_t maxBytesPerUpdate) {
+	budget = memoryBudget;
+	bytesPerUpdate = maxBytesPerUpdate;
+	frame = 0;
+	streamedBytes = 0;
+	evictedBytes = 0;
+}
+void SrResidencyManager::addTexture(SrTexture* texture) {
+	if (!texture->isStreamed()) return;
+	residentTexture rt;
+	rt.texture = texture;
+	rt.lastUsedFrame = frame;
+	rt.targetLevel = texture->getResidentLevel();
+	textures.push_back(rt);
+}
+void SrResidencyManager::removeTexture(SrTexture* texture) {
+	for (size_t i = 0; i < textures.size(); i++)
+		if (textures[i].texture == texture) {
+			textures.erase(textures.begin() + i);
+			return;
+		}
+}
+size_t SrResidencyManager::chainMemory(SrTexture* texture, const int mipmapLevel) {
+	size_t bytes = 0;
+	for (int l = mipmapLevel; l < texture->getMipmapCount(); l++)
+		bytes += texture->getLevelMemory(l);
+	return bytes;
+}
+void SrResidencyManager::update() {
+	frame++;
+	// Targets from the LOD feedback: the textures not sampled keep their levels until the memory is needed
+	size_t total = 0;
+	for (size_t i = 0; i < textures.size(); i++) {
+		residentTexture& rt = textures[i];
+		int requested = rt.texture->getRequestedLevel();
+		if (requested < rt.texture->getMipmapCount()) {
+			rt.lastUsedFrame = frame;
+			rt.targetLevel = requested;
+		}
+		else rt.targetLevel = rt.texture->getResidentLevel();
+		rt.targetLevel = min(rt.targetLevel, rt.texture->getPinnedLevel());
+		rt.texture->resetLodFeedback();
+		total += chainMemory(rt.texture, rt.targetLevel);
+	}
+	// Fit the targets in the budget one level at a time: the least recently used textures first, then the largest
+	// finest level (the mip tails are always resident, they may exceed a very small budget)
+	while (total > budget) {
+		residentTexture* victim = NULL;
+		for (size_t i = 0; i < textures.size(); i++) {
+			residentTexture& rt = textures[i];
+			if (rt.targetLevel >= rt.texture->getPinnedLevel()) continue;
+			if (victim == NULL || rt.lastUsedFrame < victim->lastUsedFrame || (rt.lastUsedFrame == victim->lastUsedFrame &&
+				rt.texture->getLevelMemory(rt.targetLevel) > victim->texture->getLevelMemory(victim->targetLevel)))
+				victim = &rt;
+		}
+		if (victim == NULL) break;
+		total -= victim->texture->getLevelMemory(victim->targetLevel);
+		victim->targetLevel++;
+	}
+	// Release before streaming so that the memory never exceeds the budget
+	for (size_t i = 0; i < textures.size(); i++)
+		evictedBytes += textures[i].texture->evictLevels(textures[i].targetLevel);
+	// Stream one level per texture at a time, coarsest first, so that every texture sharpens progressively
+	size_t streamed = 0;
+	bool pending = true;
+	while (pending && (bytesPerUpdate == 0 || streamed < bytesPerUpdate)) {
+		pending = false;
+		for (size_t i = 0; i < textures.size() && (bytesPerUpdate == 0 || streamed < bytesPerUpdate); i++) {
+			SrTexture* texture = textures[i].texture;
+			int level = texture->getResidentLevel() - 1;
+			if (level < textures[i].targetLevel) continue;
+			if (!texture->streamLevels(level)) {
+				textures[i].targetLevel = level + 1; // unreadable, keep what is resident
+				continue;
+			}
+			streamed += texture->getLevelMemory(level);
+			pending = pending || level > textures[i].targetLevel;
+		}
+	}
+	streamedBytes += streamed;
+}
+size_t SrResidencyManager::getMemoryUsage() {
+	size_t bytes = 0;
+	for (size_t i = 0; i < textures.size(); i++)
+		bytes += textures[i].texture->getMemoryUsage();
+	return bytes;
+}
+size_t SrResidencyManager::getBudget() {
+	return budget;
+}
+void SrResidencyManager::setBudget(const size_t memoryBudget) {
+	budget = memoryBudget;
+}
+void SrResidencyManager::getStats(size_t& streamed, size_t& evicted) {
+	streamed = streamedBytes;
+	evicted = evictedBytes;
+}
+#endif
@@ -0,0 +1,295 @@
+// Author: Andrea Luzzati
+#ifndef SR_SCENE_H
+#define SR_SCENE_H
+#include "gpu.h"       // for SrGPU, SrPackedMesh, SrInstance
+#include <algorithm>   // for nth_element, sort
+
+using namespace glm;
+
+/* Scene of many objects above SrGPU, for the scenes too large to submit every mesh every frame. The objects (copies
+   of packed meshes with their instance data) are kept in a bounding volume hierarchy traversed front to back: the
+   nodes outside the view frustum are skipped, and so are the nodes whose screen bounds are behind the depth already
+   drawn, tested against a hierarchical depth buffer (see SrHiZ) updated after every draw. The visible objects are
+   drawn through the instanced pipeline (see SrGPU::submitInstancedMesh), so the vertex shader of the scene is
+   SrGPU::instanceVertexShaderProgram, which receives the transform of the object. */
+
+/* Hierarchical depth buffer: level 0 keeps the largest depth of every tile x tile pixels of the depth buffer, every
+   next level the largest of 2x2 texels of the previous one. A rectangle of pixels whose nearest depth is beyond the
+   largest depth under it fails the depth test everywhere, so what it holds can be skipped. */
+class SrHiZ {
+public:
+	static const int tile = 8;
+	// Rebuilds the pyramid from the whole depth buffer
+	void build(SrTexture& depthBuffer);
+	// Updates the pyramid over the pixels [x0,x1]x[y0,y1] of the depth buffer, after drawing there
+	void update(SrTexture& depthBuffer, int x0, int y0, int x1, int y1);
+	// True when every pixel of [x0,x1]x[y0,y1] is nearer than nearestDepth (reading at most 2x2 texels)
+	bool occluded(int x0, int y0, int x1, int y1, const float nearestDepth) const;
+private:
+	std::vector<std::vector<float> > levels;
+	std::vector<int> widths, heights;
+	int pixelWidth, pixelHeight;
+};
+
+// Object of a scene: a copy of a packed mesh (owned by the caller) with its instance data and world space bounds
+struct SrSceneObject {
+	SrPackedMesh* mesh;
+	SrInstance instance;
+	vec3 boundsMin, boundsMax;
+};
+// Statistics of a frame of SrScene::render
+struct SrSceneStats {
+	int nodesVisited;
+	int frustumCulled;   // nodes and objects outside the view frustum
+	int occlusionCulled; // nodes and objects behind the depth buffer
+	int objectsDrawn;
+	size_t trianglesDrawn;
+};
+
+class SrScene {
+public:
+	// Adds a copy of mesh placed by instance.world, returns the index of the object. Call build before render.
+	int addObject(SrPackedMesh& mesh, const SrInstance& instance);
+	// Builds the hierarchy of the objects (median splits along the largest axis, up to maxLeafObjects per leaf)
+	void build(const int maxLeafObjects = 4);
+	/* Draws the visible objects on gpu front to back. viewProjection maps the world space to the clip space, as the
+	   instance vertex shader does; without occlusionCulling only the nodes outside the view frustum are skipped. */
+	SrSceneStats render(SrGPU& gpu, const mat4& viewProjection, const SrGPU::CullMode culling = SrGPU::NOCULLING,
+		const bool occlusionCulling = true);
+	size_t getObjectCount() const { return objects.size(); }
+	const SrSceneObject& getObject(const int index) const { return objects[index]; }
+private:
+	struct node {
+		vec3 boundsMin, boundsMax;
+		int first; // first object in order for a leaf, first child (the other is first + 1) for an inner node
+		int count; // objects of a leaf, 0 for an inner node
+	};
+	std::vector<SrSceneObject> objects;
+	std::vector<node> nodes;
+	std::vector<int> order; // objects by leaf
+	SrHiZ hiz;
+	std::vector<SrInstance> batch;
+	void buildNode(const int index, const int first, const int count, const int maxLeafObjects);
+	/* Pixel rectangle (clamped to the screen) and nearest depth of a world space box; false when the box is outside
+	   the view frustum. A box crossing the eye plane covers the whole screen at the nearest depth. */
+	static bool screenBounds(const mat4& viewProjection, const vec3& low, const vec3& high, const int width, const int height,
+		int rect[4], float& nearestDepth);
+};
+
+
+// HIERARCHICAL DEPTH IMPLEMENTATION
+void SrHiZ::build(SrTexture& depthBuffer) {
+	pixelWidth = depthBuffer.getTextureWidth();
+	pixelHeight = depthBuffer.getTextureHeight();
+	levels.clear();
+	widths.clear();
+	heights.clear();
+	int width = (pixelWidth + tile - 1) / tile, height = (pixelHeight + tile - 1) / tile;
+	while (true) {
+		levels.push_back(std::vector<float>(width * height));
+		widths.push_back(width);
+		heights.push_back(height);
+		if (width == 1 && height == 1) break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+	update(depthBuffer, 0, 0, pixelWidth - 1, pixelHeight - 1);
+}
+void SrHiZ::update(SrTexture& depthBuffer, int x0, int y0, int x1, int y1) {
+	x0 = max(x0, 0); y0 = max(y0, 0);
+	x1 = min(x1, pixelWidth - 1); y1 = min(y1, pixelHeight - 1);
+	if (x0 > x1 || y0 > y1) return;
+	int tx0 = x0 / tile, ty0 = y0 / tile, tx1 = x1 / tile, ty1 = y1 / tile;
+	for (int ty = ty0; ty <= ty1; ty++)
+		for (int tx = tx0; tx <= tx1; tx++) {
+			float depth = -std::numeric_limits<float>::max();
+			for (int y = ty * tile; y < min((ty + 1) * tile, pixelHeight); y++)
+				for (int x = tx * tile; x < min((tx + 1) * tile, pixelWidth); x++) depth = max(depth, depthBuffer.read(x, y).x);
+			levels[0][tx + ty * widths[0]] = depth;
+		}
+	for (size_t l = 1; l < levels.size(); l++) {
+		tx0 >>= 1; ty0 >>= 1; tx1 >>= 1; ty1 >>= 1;
+		const std::vector<float>& fine = levels[l - 1];
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++) {
+				float depth = -std::numeric_limits<float>::max();
+				for (int y = ty * 2; y < min(ty * 2 + 2, heights[l - 1]); y++)
+					for (int x = tx * 2; x < min(tx * 2 + 2, widths[l - 1]); x++) depth = max(depth, fine[x + y * widths[l - 1]]);
+				levels[l][tx + ty * widths[l]] = depth;
+			}
+	}
+}
+bool SrHiZ::occluded(int x0, int y0, int x1, int y1, const float nearestDepth) const {
+	x0 = max(x0, 0); y0 = max(y0, 0);
+	x1 = min(x1, pixelWidth - 1); y1 = min(y1, pixelHeight - 1);
+	if (x0 > x1 || y0 > y1) return false;
+	int tx0 = x0 / tile, ty0 = y0 / tile, tx1 = x1 / tile, ty1 = y1 / tile;
+	size_t l = 0;
+	while (l + 1 < levels.size() && (tx1 - tx0 > 1 || ty1 - ty0 > 1)) {
+		tx0 >>= 1; ty0 >>= 1; tx1 >>= 1; ty1 >>= 1;
+		l++;
+	}
+	float depth = -std::numeric_limits<float>::max();
+	for (int ty = ty0; ty <= ty1; ty++)
+		for (int tx = tx0; tx <= tx1; tx++) depth = max(depth, levels[l][tx + ty * widths[l]]);
+	return nearestDepth >= depth; // the depth test passes only where the stored depth is larger
+}
+
+
+// SCENE IMPLEMENTATION
+int SrScene::addObject(SrPackedMesh& mesh, const SrInstance& instance) {
+	SrSceneObject object;
+	object.mesh = &mesh;
+	object.instance = instance;
+	// World space box of the corners of the quantization bounds of the mesh
+	vec3 extent = mesh.boundsScale * 65535.0f;
+	for (int c = 0; c < 8; c++) {
+		vec3 corner = mesh.boundsMin + extent * vec3(c & 1, (c >> 1) & 1, (c >> 2) & 1);
+		vec3 p = vec3(instance.world * vec4(corner, 1.0f));
+		object.boundsMin = c == 0 ? p : min(object.boundsMin, p);
+		object.boundsMax = c == 0 ? p : max(object.boundsMax, p);
+	}
+	objects.push_back(object);
+	return (int)objects.size() - 1;
+}
+void SrScene::build(const int maxLeafObjects) {
+	nodes.clear();
+	order.resize(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) order[i] = (int)i;
+	if (objects.size() == 0) return;
+	nodes.push_back(node());
+	buildNode(0, 0, (int)objects.size(), max(maxLeafObjects, 1));
+}
+void SrScene::buildNode(const int index, const int first, const int count, const int maxLeafObjects) {
+	node n;
+	n.boundsMin = objects[order[first]].boundsMin;
+	n.boundsMax = objects[order[first]].boundsMax;
+	vec3 centerMin = (n.boundsMin + n.boundsMax) * 0.5f, centerMax = centerMin;
+	for (int i = first; i < first + count; i++) {
+		const SrSceneObject& object = objects[order[i]];
+		n.boundsMin = min(n.boundsMin, object.boundsMin);
+		n.boundsMax = max(n.boundsMax, object.boundsMax);
+		centerMin = min(centerMin, (object.boundsMin + object.boundsMax) * 0.5f);
+		centerMax = max(centerMax, (object.boundsMin + object.boundsMax) * 0.5f);
+	}
+	if (count <= maxLeafObjects) {
+		// The objects of the same mesh are drawn together (see render)
+		std::sort(order.begin() + first, order.begin() + first + count, [&](const int a, const int b) { return objects[a].mesh < objects[b].mesh; });
+		n.first = first;
+		n.count = count;
+		nodes[index] = n;
+		return;
+	}
+	// Median split of the object centers along the largest axis of their bounds
+	vec3 extent = centerMax - centerMin;
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	int middle = first + count / 2;
+	std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count, [&](const int a, const int b) {
+		return objects[a].boundsMin[axis] + objects[a].boundsMax[axis] < objects[b].boundsMin[axis] + objects[b].boundsMax[axis];
+	});
+	n.first = (int)nodes.size();
+	n.count = 0;
+	nodes[index] = n;
+	nodes.push_back(node());
+	nodes.push_back(node());
+	buildNode(n.first, first, middle - first, maxLeafObjects);
+	buildNode(n.first + 1, middle, first + count - middle, maxLeafObjects);
+}
+bool SrScene::screenBounds(const mat4& viewProjection, const vec3& low, const vec3& high, const int width, const int height,
+	int rect[4], float& nearestDepth) {
+	int outside[6] = { 0, 0, 0, 0, 0, 0 };
+	bool crossesEye = false;
+	vec2 screenMin(std::numeric_limits<float>::max()), screenMax(-std::numeric_limits<float>::max());
+	nearestDepth = std::numeric_limits<float>::max();
+	for (int c = 0; c < 8; c++) {
+		vec4 p = viewProjection * vec4(c & 1 ? high.x : low.x, c & 2 ? high.y : low.y, c & 4 ? high.z : low.z, 1.0f);
+		for (int axis = 0; axis < 3; axis++) {
+			outside[axis * 2] += p[axis] < -p.w;
+			outside[axis * 2 + 1] += p[axis] > p.w;
+		}
+		if (p.w <= 1e-6f) {
+			crossesEye = true;
+			continue;
+		}
+		// Same viewport mapping as the rasterizer, depth after the perspective division
+		vec2 screen = (vec2(p.x, p.y) / p.w + vec2(1.0f, 1.0f)) * 0.5f * vec2(width, height);
+		screenMin = min(screenMin, screen);
+		screenMax = max(screenMax, screen);
+		nearestDepth = min(nearestDepth, p.z / p.w);
+	}
+	for (int plane = 0; plane < 6; plane++)
+		if (outside[plane] == 8) return false;
+	if (crossesEye) {
+		rect[0] = 0; rect[1] = 0; rect[2] = width - 1; rect[3] = height - 1;
+		nearestDepth = -std::numeric_limits<float>::max();
+		return true;
+	}
+	// One more pixel around the box, like the bounding box of the rasterizer
+	rect[0] = max((int)floor(screenMin.x) - 1, 0);
+	rect[1] = max((int)floor(screenMin.y) - 1, 0);
+	rect[2] = min((int)ceil(screenMax.x) + 1, width - 1);
+	rect[3] = min((int)ceil(screenMax.y) + 1, height - 1);
+	return rect[0] <= rect[2] && rect[1] <= rect[3];
+}
+SrSceneStats SrScene::render(SrGPU& gpu, const mat4& viewProjection, const SrGPU::CullMode culling, const bool occlusionCulling) {
+	SrSceneStats stats = { 0, 0, 0, 0, 0 };
+	if (nodes.size() == 0) return stats;
+	int width = gpu.backBuffer->getTextureWidth(), height = gpu.backBuffer->getTextureHeight();
+	if (occlusionCulling) hiz.build(*gpu.depthBuffer);
+	std::vector<int> stack(1, 0);
+	int rect[4];
+	float nearestDepth;
+	while (stack.size() > 0) {
+		const node n = nodes[stack.back()];
+		stack.pop_back();
+		stats.nodesVisited++;
+		if (!screenBounds(viewProjection, n.boundsMin, n.boundsMax, width, height, rect, nearestDepth)) {
+			stats.frustumCulled++;
+			continue;
+		}
+		if (occlusionCulling && hiz.occluded(rect[0], rect[1], rect[2], rect[3], nearestDepth)) {
+			stats.occlusionCulled++;
+			continue;
+		}
+		if (n.count == 0) {
+			// Visit the nearer child first (the smaller clip space depth of its center): push it last
+			vec3 centerA = (nodes[n.first].boundsMin + nodes[n.first].boundsMax) * 0.5f;
+			vec3 centerB = (nodes[n.first + 1].boundsMin + nodes[n.first + 1].boundsMax) * 0.5f;
+			bool aFirst = (viewProjection * vec4(centerA, 1.0f)).z <= (viewProjection * vec4(centerB, 1.0f)).z;
+			stack.push_back(aFirst ? n.first + 1 : n.first);
+			stack.push_back(aFirst ? n.first : n.first + 1);
+			continue;
+		}
+		// Leaf: test its objects on their own, then draw the visible ones with an instanced draw per mesh
+		int dirty[4] = { width, height, -1, -1 };
+		SrPackedMesh* mesh = NULL;
+		batch.clear();
+		for (int i = n.first; i <= n.first + n.count; i++) {
+			const SrSceneObject* object = i < n.first + n.count ? &objects[order[i]] : NULL;
+			if (object != NULL && n.count > 1) {
+				if (!screenBounds(viewProjection, object->boundsMin, object->boundsMax, width, height, rect, nearestDepth)) {
+					stats.frustumCulled++;
+					continue;
+				}
+				if (occlusionCulling && hiz.occluded(rect[0], rect[1], rect[2], rect[3], nearestDepth)) {
+					stats.occlusionCulled++;
+					continue;
+				}
+			}
+			if (batch.size() > 0 && (object == NULL || object->mesh != mesh)) {
+				gpu.submitInstancedMesh(*mesh, batch, culling);
+				stats.objectsDrawn += (int)batch.size();
+				stats.trianglesDrawn += mesh->getIndexCount() / 3 * batch.size();
+				batch.clear();
+			}
+			if (object == NULL) break;
+			mesh = object->mesh;
+			batch.push_back(object->instance);
+			dirty[0] = min(dirty[0], rect[0]); dirty[1] = min(dirty[1], rect[1]);
+			dirty[2] = max(dirty[2], rect[2]); dirty[3] = max(dirty[3], rect[3]);
+		}
+		if (occlusionCulling) hiz.update(*gpu.depthBuffer, dirty[0], dirty[1], dirty[2], dirty[3]);
+	}
+	return stats;
+}
+#endif
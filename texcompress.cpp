@@ -0,0 +1,43 @@
+// Author: Andrea Luzzati
+// Offline tool to block compress a picture (with its whole mipmap chain) to a file that can be loaded
+// at runtime with SrTexture::textureFromCompressed.
+// Usage: texcompress <input picture> <output file> <bc1|bc4|bc5|bc7> [srgb]
+//   srgb: gamma correct the picture when loading and store it gamma encoded (use it for basecolor textures)
+#include <iostream>
+#include <string>
+#include "texture.h"
+
+int main(int argc, char** argv) {
+	if (argc < 4) {
+		std::cout << "usage: texcompress <input picture> <output file> <bc1|bc4|bc5|bc7> [srgb]" << std::endl;
+		return 1;
+	}
+	std::string fmt = argv[3];
+	SrTexture::TextureFormat format;
+	if (fmt == "bc1") format = SrTexture::BC1;
+	else if (fmt == "bc4") format = SrTexture::BC4;
+	else if (fmt == "bc5") format = SrTexture::BC5;
+	else if (fmt == "bc7") format = SrTexture::BC7;
+	else {
+		std::cout << "unknown format " << fmt << std::endl;
+		return 1;
+	}
+	bool srgb = argc > 4 && std::string(argv[4]) == "srgb";
+
+	SrTexture texture;
+	texture.textureFromImage(argv[1], srgb);
+	if (texture.getMipmapCount() == 0) {
+		std::cout << "could not load " << argv[1] << std::endl;
+		return 1;
+	}
+	texture.generateMipmaps();
+	size_t uncompressed = texture.getMemoryUsage();
+	texture.compress(format, srgb);
+	if (!texture.saveCompressed(argv[2])) {
+		std::cout << "could not write " << argv[2] << std::endl;
+		return 1;
+	}
+	std::cout << argv[1] << ": " << texture.getTextureWidth() << "x" << texture.getTextureHeight() << ", "
+		<< texture.getMipmapCount() << " mipmaps, " << uncompressed << " -> " << texture.getMemoryUsage() << " bytes" << std::endl;
+	return 0;
+}
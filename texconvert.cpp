@@ -0,0 +1,89 @@
+// Author: Andrea Luzzati
+// Offline tool to convert textures to .srtex containers, loaded at runtime with SrTexture::textureFromContainer by
+// mapping the file in memory (no decoding, gamma conversion nor mipmap generation at startup).
+// Usage: texconvert <input picture> <output.srtex> [rgba|bc1|bc4|bc5|bc7] [srgb]
+//          converts a picture and its mipmap chain (rgba keeps the float texels, the default)
+//          srgb: gamma correct the picture when loading (use it for basecolor textures)
+//        texconvert <input picture> <output.srvt> virtual [srgb]
+//          converts a picture and its mipmap chain to a virtual texture split in 128x128 pages (see
+//          SrTexture::textureFromVirtual)
+//        texconvert <input.srbc> <output.srtex>
+//          converts a compressed texture written by texcompress
+//        texconvert emap <output directory>
+//          converts the demo environment (emap radiance and irradiance cubemaps, brdf.buff) to radiance.srtex,
+//          radiance-octahedral.srtex, irradiance.srtex and brdf.srtex
+#include <iostream>
+#include <string>
+#include "texture.h"
+
+// Saves the container reporting the result, returns false if the file could not be written
+bool save(SrTexture& texture, const std::string& fname) {
+	if (!texture.saveContainer(fname.c_str())) {
+		std::cout << "could not write " << fname << std::endl;
+		return false;
+	}
+	std::cout << fname << ": " << texture.getMipmapCount() << " mipmaps, " << texture.getMemoryUsage() << " bytes" << std::endl;
+	return true;
+}
+int convertEnvironment(const std::string& directory) {
+	SrTexture radiance, irradiance, brdflut, radianceOctahedral;
+	const char* faceMap[6] = { "front","back","right","left","top","bottom" };
+	for (int mip = 0; mip < 8; mip++)
+		for (int face = 0; face < 6; face++) {
+			std::string fname = "emap/radiance-" + std::to_string(mip) + "-" + faceMap[face] + ".buff";
+			if (!radiance.cubemapFromBuffer(fname.c_str(), 512 >> mip, 512 >> mip, face, mip)) return 1;
+			fname = std::string("emap/irradiance-") + faceMap[face] + ".buff";
+			if (mip == 0 && !irradiance.cubemapFromBuffer(fname.c_str(), 32, 32, face, 0)) return 1;
+		}
+	if (!brdflut.textureFromBuffer("brdf.buff", 512, 512, 2)) return 1;
+	radianceOctahedral.octahedralFromCubemap(radiance, 1024);
+	bool success = save(radiance, directory + "/radiance.srtex") && save(irradiance, directory + "/irradiance.srtex") &&
+		save(brdflut, directory + "/brdf.srtex") && save(radianceOctahedral, directory + "/radiance-octahedral.srtex");
+	return success ? 0 : 1;
+}
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		std::cout << "usage: texconvert <input picture> <output.srtex> [rgba|bc1|bc4|bc5|bc7] [srgb]" << std::endl;
+		std::cout << "       texconvert <input picture> <output.srvt> virtual [srgb]" << std::endl;
+		std::cout << "       texconvert <input.srbc> <output.srtex>" << std::endl;
+		std::cout << "       texconvert emap <output directory>" << std::endl;
+		return 1;
+	}
+	std::string input = argv[1];
+	if (input == "emap") return convertEnvironment(argv[2]);
+
+	SrTexture texture;
+	if (input.size() > 5 && input.substr(input.size() - 5) == ".srbc") {
+		if (!texture.textureFromCompressed(argv[1])) return 1;
+		return save(texture, argv[2]) ? 0 : 1;
+	}
+	std::string fmt = argc > 3 ? argv[3] : "rgba";
+	SrTexture::TextureFormat format;
+	if (fmt == "rgba") format = SrTexture::RGBA32F;
+	else if (fmt == "bc1") format = SrTexture::BC1;
+	else if (fmt == "bc4") format = SrTexture::BC4;
+	else if (fmt == "bc5") format = SrTexture::BC5;
+	else if (fmt == "bc7") format = SrTexture::BC7;
+	else if (fmt == "virtual") format = SrTexture::RGBA32F;
+	else {
+		std::cout << "unknown format " << fmt << std::endl;
+		return 1;
+	}
+	bool srgb = argc > 4 && std::string(argv[4]) == "srgb";
+	texture.textureFromImage(argv[1], srgb);
+	if (texture.getMipmapCount() == 0) {
+		std::cout << "could not load " << argv[1] << std::endl;
+		return 1;
+	}
+	texture.generateMipmaps();
+	if (fmt == "virtual") {
+		if (!texture.saveVirtual(argv[2])) {
+			std::cout << "could not write " << argv[2] << std::endl;
+			return 1;
+		}
+		std::cout << argv[2] << ": " << texture.getMipmapCount() << " mipmaps" << std::endl;
+		return 0;
+	}
+	texture.compress(format, srgb);
+	return save(texture, argv[2]) ? 0 : 1;
+}
@@ -2,6 +2,10 @@
 #ifndef SR_TEXTURE_H
 #define SR_TEXTURE_H
 #include <vector>                      // for vector
+#include <atomic>                      // for the block cache generation counter and the LOD feedback
+#include <string>                      // for string
+#include <climits>                     // for INT_MAX
+#include <algorithm>                   // for sort, unique
 #define GLM_FORCE_SWIZZLE              // to allow glm vectors to access components with swizzle
 #include <glm/glm.hpp>                 // for vec4
 #include <iostream>                    // for debugging (cout)
@@ -10,9 +14,80 @@
 #include <glm/gtx/compatibility.hpp>   // for lerp
 #define STB_IMAGE_WRITE_IMPLEMENTATION // to make stb_image_write,h work
 #include "stb_image_write.h"           // for stbi_write_bmp/png
+#include "compression.h"               // for BC1/BC4/BC5/BC7 block codecs
+#include "parallel.h"                  // for srParallelFor
+#include "filemap.h"                   // for SrFileMapping
+#include <sys/stat.h>                  // for stat
+// SIMD sampling kernels (define SR_NO_SIMD to use the plain glm implementation)
+#if !defined(SR_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SR_SSE
+#include <emmintrin.h>                 // for SSE2 intrinsics
+#if defined(__AVX__)
+#define SR_AVX
+#include <immintrin.h>                 // for AVX intrinsics
+#define SR_SIMD_LANES 8
+#else
+#define SR_SIMD_LANES 4
+#endif
+#endif
 
 using namespace glm;
 
+// Opens a file like fopen (fopen_s is only used with MSVC, where fopen is deprecated), returns NULL on failure
+FILE* srOpenFile(const char* fname, const char* mode) {
+#ifdef _MSC_VER
+	FILE* pFile;
+	return fopen_s(&pFile, fname, mode) == 0 ? pFile : NULL;
+#else
+	return fopen(fname, mode);
+#endif
+}
+// 64 bit fseek/ftell (long is 32 bit with MSVC), the seek returns true if success
+bool srSeekFile(FILE* pFile, const long long offset, const int origin) {
+#ifdef _MSC_VER
+	return _fseeki64(pFile, offset, origin) == 0;
+#else
+	return fseeko(pFile, (off_t)offset, origin) == 0;
+#endif
+}
+long long srTellFile(FILE* pFile) {
+#ifdef _MSC_VER
+	return _ftelli64(pFile);
+#else
+	return (long long)ftello(pFile);
+#endif
+}
+// Size in bytes and modification time of the file fname (to detect a changed source of a cache), both -1 if it does not exist
+void srFileStamp(const char* fname, long long stamp[2]) {
+	stamp[0] = stamp[1] = -1;
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(fname, &info) != 0) return;
+#else
+	struct stat info;
+	if (stat(fname, &info) != 0) return;
+#endif
+	stamp[0] = (long long)info.st_size;
+	stamp[1] = (long long)info.st_mtime;
+}
+// Reads the first count floats of the file fname to buffer with a single read, returns false (reporting the
+// reason) if the file cannot be opened or is too short
+bool srReadFloats(const char* fname, std::vector<float>& buffer, const size_t count) {
+	FILE* pFile = srOpenFile(fname, "rb");
+	if (pFile == NULL) {
+		std::cout << "Could not open " << fname << std::endl;
+		return false;
+	}
+	buffer.resize(count);
+	size_t read = count > 0 ? fread(&buffer[0], sizeof(float), count, pFile) : 0;
+	fclose(pFile);
+	if (read != count) {
+		std::cout << "Could not read " << fname << ": " << read * sizeof(float) << " of " << count * sizeof(float) << " bytes" << std::endl;
+		return false;
+	}
+	return true;
+}
+
 // By default, to simplify things, make all texture be four channels 32bit float so textures can be used
 // for basically all applications without the need for care about convoluted texture channel and size specifications
 // (not that it wouldn't be a fine addition to this software)
@@ -26,16 +101,124 @@ public:
 		TOP = 4,
 		BOTTOM = 5
 	};
+	// Storage format of the texture data. RGBA32F is the default four channels float format, the others are
+	// GPU block compression formats (see compression.h) decoded on the fly by the sampler.
+	enum TextureFormat {
+		RGBA32F = 0,
+		BC1 = 1, // RGB (+1 bit alpha), 8 bytes per 4x4 block
+		BC4 = 2, // R, 8 bytes per 4x4 block
+		BC5 = 3, // RG, 16 bytes per 4x4 block (normal maps, blue is reconstructed when sampling)
+		BC7 = 4  // RGBA, 16 bytes per 4x4 block
+	};
+	// Downsampling filter used to generate the mipmap chain
+	enum MipmapFilter {
+		BOX = 0,     // average of the covered texels (2x2, or 3 texels wide for odd sizes)
+		KAISER = 1,  // Kaiser windowed sinc (width 3, alpha 4): sharper, little ringing
+		LANCZOS = 2  // Lanczos3 windowed sinc: sharpest, some ringing
+	};
 private:
 	struct textureData {
-		float* data;
+		float* data = NULL;           // RGBA32F texels, NULL when the level is block compressed
+		unsigned char* blocks = NULL; // compressed 4x4 blocks left to right, top to bottom
 		int width;
 		int height;
 	};
 	std::vector<textureData> mipmaps;
 	std::vector<textureData*> cubemapMipmaps;
+	TextureFormat format;
+	bool gammaEncoded; // compressed texels are stored with gamma 2.2 applied and decoded back to linear
+	// Container file (see textureFromContainer) the levels point into, their memory belongs to the mapping
+	SrFileMapping mapping;
+	bool isMapped(const void* memory);
+	/* Streaming (see textureFromContainerStreamed): the levels finer than residentLevel have no data and are read
+	   on demand from streamFile at levelOffsets. The levels from pinnedLevel on (the mip tail) are never released.
+	   requestedLevel is the finest level asked for by the sampler since the last resetLodFeedback, the samplers of
+	   all the threads lower it concurrently (see requestLevel). */
+	std::string streamFile;
+	std::vector<long long> levelOffsets;
+	int residentLevel;
+	int pinnedLevel;
+	std::atomic<int> requestedLevel;
+	// Lowers requestedLevel to level, a relaxed atomic minimum (no store when the level is already requested)
+	void requestLevel(const int level);
+	// Memory of a width x height level, RGBA32F or in blocks of the texture format
+	size_t levelBytes(const int width, const int height, const bool compressed);
+	/* Validates the header and the level table of a container from its first bytes (tableBytes of them are available)
+	   and returns the levels sizes and data offsets, mipmaps first then the cubemap faces. fileBytes is the size of
+	   the whole file, every level must lie inside it. Sets format and gammaEncoded. */
+	bool readContainerTable(const unsigned char* file, const size_t tableBytes, const size_t fileBytes, int& mipmapCount, std::vector<textureData>& levels, std::vector<long long>& offsets);
+	/* Virtual texture (see textureFromVirtual): every level is split in pageSize x pageSize pages, read on demand
+	   into the slots of a physical page cache. A page is stored with one more column and row (the first texels of
+	   the next pages, clamped to the level edges) so that the bilinear footprint never leaves its slot. */
+	struct virtualData {
+		std::string file;
+		int pageSize;
+		int pinnedLevel;                          // first level fitting in a single page, always resident from there on
+		std::vector<ivec2> pageCounts;            // pages along x and y of every level
+		std::vector<long long> levelOffsets;      // file offset of the first page of every level
+		std::vector<std::vector<int> > pageTable; // slot of every page of every level, -1 when not resident
+		std::vector<float> cache;                 // the slots, (pageSize + 1)^2 RGBA32F texels each
+		std::vector<unsigned int> slotPages;      // page held by every slot (see virtualPageId)
+		std::vector<int> slotFrames;              // frame every slot was last requested in, -1 when free, INT_MAX when pinned
+		std::vector<unsigned int> feedback;       // page requested at every pixel of the feedback buffer
+		int frame;
+		size_t pagesLoaded;
+	};
+	virtualData* virtualPages;
+	// Identifier of the page x,y of a level (5 bits for the level, 13 bits for each page coordinate)
+	static unsigned int virtualPageId(const int mipmapLevel, const int x, const int y) { return (unsigned int)mipmapLevel << 26 | (unsigned int)y << 13 | (unsigned int)x; }
+	// Samples a level of a virtual texture, falling back to the coarser levels where the pages are not resident
+	vec4 sampleVirtual(vec2 uv, const bool repeat, const bool bilinear, int mipmapLevel);
+	// Reads a page from the open virtual texture file to a cache slot, replacing the page it held
+	bool loadVirtualPage(FILE* pFile, const unsigned int page, const int slot);
 	vec4 sampleMipmap(vec2 uv, const bool repeat = false, const bool bilinear = false, const int mipmapLevel = 0, textureData* td = NULL);
+	// Decodes the 4x4 block at (bx,by) of a compressed level into 16 RGBA float texels
+	void decodeBlock(const textureData& td, const int bx, const int by, float* texels);
+	// Returns the decoded texels of the block at (bx,by) going through the decoded block cache (scratch is used
+	// when the cache is disabled)
+	const float* fetchBlock(const textureData& td, const int bx, const int by, float* scratch);
+	/* Per-thread direct-mapped cache of decoded blocks. Each slot is tagged with the address of the compressed
+	   block, which is unique across all textures and levels; the generation counter invalidates every cache
+	   when texture data is released or compressed (addresses may be reused by new allocations). */
+	struct blockCacheData {
+		const unsigned char* tags[256];
+		float texels[256][16 * 4];
+		unsigned int generation;
+		size_t hits;
+		size_t misses;
+	};
+	static blockCacheData& blockCache();
+	static std::atomic<unsigned int>& blockCacheGeneration();
+	static bool& blockCacheEnabled();
 	vec4 sampleCubemapMipmap(vec2 uv, CubemapFaceIndex cfi, const bool bilinear, const int mipmapLevel);
+	static const vec3 cubemapFaceBasis[6][3];
+	static const CubemapFaceIndex cubemapAxisFaces[3][2];
+	// Selects the cubemap face hit by the direction and computes the uv on that face
+	static void cubemapFaceUV(const vec3& dir, CubemapFaceIndex& cfi, vec2& uv);
+	/* Computes the weights to downsample srcSize texels to dstSize with the filter: destination texel d is the sum
+	   of taps source texels starting at first[d] (clamped to the edges) weighted by weights[d * taps + k] */
+	static void mipmapFilterWeights(const int srcSize, const int dstSize, const MipmapFilter filter, std::vector<int>& first, std::vector<float>& weights, int& taps);
+	// Filters a row of srcWidth RGBA texels to dstWidth texels with the weights computed by mipmapFilterWeights
+	static void filterMipmapRow(const float* src, const int srcWidth, float* dst, const int dstWidth, const int* first, const float* weights, const int taps);
+	// Expands the column by column float texels of a raw buffer file (see textureFromBuffer) to RGBA32F data
+	static void expandBuffer(const float* buffer, float* data, const int width, const int height, const int channels);
+	// 256 entries table decoding 8 bit channels with the given curve (0 linear, 1 gamma 2.2, 2 exact sRGB)
+	static const float* decodeTable(const int curve);
+	// Fetches a texel of a cubemap face; coordinates outside the face are wrapped onto the neighbouring face
+	vec4 cubemapTexel(textureData* faces, int face, int x, int y);
+	// Maps an octahedral uv to the uv of a bordered level of an octahedral map (see octahedralFromCubemap)
+	vec2 octahedralLevelUv(vec2 uv, const int mipmapLevel);
+	// Sample with bilinear/trilinear filtering at the current trilinear coefficient (sample without anisotropy)
+	vec4 sampleIsotropic(vec2 uv, const bool repeat, const bool bilinear, const bool trilinear);
+	int maxAnisotropy;     // maximum number of anisotropic taps (1 disables anisotropic filtering)
+	int anisotropicTaps;   // number of taps of the current footprint
+	vec2 anisotropicAxis;  // major axis of the current footprint in uv space
+#ifdef SR_SSE
+	// Samples a RGBA32F level returning the color in a SSE register
+	__m128 sampleLevelSse(vec2 uv, const bool repeat, const bool bilinear, const textureData& td);
+	// Samples count uvs of a RGBA32F texture at the level of detail lod >= 0, the kernel of sampleMany
+	void sampleManySse(const vec2* uvs, vec4* results, const int count, const bool repeat, const bool bilinear, const bool trilinear, const float lod);
+#endif
 public:
 	float trilinearCoefficient;
 	// TODO: This function was used in a previous version of the software and I should get rid of it - the toImage method
@@ -48,13 +231,33 @@ public:
 	// Loads the texture data from a picture. Specify wether to apply basic gamma correction (this is usually done
 	// to the basecolor textures as artists usually work in adobe srgb color space, and not to specialized textures
 	// such as displacement maps, normal maps, metallic/roughness/occlusion maps etc...).
-	void textureFromImage(const char* fname, const bool gammaCorrect = true);
+	// The gamma correction uses the 2.2 power curve, or the exact piecewise sRGB curve with exactSrgb; alpha is
+	// always linear. The rows are decoded in parallel with a lookup table. Returns false if the picture cannot be loaded.
+	bool textureFromImage(const char* fname, const bool gammaCorrect = true, const bool exactSrgb = false);
 	// Loads the texture data from a raw buffer file. It is assumed to be just an array of the raw float color 
-	// channel values left to right, top to bottom (rgbargbargba...)
-	void textureFromBuffer(const char* fname, const int width, const int height, const int channels = 4);
-	// Loads the texture data from a cubemap. The specified file is assumed to be an undistorted cubemap face. Use the 
-	// arguments to specify the face index and mip level.
-	void cubemapFromBuffer(const char* fname, const int width, const int height, const int face, const int mipmapLevel = 0);
+	// channel values top to bottom, left to right (column by column, rgbargbargba...). The whole file is read at once,
+	// returns false (reporting the reason) if it is missing or too short.
+	bool textureFromBuffer(const char* fname, const int width, const int height, const int channels = 4);
+	/* Asynchronous versions of the loaders above, running on the asset loading pool (see srAsync). The texture must
+	   not be used until the returned future is ready. */
+	std::future<bool> textureFromImageAsync(const char* fname, const bool gammaCorrect = true, const bool exactSrgb = false);
+	std::future<bool> textureFromBufferAsync(const char* fname, const int width, const int height, const int channels = 4);
+	// Loads the texture data from a cubemap. The specified file is assumed to be an undistorted cubemap face (rgb float
+	// texels laid out as in textureFromBuffer). Use the arguments to specify the face index and mip level.
+	// Returns false (reporting the reason) if the file is missing or too short.
+	bool cubemapFromBuffer(const char* fname, const int width, const int height, const int face, const int mipmapLevel = 0);
+	// Loads a cubemap mipmap level made of six size x size faces filled by a uniform color.
+	void cubemapFromColor(const int size, const vec4 color, const int mipmapLevel = 0);
+	// Generates the cubemap mipmap chain all the way to 1x1 faces from the first level (averaging 2x2 texels)
+	void generateCubemapMipmaps();
+	// Returns the faces size of a cubemap mipmap level.
+	int getCubemapSize(const int mipmapLevel = 0);
+	// Get the texel value at x,y of a cubemap face. For rendering purposes, use instead sampleCubemap.
+	vec4 cubemapRead(const int face, const size_t x, const size_t y, const int mipmapLevel = 0);
+	// Set the texel value at x,y of a cubemap face.
+	void cubemapWrite(const int face, const size_t x, const size_t y, vec4 value, const int mipmapLevel = 0);
+	// Returns the (unit) direction through the center of the texel x,y of a size x size cubemap face
+	static vec3 cubemapTexelDirection(const int face, const int x, const int y, const int size);
 	// Returns the texture width when it is used as a texture (as opposed to cubemap).
 	int getTextureWidth();
 	// Returns the texture height when it is used as a texture (as opposed to cubemap).
@@ -74,14 +277,40 @@ public:
 		This function is to be used insetad of read to sample for rendering purposes.
 	*/
 	vec4 sample(vec2 uv, const bool repeat = false, const bool bilinear = true, const bool trilinear = true);
+	/* Sample many uvs at once (for example the fragments of a quad) with the same arguments as sample, results[i]
+	   receives the color sampled at uvs[i]. The texel coordinates are computed 4 (SSE) or 8 (AVX) uvs at a time. */
+	void sampleMany(const vec2* uvs, vec4* results, const int count, const bool repeat = false, const bool bilinear = true, const bool trilinear = true);
+	// Sample a cubemap in the direction eyeView. Bilinear filtering is seamless across the faces edges.
 	vec4 sampleCubemap(vec3 eyeView, const bool bilinear = true, const bool trilinear = true, float trilinearCoefficient = 0.0f);
+	// Sample a cubemap in count directions at once (faces and uvs are computed 4 directions at a time with SSE)
+	void sampleCubemapMany(const vec3* eyeViews, vec4* results, const int count, const bool bilinear = true, const bool trilinear = true, float trilinearCoefficient = 0.0f);
+	/* Converts a cubemap to an octahedral environment map: a regular 2D texture where the sphere of directions is
+	   folded onto a square, so a lookup is a single sampleMipmap with no face selection. Every mipmap level of the
+	   cubemap is converted to a level of size/2^level, keeping the prefiltered mipmap chain of radiance maps.
+	   Each level has a one texel border mirroring the texels across the folded edges of the square (texel (x,-1)
+	   is (size-1-x,0) and so on), so the bilinear lookups only blend texels that are neighbours on the sphere. */
+	void octahedralFromCubemap(SrTexture& cubemap, const int size);
+	// Sample an octahedral environment map (see octahedralFromCubemap) in the direction eyeView
+	vec4 sampleOctahedral(vec3 eyeView, const bool bilinear = true, const bool trilinear = true, float trilinearCoefficient = 0.0f);
+	// Sample an octahedral environment map in count directions at once
+	void sampleOctahedralMany(const vec3* eyeViews, vec4* results, const int count, const bool bilinear = true, const bool trilinear = true, float trilinearCoefficient = 0.0f);
+	/* Projects a cubemap mipmap level onto the 9 real spherical harmonics of bands 0-2 (see shEvaluate), weighting
+	   every texel by the solid angle it covers. The rows of the faces are projected in parallel. Low frequency
+	   environments such as irradiance maps are reproduced by the 9 coefficients with a small error. */
+	void cubemapToSH(vec3 coefficients[9], const int mipmapLevel = 0);
+	// Octahedral mapping of a direction to uv coordinates and back
+	static vec2 octahedralEncode(vec3 dir);
+	static vec3 octahedralDecode(vec2 uv);
 	// Clear the texture with a given color (no cubemap)
 	void clear(vec4 color);
 	// Draw a line on the texture (no cubemap) for debugging purposes
 	void textureDrawLine(ivec2 a, ivec2 b, vec4 color=vec4(1,1,1,1));
-	// Generates the mipmap chain all the way to the 1x1 pixel size (if possible)
-	void generateMipmaps();
-	// Get generated mipmap chain size
+	/* Generates the mipmap chain all the way to the 1x1 pixel size with the given filter. Every level is half the
+	   size of the previous one rounded down, odd sizes being filtered over the whole previous level. The rows of
+	   every level are filtered in parallel. The texels are linear (textureFromImage removes the gamma), so the
+	   downsampling is gamma correct for sRGB pictures too. */
+	void generateMipmaps(const MipmapFilter filter = BOX);
+	// Get generated mipmap chain size (of the cubemap faces for cubemaps)
 	int getMipmapCount();
 	/* Computes the trilinear coefficient to use given the UV area covered by the pixel being drawn. 
 	   For example, a coefficient of 3.7 will trilinearly interpolate between mipmap levels 3 and 4 with
@@ -90,10 +319,174 @@ public:
 	   accepted in that it means that the first mipmap is not enough high resolution) and avoid aliasing of
 	   the high frequency components. */
 	void calculateTrilinearCoefficient(float pixelUVAreaCoverage);
-
+	/* Enables anisotropic filtering taking up to maxTaps (2, 4, 8 or 16; 1 disables it) trilinear samples along
+	   the major axis of the pixel footprint. More taps keep surfaces seen at grazing angles sharp at a higher cost. */
+	void setMaxAnisotropy(const int maxTaps);
+	// Get the maximum anisotropic tap count (1 when anisotropic filtering is disabled)
+	int getMaxAnisotropy();
+	/* Computes the anisotropic footprint of the pixel being drawn from the uv derivatives along the screen x and y
+	   axes (the columns of the uv Jacobian). The number of taps is the ratio between the footprint major and minor
+	   axes (bounded by the max anisotropy) and the mipmap level is selected by the major axis length divided by the
+	   tap count, overriding the trilinear coefficient. Only used when anisotropic filtering is enabled. */
+	void calculateAnisotropicFootprint(vec2 dUVdx, vec2 dUVdy);
+	/* Compresses the whole mipmap chain (generate the mipmaps first) to the given block compression format,
+	   releasing the float data. Use gammaEncode for color textures loaded with gamma correction so the limited
+	   precision of the formats is spent perceptually (as the sRGB variants of the GPU formats do).
+	   The texture becomes read-only: read/write/clear are meant for RGBA32F textures only. */
+	void compress(const TextureFormat format, const bool gammaEncode = false);
+	// Get the storage format of the texture
+	TextureFormat getFormat();
+	// Get the memory used by the mipmap chain and the cubemap faces, in bytes
+	size_t getMemoryUsage();
+	// Saves the compressed mipmap chain to a file (see textureFromCompressed) and returns true if success
+	bool saveCompressed(const char* fname);
+	// Loads a compressed mipmap chain saved with saveCompressed and returns true if success
+	bool textureFromCompressed(const char* fname);
+	/* Saves the mipmap chain and the cubemap levels in their in-memory format and layout (RGBA32F or compressed
+	   blocks) to a .srtex container file (see textureFromContainer) and returns true if success */
+	bool saveContainer(const char* fname);
+	/* Loads a .srtex container file saved with saveContainer by mapping it in memory: the levels point straight into
+	   the mapping with no decoding nor copy, and the pages are read by the OS on first access. Writes to the texture
+	   stay private to the process. Returns false if the file is missing or invalid (reporting the reason). */
+	bool textureFromContainer(const char* fname);
+	// Asynchronous version of textureFromContainer (see textureFromImageAsync)
+	std::future<bool> textureFromContainerAsync(const char* fname);
+	/* Opens a .srtex container of a 2D texture for streaming: only the level table and the mip tail (the levels of
+	   up to 64x64 texels, never released) are read, the finer levels are read on demand with streamLevels and
+	   released with evictLevels (usually by a SrResidencyManager, see residency.h). Sampling a level that is not
+	   resident falls back to the finest resident one. Returns false if the file is missing or invalid. */
+	bool textureFromContainerStreamed(const char* fname);
+	// Reads from the container the levels from mipmapLevel to the finest resident one, returns false if they cannot be read
+	bool streamLevels(const int mipmapLevel);
+	// Releases the levels finer than mipmapLevel (the mip tail stays resident), returns the bytes released
+	size_t evictLevels(const int mipmapLevel);
+	// Returns true if the texture is streamed from a container
+	bool isStreamed();
+	// Get the finest resident mipmap level (0 when the whole chain is in memory)
+	int getResidentLevel();
+	// Get the finest mipmap level that can be released (the first level of the mip tail)
+	int getPinnedLevel();
+	/* Get the finest mipmap level sampled since the last resetLodFeedback, before falling back to the resident
+	   levels (getMipmapCount() when the texture was not sampled). This LOD feedback tells which levels to stream. */
+	int getRequestedLevel();
+	void resetLodFeedback();
+	// Get the memory used by a mipmap level once resident, in bytes
+	size_t getLevelMemory(const int mipmapLevel);
+	/* Saves the mipmap chain (RGBA32F, generate the mipmaps first) to a .srvt virtual texture file split in pages of
+	   pageSize x pageSize texels (see textureFromVirtual) and returns true if success */
+	bool saveVirtual(const char* fname, const int pageSize = 128);
+	/* Opens a .srvt virtual texture file written by saveVirtual: the pages of the levels are read on demand into a
+	   cache of cachePages slots, so only the pages in view use memory. The rasterizer records the pages requested by
+	   the fragments in a low resolution feedback buffer (see SrGPU::setFeedbackScale) and updateVirtualPages reads the
+	   missing ones between frames; sampling a page that is not resident falls back to the coarser levels (the levels
+	   fitting in a single page are always resident). The texture is read-only and its texels are only reached through
+	   the sampler: clear, generateMipmaps, compress, saveContainer and toImage reject it (the levels hold no data).
+	   Returns false if the file is missing or invalid. */
+	bool textureFromVirtual(const char* fname, const int cachePages = 256);
+	// Returns true if the texture is a virtual texture
+	bool isVirtual();
+	// Clears the feedback buffer, sizing it for count pixels
+	void clearVirtualFeedback(const int count);
+	// Records at the pixel index of the feedback buffer the page sampled at uv with the current trilinear coefficient
+	void writeVirtualFeedback(const int index, vec2 uv);
+	/* Reads the pages requested in the feedback buffer (and their coarser levels) that are not resident, the
+	   coarsest first and at most maxPages of them when not 0. The least recently requested pages are replaced.
+	   Returns the number of pages read. */
+	int updateVirtualPages(const int maxPages = 0);
+	// Get the number of resident pages and the number of pages read since the virtual texture was opened
+	void getVirtualStats(int& residentPages, size_t& pagesLoaded);
+	// Enable or disable (default enabled) the per-thread cache of decoded blocks used when sampling compressed textures
+	static void setBlockCacheEnabled(const bool enabled);
+	// Get the decoded block cache hit and miss counters of the calling thread
+	static void getBlockCacheStats(size_t& hits, size_t& misses);
+	// Reset the decoded block cache hit and miss counters of the calling thread
+	static void resetBlockCacheStats();
 };
 
 
+#ifdef SR_SSE
+// Fetches and blends the 2x2 texels footprint at p (texel space coordinates, p >= 0) of a RGBA32F level
+static inline __m128 srBilinearTexels(const float* data, const int width, const int height, const float px, const float py) {
+	int x0 = (int)px, y0 = (int)py; // truncation is floor since p >= 0
+	__m128 fx = _mm_set1_ps(px - (float)x0), fy = _mm_set1_ps(py - (float)y0);
+	x0 = x0 < width - 1 ? x0 : width - 1;
+	y0 = y0 < height - 1 ? y0 : height - 1;
+	int dx = x0 < width - 1 ? 4 : 0, dy = y0 < height - 1 ? width * 4 : 0;
+	const float* t11 = &data[(x0 + y0 * width) * 4];
+	__m128 d11 = _mm_loadu_ps(t11), d21 = _mm_loadu_ps(t11 + dx);
+	__m128 d12 = _mm_loadu_ps(t11 + dy), d22 = _mm_loadu_ps(t11 + dy + dx);
+	__m128 top = _mm_add_ps(d11, _mm_mul_ps(_mm_sub_ps(d21, d11), fx));
+	__m128 bottom = _mm_add_ps(d12, _mm_mul_ps(_mm_sub_ps(d22, d12), fx));
+	return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy));
+}
+// Fetches the texel nearest to p (texel space coordinates, p >= 0) of a RGBA32F level
+static inline __m128 srNearestTexel(const float* data, const int width, const int height, const float px, const float py) {
+	int x = (int)(px + 0.5f), y = (int)(py + 0.5f);
+	x = x < width - 1 ? x : width - 1;
+	y = y < height - 1 ? y : height - 1;
+	return _mm_loadu_ps(&data[(x + y * width) * 4]);
+}
+/* Converts SR_SIMD_LANES uvs to texel space coordinates of a width x height level (wrapping them when repeat
+   is set, and clamping them to the texture edges) writing the x and y coordinates to px and py */
+static inline void srTexelCoordinates(const vec2* uvs, const bool repeat, const float width, const float height, float* px, float* py) {
+#ifdef SR_AVX
+	__m256 a = _mm256_loadu_ps(&uvs[0].x), b = _mm256_loadu_ps(&uvs[4].x);
+	__m256 lo = _mm256_permute2f128_ps(a, b, 0x20), hi = _mm256_permute2f128_ps(a, b, 0x31);
+	__m256 u = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)), v = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+	if (repeat) {
+		u = _mm256_sub_ps(u, _mm256_floor_ps(u));
+		v = _mm256_sub_ps(v, _mm256_floor_ps(v));
+	}
+	u = _mm256_min_ps(_mm256_max_ps(u, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	_mm256_storeu_ps(px, _mm256_mul_ps(u, _mm256_set1_ps(width)));
+	_mm256_storeu_ps(py, _mm256_mul_ps(v, _mm256_set1_ps(height)));
+#else
+	__m128 a = _mm_loadu_ps(&uvs[0].x), b = _mm_loadu_ps(&uvs[2].x);
+	__m128 u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), v = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+	if (repeat) { // uv - floor(uv) (SSE2 has no floor: truncate and fix negative values)
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 tu = _mm_cvtepi32_ps(_mm_cvttps_epi32(u)), tv = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+		u = _mm_sub_ps(u, _mm_sub_ps(tu, _mm_and_ps(_mm_cmpgt_ps(tu, u), one)));
+		v = _mm_sub_ps(v, _mm_sub_ps(tv, _mm_and_ps(_mm_cmpgt_ps(tv, v), one)));
+	}
+	u = _mm_min_ps(_mm_max_ps(u, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	_mm_storeu_ps(px, _mm_mul_ps(u, _mm_set1_ps(width)));
+	_mm_storeu_ps(py, _mm_mul_ps(v, _mm_set1_ps(height)));
+#endif
+}
+#endif
+
+// Evaluates the 9 real spherical harmonics of bands 0-2 in the (unit) direction dir
+void shBasis(vec3 dir, float basis[9]) {
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * dir.y;
+	basis[2] = 0.488603f * dir.z;
+	basis[3] = 0.488603f * dir.x;
+	basis[4] = 1.092548f * dir.x * dir.y;
+	basis[5] = 1.092548f * dir.y * dir.z;
+	basis[6] = 0.315392f * (3.0f * dir.z * dir.z - 1.0f);
+	basis[7] = 1.092548f * dir.x * dir.z;
+	basis[8] = 0.546274f * (dir.x * dir.x - dir.y * dir.y);
+}
+// Evaluates in the (unit) direction dir the function with the given spherical harmonics coefficients (see cubemapToSH)
+vec3 shEvaluate(const vec3 coefficients[9], vec3 dir) {
+	float basis[9];
+	shBasis(dir, basis);
+	vec3 result = coefficients[0] * basis[0];
+	for (int i = 1; i < 9; i++)
+		result += coefficients[i] * basis[i];
+	return result;
+}
+/* Convolves the spherical harmonics of a radiance environment with the clamped cosine lobe divided by pi, so that
+   shEvaluate returns the same value an irradiance cubemap baked from that environment would store (each band is
+   scaled by 1, 2/3 and 1/4). Not needed when the projected cubemap is already an irradiance map. */
+void shConvolveIrradiance(vec3 coefficients[9]) {
+	for (int i = 1; i < 4; i++) coefficients[i] *= 2.0f / 3.0f;
+	for (int i = 4; i < 9; i++) coefficients[i] *= 0.25f;
+}
+
 // TEXTURE IMPLENTATION
 void SrTexture::textureFromColor(const int width, const int height, const vec4 color)
 {
@@ -105,95 +498,185 @@ void SrTexture::textureFromColor(const int width, const int height, const vec4 c
 	mipmaps.push_back(td);
 	clear(color);
 }
-void SrTexture::textureFromImage(const char* fname, const bool correctGamma) {
+const float* SrTexture::decodeTable(const int curve) {
+	// 0: linear, 1: gamma 2.2, 2: sRGB, filled once by the thread safe initialization of the static
+	static const struct decodeTables {
+		float curves[3][256];
+		decodeTables() {
+			for (int i = 0; i < 256; i++) {
+				float v = (float)i / 255.0f;
+				curves[0][i] = v;
+				curves[1][i] = pow(v, 2.2f);
+				curves[2][i] = v <= 0.04045f ? v / 12.92f : pow((v + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	} tables;
+	return tables.curves[curve];
+}
+bool SrTexture::textureFromImage(const char* fname, const bool correctGamma, const bool exactSrgb) {
 	disposeData();
 	int width, height, n;
 	unsigned char* rawData = stbi_load(fname, &width, &height, &n, 0);
-	if (rawData == NULL) return;
+	if (rawData == NULL) {
+		std::cout << "Could not load " << fname << ": " << stbi_failure_reason() << std::endl;
+		return false;
+	}
 	float* data = new float[width * height * 4];
-	for (unsigned int x = 0; x < width; x++)
-		for (unsigned int y = 0; y < height; y++) {
-			if (correctGamma)
-				for (unsigned int i = 0; i < (n < 4 ? n : 4); i++)
-					data[y * width * 4 + x * 4 + i] = pow((float)rawData[x * n + i + y * width * n] / 255.0f, 2.2f);
-			else
-				for (unsigned int i = 0; i < (n < 4 ? n : 4); i++)
-					data[y * width * 4 + x * 4 + i] = (float)rawData[x * n + i + y * width * n] / 255.0f;
-			for (unsigned int i = n; i < 4; i++)
-				data[y * width * 4 + x * 4 + i] = 0.0f;
+	// Color channels go through the gamma curve, alpha (the last channel of grey+alpha and rgba pictures) stays linear
+	const float* color = decodeTable(correctGamma ? (exactSrgb ? 2 : 1) : 0);
+	const float* linear = decodeTable(0);
+	const float* tables[4] = { color, n == 2 ? linear : color, color, linear };
+	int channels = n < 4 ? n : 4;
+	srParallelFor(height, [&](int begin, int end, int worker) {
+		for (int y = begin; y < end; y++) {
+			const unsigned char* src = &rawData[(size_t)y * width * n];
+			float* dst = &data[(size_t)y * width * 4];
+			for (int x = 0; x < width; x++, src += n, dst += 4) {
+				int i = 0;
+				for (; i < channels; i++) dst[i] = tables[i][src[i]];
+				for (; i < 4; i++) dst[i] = 0.0f;
+			}
 		}
+	});
 	textureData td;
 	td.width = width;
 	td.height = height;
 	td.data = data;
 	mipmaps.push_back(td);
 	stbi_image_free(rawData);
+	return true;
 }
-void SrTexture::textureFromBuffer(const char* fname, const int width, const int height, const int channels) {
+bool SrTexture::textureFromBuffer(const char* fname, const int width, const int height, const int channels) {
 	disposeData();
-	
+	std::vector<float> buffer;
+	if (!srReadFloats(fname, buffer, (size_t)width * height * channels)) return false;
 	textureData td;
 	td.width = width;
 	td.height = height;
 	td.data = new float[width * height * 4];
+	expandBuffer(&buffer[0], td.data, width, height, channels);
 	mipmaps.push_back(td);
-
-	FILE* pFile;
-	fopen_s(&pFile, fname, "rb");
-	for(int x = 0; x < width; x++)
-		for (int y = 0; y < height; y++) {
-			fread(&td.data[x * 4 + y * width * 4], 4, channels, pFile);
-			if (channels < 4)
-				for (int j = channels; j < 4; j++)
-					td.data[x * 4 + j + y * width * 4] = 0.0f;
-		}
-	fclose(pFile);
+	return true;
 }
-void SrTexture::cubemapFromBuffer(const char* fname, const int width, const int height, const int face, const int mipmapLevel)
+std::future<bool> SrTexture::textureFromImageAsync(const char* fname, const bool gammaCorrect, const bool exactSrgb) {
+	std::string name = fname; // the caller's string may not outlive the task
+	return srAsync([this, name, gammaCorrect, exactSrgb] { return textureFromImage(name.c_str(), gammaCorrect, exactSrgb); });
+}
+std::future<bool> SrTexture::textureFromBufferAsync(const char* fname, const int width, const int height, const int channels) {
+	std::string name = fname;
+	return srAsync([this, name, width, height, channels] { return textureFromBuffer(name.c_str(), width, height, channels); });
+}
+bool SrTexture::cubemapFromBuffer(const char* fname, const int width, const int height, const int face, const int mipmapLevel)
 {
-	while (mipmapLevel >= cubemapMipmaps.size()) 
+	std::vector<float> buffer;
+	if (!srReadFloats(fname, buffer, (size_t)width * height * 3)) return false;
+	while ((size_t)mipmapLevel >= cubemapMipmaps.size()) 
 		cubemapMipmaps.push_back( new textureData[6] );
 	textureData* cubemap = cubemapMipmaps[mipmapLevel];
+	if (!isMapped(cubemap[face].data)) delete[] cubemap[face].data;
 	cubemap[face].width = width;
 	cubemap[face].height = height;
 	cubemap[face].data = new float[width * height * 4];
-
-	FILE* pFile;
-	fopen_s(&pFile, fname, "rb");
-	int channels = 3;
-	for (int x = 0; x < width; x++)
-		for (int y = 0; y < height; y++) {
-			fread(&cubemap[face].data[x * 4 + y * width * 4], 4, channels, pFile);
-			if (channels < 4)
-				for (int j = channels; j < 4; j++)
-					cubemap[face].data[x * 4 + j + y * width * 4] = 0.0f;
+	expandBuffer(&buffer[0], cubemap[face].data, width, height, 3);
+	return true;
+}
+void SrTexture::expandBuffer(const float* buffer, float* data, const int width, const int height, const int channels) {
+	// The buffer stores the texels column by column: walk the destination row by row (sequential writes) and
+	// gather every row from the columns
+	for (int y = 0; y < height; y++) {
+		float* dst = &data[y * width * 4];
+		const float* src = &buffer[y * channels];
+		for (int x = 0; x < width; x++, dst += 4, src += height * channels) {
+			int c = 0;
+			for (; c < channels; c++) dst[c] = src[c];
+			for (; c < 4; c++) dst[c] = 0.0f;
 		}
-	fclose(pFile);
+	}
+}
+void SrTexture::cubemapFromColor(const int size, const vec4 color, const int mipmapLevel) {
+	while ((size_t)mipmapLevel >= cubemapMipmaps.size())
+		cubemapMipmaps.push_back(new textureData[6]);
+	textureData* cubemap = cubemapMipmaps[mipmapLevel];
+	for (int face = 0; face < 6; face++) {
+		if (!isMapped(cubemap[face].data)) delete[] cubemap[face].data;
+		cubemap[face].width = size;
+		cubemap[face].height = size;
+		cubemap[face].data = new float[size * size * 4];
+		for (int i = 0; i < size * size; i++)
+			memcpy(&cubemap[face].data[i * 4], &color[0], 4 * sizeof(float));
+	}
+}
+void SrTexture::generateCubemapMipmaps() {
+	if (cubemapMipmaps.size() != 1) return;
+	for (int size = cubemapMipmaps[0][0].width >> 1, level = 1; size >= 1; size >>= 1, level++) {
+		cubemapFromColor(size, vec4(0.0f), level);
+		for (int face = 0; face < 6; face++) {
+			const float* src = cubemapMipmaps[level - 1][face].data;
+			float* dst = cubemapMipmaps[level][face].data;
+			int srcSize = size * 2;
+			for (int y = 0; y < size; y++)
+				for (int x = 0; x < size; x++)
+					for (int k = 0; k < 4; k++)
+						dst[(x + y * size) * 4 + k] = (
+							src[(x * 2 + y * 2 * srcSize) * 4 + k] + src[(x * 2 + 1 + y * 2 * srcSize) * 4 + k] +
+							src[(x * 2 + (y * 2 + 1) * srcSize) * 4 + k] + src[(x * 2 + 1 + (y * 2 + 1) * srcSize) * 4 + k]) * 0.25f;
+		}
+	}
+}
+int SrTexture::getCubemapSize(const int mipmapLevel) {
+	return cubemapMipmaps[mipmapLevel][0].width;
+}
+vec4 SrTexture::cubemapRead(const int face, const size_t x, const size_t y, const int mipmapLevel) {
+	const textureData& td = cubemapMipmaps[mipmapLevel][face];
+	const float* texel = &td.data[(x + y * td.width) * 4];
+	return vec4(texel[0], texel[1], texel[2], texel[3]);
+}
+void SrTexture::cubemapWrite(const int face, const size_t x, const size_t y, vec4 value, const int mipmapLevel) {
+	const textureData& td = cubemapMipmaps[mipmapLevel][face];
+	memcpy(&td.data[(x + y * td.width) * 4], &value[0], 4 * sizeof(float));
 }
 SrTexture::SrTexture() {
 	trilinearCoefficient = 0.0f;
+	format = RGBA32F;
+	gammaEncoded = false;
+	maxAnisotropy = 1;
+	anisotropicTaps = 1;
+	anisotropicAxis = vec2(0.0f);
+	residentLevel = 0;
+	pinnedLevel = 0;
+	requestedLevel = INT_MAX;
+	virtualPages = NULL;
 }
 SrTexture::~SrTexture() {
 	disposeData();
 }
 void SrTexture::disposeData() {
 	if (mipmaps.size() > 0) {
-		for (std::vector<textureData>::iterator it = mipmaps.begin(); it != mipmaps.end(); it++)
-			delete (*it).data;
+		for (std::vector<textureData>::iterator it = mipmaps.begin(); it != mipmaps.end(); it++) {
+			if (!isMapped((*it).data)) delete[] (*it).data;
+			if (!isMapped((*it).blocks)) delete[] (*it).blocks;
+		}
 		mipmaps.clear();
 	}
+	format = RGBA32F;
+	gammaEncoded = false;
+	blockCacheGeneration()++;
 	if (cubemapMipmaps.size() > 0) {
 		for (std::vector<textureData*>::iterator it = cubemapMipmaps.begin(); it != cubemapMipmaps.end(); it++) {
-			delete (*it)[0].data;
-			delete (*it)[1].data;
-			delete (*it)[2].data;
-			delete (*it)[3].data;
-			delete (*it)[4].data;
-			delete (*it)[5].data;
-			delete (*it);
+			for (int face = 0; face < 6; face++)
+				if (!isMapped((*it)[face].data)) delete[] (*it)[face].data;
+			delete[] (*it);
 		}
 		cubemapMipmaps.clear();
 	}
+	mapping.close();
+	streamFile.clear();
+	levelOffsets.clear();
+	residentLevel = 0;
+	pinnedLevel = 0;
+	requestedLevel = INT_MAX;
+	delete virtualPages;
+	virtualPages = NULL;
 }
 int SrTexture::getTextureWidth() {
 	return mipmaps[0].width;
@@ -201,11 +684,66 @@ int SrTexture::getTextureWidth() {
 int SrTexture::getTextureHeight() {
 	return mipmaps[0].height;
 }
+/* Cubemap face basis: for every face the axis it faces (N) and the directions of increasing u (U) and v (V), so that
+   the direction through the face point uv is N + U * (2u - 1) + V * (2v - 1). This is the orientation of the
+   faces of the environment maps used by the demo. */
+const vec3 SrTexture::cubemapFaceBasis[6][3] = {
+	{ vec3(0, -1, 0), vec3(0, 0, 1), vec3(-1, 0, 0) }, // FRONT (-y)
+	{ vec3(0, 1, 0), vec3(0, 0, 1), vec3(1, 0, 0) },   // BACK (+y)
+	{ vec3(-1, 0, 0), vec3(0, 0, 1), vec3(0, 1, 0) },  // RIGHT (-x)
+	{ vec3(1, 0, 0), vec3(0, 0, 1), vec3(0, -1, 0) },  // LEFT (+x)
+	{ vec3(0, 0, -1), vec3(1, 0, 0), vec3(0, -1, 0) }, // TOP (-z)
+	{ vec3(0, 0, 1), vec3(-1, 0, 0), vec3(0, -1, 0) }  // BOTTOM (+z)
+};
+// Face selected by the major axis (x, y, z) of a direction and its sign (negative, positive)
+const SrTexture::CubemapFaceIndex SrTexture::cubemapAxisFaces[3][2] = { { RIGHT, LEFT }, { FRONT, BACK }, { TOP, BOTTOM } };
+void SrTexture::cubemapFaceUV(const vec3& dir, CubemapFaceIndex& cfi, vec2& uv) {
+	vec3 a = abs(dir);
+	int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+	cfi = cubemapAxisFaces[axis][dir[axis] > 0.0f ? 1 : 0];
+	float k = 0.5f / a[axis];
+	uv = vec2(dot(dir, cubemapFaceBasis[cfi][1]) * k + 0.5f, dot(dir, cubemapFaceBasis[cfi][2]) * k + 0.5f);
+}
+vec3 SrTexture::cubemapTexelDirection(const int face, const int x, const int y, const int size) {
+	return normalize(cubemapFaceBasis[face][0] +
+		cubemapFaceBasis[face][1] * (((float)x + 0.5f) / (float)size * 2.0f - 1.0f) +
+		cubemapFaceBasis[face][2] * (((float)y + 0.5f) / (float)size * 2.0f - 1.0f));
+}
+vec4 SrTexture::cubemapTexel(textureData* faces, int face, int x, int y) {
+	int size = faces[face].width;
+	if (x < 0 || y < 0 || x >= size || y >= size) {
+		// The texel lies on a neighbouring face: follow the direction through its center
+		vec3 dir = cubemapFaceBasis[face][0] +
+			cubemapFaceBasis[face][1] * (((float)x + 0.5f) / (float)size * 2.0f - 1.0f) +
+			cubemapFaceBasis[face][2] * (((float)y + 0.5f) / (float)size * 2.0f - 1.0f);
+		CubemapFaceIndex cfi;
+		vec2 uv;
+		cubemapFaceUV(dir, cfi, uv);
+		face = cfi;
+		size = faces[face].width;
+		x = clamp((int)(uv.x * (float)size), 0, size - 1);
+		y = clamp((int)(uv.y * (float)size), 0, size - 1);
+	}
+	const float* texel = &faces[face].data[(x + y * size) * 4];
+	return vec4(texel[0], texel[1], texel[2], texel[3]);
+}
 vec4 SrTexture::sampleCubemapMipmap(vec2 uv, SrTexture::CubemapFaceIndex cfi, const bool bilinear, const int mipmapLevel) {
-	textureData td = cubemapMipmaps[mipmapLevel][cfi];
-	return sampleMipmap(uv, false, bilinear, 0, &td);
+	textureData* faces = cubemapMipmaps[mipmapLevel];
+	float size = (float)faces[cfi].width;
+	if (!bilinear) return cubemapTexel(faces, cfi, (int)(uv.x * size), (int)(uv.y * size));
+	// Bilinear filtering with texel centers at (i + 0.5) / size: taps past the face edges are fetched
+	// from the neighbouring faces so that there are no seams
+	vec2 p = uv * size - vec2(0.5f);
+	vec2 f = fract(p);
+	int x = (int)floor(p.x), y = (int)floor(p.y);
+	return lerp(
+		lerp(cubemapTexel(faces, cfi, x, y), cubemapTexel(faces, cfi, x + 1, y), f.x),
+		lerp(cubemapTexel(faces, cfi, x, y + 1), cubemapTexel(faces, cfi, x + 1, y + 1), f.x),
+		f.y
+	);
 }
 vec4 SrTexture::sampleMipmap(vec2 uv, const bool repeat, const bool bilinear, const int mipmapLevel, textureData* tdd) {
+	if (virtualPages != NULL && tdd == NULL) return sampleVirtual(uv, repeat, bilinear, mipmapLevel);
 	textureData td;
 	if (tdd != NULL) td = *tdd;
 	else td = mipmaps[mipmapLevel];
@@ -219,6 +757,40 @@ vec4 SrTexture::sampleMipmap(vec2 uv, const bool repeat, const bool bilinear, co
 	if (pos.x >= width) pos.x = width - 1;
 	if (pos.y >= height) pos.y = height - 1;
 
+	// Block compressed levels: decode the 4x4 blocks touched by the sample
+	if (td.data == NULL) {
+		float scratch[16 * 4];
+		const float* texels = NULL; // the first tap always fetches its block
+		if (!bilinear) {
+			texels = fetchBlock(td, pos.x >> 2, pos.y >> 2, scratch);
+			const float* texel = &texels[((pos.x & 3) + (pos.y & 3) * 4) * 4];
+			return vec4(texel[0], texel[1], texel[2], texel[3]);
+		}
+		vec2 p = size * uv;
+		ivec2 q[4];
+		q[0] = clamp(ivec2(floor(p)), ivec2(0, 0), iSize); // top left
+		q[1] = clamp(q[0] + ivec2(1, 0), ivec2(0, 0), iSize); // top right
+		q[2] = clamp(q[0] + ivec2(0, 1), ivec2(0, 0), iSize); // bottom left
+		q[3] = clamp(q[0] + ivec2(1, 1), ivec2(0, 0), iSize); // bottom right
+		vec4 d[4];
+		ivec2 block(-1, -1);
+		for (int i = 0; i < 4; i++) {
+			if ((q[i] >> 2) != block) { // the 2x2 footprint usually lies in a single block
+				block = q[i] >> 2;
+				texels = fetchBlock(td, block.x, block.y, scratch);
+			}
+			const float* texel = &texels[((q[i].x & 3) + (q[i].y & 3) * 4) * 4];
+			d[i] = vec4(texel[0], texel[1], texel[2], texel[3]);
+		}
+		return lerp(lerp(d[0], d[1], fract(p.x)), lerp(d[2], d[3], fract(p.x)), fract(p.y));
+	}
+
+#ifdef SR_SSE
+	vec4 result;
+	_mm_storeu_ps(&result[0], bilinear ? srBilinearTexels(td.data, width, height, size.x * uv.x, size.y * uv.y) :
+		_mm_loadu_ps(&td.data[(pos.x + pos.y * width) * 4]));
+	return result;
+#else
 	// Nearest neighbor sampling
 	if (!bilinear) return vec4(
 		td.data[pos.x * 4 + 0 + pos.y * width * 4],
@@ -262,28 +834,105 @@ vec4 SrTexture::sampleMipmap(vec2 uv, const bool repeat, const bool bilinear, co
 	R1 = lerp(d11, d21, fract(p.x)); // top sample
 	R2 = lerp(d12, d22, fract(p.x)); // bottom sample
 	return lerp(R1, R2, fract(p.y));
+#endif
+}
+#ifdef SR_SSE
+__m128 SrTexture::sampleLevelSse(vec2 uv, const bool repeat, const bool bilinear, const textureData& td) {
+	if (repeat) uv = mod(uv, vec2(1.0f));
+	uv = clamp(uv, vec2(0.0f), vec2(1.0f));
+	float px = uv.x * (float)td.width, py = uv.y * (float)td.height;
+	return bilinear ? srBilinearTexels(td.data, td.width, td.height, px, py) : srNearestTexel(td.data, td.width, td.height, px, py);
 }
-vec4 SrTexture::sample(vec2 uv, const bool repeat, const bool bilinear , const bool trilinear) {
-	int mipmapLow = floor(max(trilinearCoefficient,0.0f));
+#endif
+vec4 SrTexture::sample(vec2 uv, const bool repeat, const bool bilinear, const bool trilinear) {
+	if (anisotropicTaps <= 1) return sampleIsotropic(uv, repeat, bilinear, trilinear);
+	// Average the taps distributed along the footprint major axis
+	vec4 color(0.0f);
+	vec2 step = anisotropicAxis / (float)anisotropicTaps;
+	vec2 tapUV = uv - (anisotropicAxis - step) * 0.5f;
+	for (int i = 0; i < anisotropicTaps; i++, tapUV += step)
+		color += sampleIsotropic(tapUV, repeat, bilinear, trilinear);
+	return color / (float)anisotropicTaps;
+}
+vec4 SrTexture::sampleIsotropic(vec2 uv, const bool repeat, const bool bilinear, const bool trilinear) {
+	float lod = max(trilinearCoefficient, 0.0f);
+	requestLevel((int)lod); // LOD feedback for the streaming
+	lod = max(lod, (float)residentLevel); // the finer levels may not be resident
+	int mipmapLow = floor(lod);
 	if (mipmapLow >= mipmaps.size())
 		mipmapLow = mipmaps.size() - 1;
 	if (!trilinear) return sampleMipmap(uv, repeat, bilinear, mipmapLow);
 	int mipmapHigh = mipmapLow + 1;
 	if (mipmapHigh >= mipmaps.size())
 		mipmapHigh = mipmaps.size() - 1;
+#ifdef SR_SSE
+	if (format == RGBA32F && virtualPages == NULL) { // blend the two levels without leaving the SSE registers
+		__m128 low = sampleLevelSse(uv, repeat, bilinear, mipmaps[mipmapLow]);
+		__m128 high = sampleLevelSse(uv, repeat, bilinear, mipmaps[mipmapHigh]);
+		vec4 result;
+		_mm_storeu_ps(&result[0], _mm_add_ps(low, _mm_mul_ps(_mm_sub_ps(high, low), _mm_set1_ps(fract(lod)))));
+		return result;
+	}
+#endif
 	return lerp(
 		sampleMipmap(uv, repeat, bilinear, mipmapLow),
 		sampleMipmap(uv, repeat, bilinear, mipmapHigh),
-		fract(trilinearCoefficient)
+		fract(lod)
 	);
 }
+void SrTexture::sampleMany(const vec2* uvs, vec4* results, const int count, const bool repeat, const bool bilinear, const bool trilinear) {
+#ifdef SR_SSE
+	if (format == RGBA32F && anisotropicTaps <= 1 && virtualPages == NULL) {
+		float lod = max(trilinearCoefficient, 0.0f);
+		requestLevel((int)lod); // LOD feedback (see sampleIsotropic)
+		sampleManySse(uvs, results, count, repeat, bilinear, trilinear, max(lod, (float)residentLevel));
+		return;
+	}
+#endif
+	for (int i = 0; i < count; i++)
+		results[i] = sample(uvs[i], repeat, bilinear, trilinear);
+}
+#ifdef SR_SSE
+void SrTexture::sampleManySse(const vec2* uvs, vec4* results, const int count, const bool repeat, const bool bilinear, const bool trilinear, const float lod) {
+	int mipmapLow = min((int)floor(lod), (int)mipmaps.size() - 1);
+	int mipmapHigh = min(mipmapLow + 1, (int)mipmaps.size() - 1);
+	bool blendLevels = trilinear && mipmapHigh != mipmapLow;
+	const textureData& low = mipmaps[mipmapLow];
+	const textureData& high = mipmaps[mipmapHigh];
+	__m128 t = _mm_set1_ps(fract(lod));
+	vec2 lanes[SR_SIMD_LANES];
+	float lx[SR_SIMD_LANES], ly[SR_SIMD_LANES], hx[SR_SIMD_LANES], hy[SR_SIMD_LANES];
+	for (int i = 0; i < count; i += SR_SIMD_LANES) {
+		int n = min(count - i, SR_SIMD_LANES);
+		const vec2* chunk = &uvs[i];
+		if (n < SR_SIMD_LANES) { // pad the last chunk
+			for (int k = 0; k < SR_SIMD_LANES; k++) lanes[k] = uvs[i + min(k, n - 1)];
+			chunk = lanes;
+		}
+		srTexelCoordinates(chunk, repeat, (float)low.width, (float)low.height, lx, ly);
+		if (blendLevels) srTexelCoordinates(chunk, repeat, (float)high.width, (float)high.height, hx, hy);
+		for (int k = 0; k < n; k++) {
+			__m128 color = bilinear ? srBilinearTexels(low.data, low.width, low.height, lx[k], ly[k]) :
+				srNearestTexel(low.data, low.width, low.height, lx[k], ly[k]);
+			if (blendLevels) {
+				__m128 colorHigh = bilinear ? srBilinearTexels(high.data, high.width, high.height, hx[k], hy[k]) :
+					srNearestTexel(high.data, high.width, high.height, hx[k], hy[k]);
+				color = _mm_add_ps(color, _mm_mul_ps(_mm_sub_ps(colorHigh, color), t));
+			}
+			_mm_storeu_ps(&results[i + k][0], color);
+		}
+	}
+}
+#endif
 void SrTexture::clear(vec4 color) {
+	if (virtualPages != NULL || format != RGBA32F) return; // the levels hold no float texels
 	float fColor[4] = { color.r,color.g,color.b,color.a };
 	float* data = mipmaps[0].data;
 	for (size_t i = 0; i < mipmaps[0].width * mipmaps[0].height * 4; i += 4)
 		memcpy(&data[i], fColor, 4*4);
 }
 bool SrTexture::toImage(const char* filename, const int mipmapLevel) {
+	if (virtualPages != NULL || format != RGBA32F) return false; // the levels hold no float texels
 	unsigned char* raw;
 	bool success;
 	size_t len = strlen(filename);
@@ -320,6 +969,7 @@ unsigned char* SrTexture::generateRawBuffer(int channels, const int mipmapLevel)
 	return buff;
 }
 void SrTexture::textureDrawLine(ivec2 a, ivec2 b, vec4 color) {
+	if (virtualPages != NULL || format != RGBA32F) return;
 	// Simplest draw line implementation for debugging purposes
 	vec2 r = vec2(b) - vec2(a);
 	float distance = length(r);
@@ -351,34 +1001,121 @@ void SrTexture::write(const size_t x, const size_t y, vec4 value) {
 	data[x * 4 + y * width * 4 + 2] = value.z;
 	data[x * 4 + y * width * 4 + 3] = value.w;
 }
-void SrTexture::generateMipmaps() {
-	if (size(mipmaps) != 1) return;
-	int i = 0;
-	int newWidth, newHeight;
-	while (mipmaps[i].width >= 2 && mipmaps[i].height >= 2) {
-		newWidth = mipmaps[i].width >> 1;
-		newHeight = mipmaps[i].height >> 1;
+void SrTexture::mipmapFilterWeights(const int srcSize, const int dstSize, const MipmapFilter filter, std::vector<int>& first, std::vector<float>& weights, int& taps) {
+	float scale = (float)srcSize / (float)dstSize; // source texels per destination texel
+	float radius = filter == BOX ? 0.5f : 3.0f;   // support of the kernel in destination texels
+	taps = (int)ceil(2.0f * radius * scale) + 1;
+	if (filter == BOX && scale == floor(scale)) taps = (int)scale; // aligned boxes (even sizes): exactly 2 texels
+	first.resize(dstSize);
+	weights.assign(dstSize * taps, 0.0f);
+	for (int d = 0; d < dstSize; d++) {
+		float center = ((float)d + 0.5f) * scale;
+		first[d] = (int)floor(center - radius * scale);
+		float sum = 0.0f;
+		for (int k = 0; k < taps; k++) {
+			float i = (float)(first[d] + k), w;
+			if (filter == BOX) // length of the source texel covered by the destination texel
+				w = max(min(i + 1.0f, center + 0.5f * scale) - max(i, center - 0.5f * scale), 0.0f);
+			else {
+				float x = (i + 0.5f - center) / scale;
+				if (abs(x) >= radius) w = 0.0f;
+				else {
+					float pix = 3.14159265359f * x;
+					w = abs(x) < 1e-5f ? 1.0f : sin(pix) / pix;
+					if (filter == LANCZOS)
+						w *= abs(x) < 1e-5f ? 1.0f : sin(pix / radius) / (pix / radius);
+					else { // Kaiser window: I0(alpha * sqrt(1 - (x / radius)^2)) / I0(alpha), I0 by its power series
+						float alpha = 4.0f, t = alpha * sqrt(1.0f - (x / radius) * (x / radius));
+						float i0t = 1.0f, i0a = 1.0f, termT = 1.0f, termA = 1.0f;
+						for (int n = 1; n < 20; n++) {
+							termT *= (t * 0.5f / n) * (t * 0.5f / n);
+							termA *= (alpha * 0.5f / n) * (alpha * 0.5f / n);
+							i0t += termT;
+							i0a += termA;
+						}
+						w *= i0t / i0a;
+					}
+				}
+			}
+			weights[d * taps + k] = w;
+			sum += w;
+		}
+		for (int k = 0; k < taps; k++)
+			weights[d * taps + k] /= sum;
+	}
+}
+void SrTexture::filterMipmapRow(const float* src, const int srcWidth, float* dst, const int dstWidth, const int* first, const float* weights, const int taps) {
+	for (int x = 0; x < dstWidth; x++) {
+		const float* w = &weights[x * taps];
+#ifdef SR_SSE
+		// One RGBA texel per SSE register
+		__m128 sum = _mm_setzero_ps();
+		for (int k = 0; k < taps; k++) {
+			int i = clamp(first[x] + k, 0, srcWidth - 1);
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&src[i * 4]), _mm_set1_ps(w[k])));
+		}
+		_mm_storeu_ps(&dst[x * 4], sum);
+#else
+		vec4 sum(0.0f);
+		for (int k = 0; k < taps; k++) {
+			int i = clamp(first[x] + k, 0, srcWidth - 1);
+			sum += vec4(src[i * 4], src[i * 4 + 1], src[i * 4 + 2], src[i * 4 + 3]) * w[k];
+		}
+		memcpy(&dst[x * 4], &sum[0], 4 * sizeof(float));
+#endif
+	}
+}
+void SrTexture::generateMipmaps(const MipmapFilter filter) {
+	if (size(mipmaps) != 1 || format != RGBA32F || virtualPages != NULL) return;
+	std::vector<int> firstX, firstY;
+	std::vector<float> weightsX, weightsY;
+	while (mipmaps.back().width > 1 || mipmaps.back().height > 1) {
+		const textureData src = mipmaps.back();
 		textureData mipmap;
-		mipmap.width = newWidth;
-		mipmap.height = newHeight;
-		mipmap.data = new float[newWidth * newHeight * 4];
-		for (int x = 0; x < newWidth; x++)
-			for (int y = 0; y < newHeight; y++) {
-				for (int k = 0; k < 4; k++) {
-					mipmap.data[x * 4 + y * newWidth * 4 + k] = (
-						mipmaps[i].data[x * 2 * 4 + y * 2 * mipmaps[i].width * 4 + k] +
-						mipmaps[i].data[(x * 2 + 1) * 4 + y *2* mipmaps[i].width * 4 + k] +
-						mipmaps[i].data[x * 2 * 4 + (y * 2 + 1) * mipmaps[i].width * 4 + k] +
-						mipmaps[i].data[(x * 2 + 1) * 4 + (y * 2 + 1) * mipmaps[i].width * 4 + k]) * 0.25f;
+		mipmap.width = max(src.width >> 1, 1);
+		mipmap.height = max(src.height >> 1, 1);
+		mipmap.data = new float[mipmap.width * mipmap.height * 4];
+		int tapsX, tapsY;
+		mipmapFilterWeights(src.width, mipmap.width, filter, firstX, weightsX, tapsX);
+		mipmapFilterWeights(src.height, mipmap.height, filter, firstY, weightsY, tapsY);
+		// Every worker filters a band of rows: the source rows are filtered horizontally once into a ring of tapsY
+		// rows (row r in slot r % tapsY, so the rows of a destination row never collide), then combined vertically
+		int rowFloats = mipmap.width * 4;
+		srParallelFor(mipmap.height, [&](int begin, int end, int worker) {
+			std::vector<float> ring((size_t)tapsY * rowFloats);
+			std::vector<int> ringRows(tapsY, -1);
+			for (int y = begin; y < end; y++) {
+				float* dstRow = &mipmap.data[(size_t)y * rowFloats];
+				memset(dstRow, 0, rowFloats * sizeof(float));
+				for (int k = 0; k < tapsY; k++) {
+					float w = weightsY[y * tapsY + k];
+					if (w == 0.0f) continue;
+					int r = clamp(firstY[y] + k, 0, src.height - 1);
+					float* row = &ring[(size_t)(r % tapsY) * rowFloats];
+					if (ringRows[r % tapsY] != r) {
+						filterMipmapRow(&src.data[(size_t)r * src.width * 4], src.width, row, mipmap.width, &firstX[0], &weightsX[0], tapsX);
+						ringRows[r % tapsY] = r;
+					}
+#ifdef SR_SSE
+					__m128 weight = _mm_set1_ps(w);
+					for (int i = 0; i < rowFloats; i += 4)
+						_mm_storeu_ps(&dstRow[i], _mm_add_ps(_mm_loadu_ps(&dstRow[i]), _mm_mul_ps(_mm_loadu_ps(&row[i]), weight)));
+#else
+					for (int i = 0; i < rowFloats; i++)
+						dstRow[i] += row[i] * w;
+#endif
 				}
+				// The negative lobes of the windowed sinc filters can undershoot next to sharp edges
+				if (filter != BOX)
+					for (int i = 0; i < rowFloats; i++)
+						dstRow[i] = max(dstRow[i], 0.0f);
 			}
+		});
 		mipmaps.push_back(mipmap);
-		i += 1;
 	}
-	return;
 }
 int SrTexture::getMipmapCount() {
-	return mipmaps.size();
+	return mipmaps.size() > 0 ? mipmaps.size() : cubemapMipmaps.size();
 }
 void SrTexture::calculateTrilinearCoefficient(float puvac) {
 	// Cycle through the puvac (pixelUVAreaCoverage) of all mipmap levels
@@ -401,63 +1138,609 @@ void SrTexture::calculateTrilinearCoefficient(float puvac) {
 	return;
 
 }
-
-vec4 SrTexture::sampleCubemap(vec3 eyePos, const bool bilinear, const bool trilinear, float trilinearCoefficient) {
-	#pragma region Compute CFI and UV
-	CubemapFaceIndex cfi;
-	vec3 spacePos = eyePos;
-	vec2 uv;
-	if (spacePos.x < 0.0) { spacePos.x = -spacePos.x; }
-	if (spacePos.y < 0.0) { spacePos.y = -spacePos.y; }
-	if (spacePos.z < 0.0) { spacePos.z = -spacePos.z; }
-	if (spacePos.x >= spacePos.y && spacePos.x >= spacePos.z) { // Left and right
-		if (eyePos.x > 0.0) {
-			cfi = CubemapFaceIndex::LEFT;
-			uv = vec2(0.5f - eyePos.y / eyePos.x, 0.5f - eyePos.z / eyePos.x);
+void SrTexture::setMaxAnisotropy(const int maxTaps) {
+	maxAnisotropy = clamp(maxTaps, 1, 16);
+	if (maxAnisotropy == 1) anisotropicTaps = 1;
+}
+int SrTexture::getMaxAnisotropy() {
+	return maxAnisotropy;
+}
+void SrTexture::calculateAnisotropicFootprint(vec2 dUVdx, vec2 dUVdy) {
+	if (maxAnisotropy <= 1 || mipmaps.size() == 0) return;
+	// Footprint axes in texels of the first mipmap
+	vec2 size(mipmaps[0].width, mipmaps[0].height);
+	float lx = length(dUVdx * size), ly = length(dUVdy * size);
+	float major = max(lx, ly), minor = min(lx, ly);
+	anisotropicTaps = clamp((int)ceil(major / max(minor, 1e-6f)), 1, maxAnisotropy);
+	anisotropicAxis = lx > ly ? dUVdx : dUVdy;
+	if (anisotropicTaps == 1) anisotropicAxis = vec2(0.0f);
+	// Each tap covers major/taps texels along the axis: select the mipmap level accordingly
+	float lod = log2(max(major / (float)anisotropicTaps, 1e-6f));
+	trilinearCoefficient = clamp(lod, 0.0f, (float)(mipmaps.size() - 1));
+}
+void SrTexture::decodeBlock(const textureData& td, const int bx, const int by, float* texels) {
+	// Byte to float conversion tables for linear and gamma encoded texels
+	const float* linearLut = decodeTable(0);
+	int blockBytes = (format == BC1 || format == BC4) ? 8 : 16;
+	const unsigned char* block = &td.blocks[(bx + by * ((td.width + 3) >> 2)) * blockBytes];
+	unsigned char rgba[16 * 4];
+	switch (format) {
+	case BC1: bc1DecodeBlock(block, rgba); break;
+	case BC4:
+		memset(rgba, 0, sizeof(rgba));
+		bc4DecodeBlock(block, rgba);
+		break;
+	case BC5: bc5DecodeBlock(block, rgba); break;
+	default: bc7DecodeBlock(block, rgba); break;
+	}
+	const float* lut = gammaEncoded ? decodeTable(1) : linearLut;
+	for (int t = 0; t < 16; t++) {
+		texels[t * 4 + 0] = lut[rgba[t * 4 + 0]];
+		texels[t * 4 + 1] = lut[rgba[t * 4 + 1]];
+		texels[t * 4 + 2] = lut[rgba[t * 4 + 2]];
+		texels[t * 4 + 3] = linearLut[rgba[t * 4 + 3]];
+		if (format == BC4)
+			texels[t * 4 + 3] = 1.0f;
+		else if (format == BC5) { // reconstruct the normal z component
+			float nx = texels[t * 4 + 0] * 2.0f - 1.0f, ny = texels[t * 4 + 1] * 2.0f - 1.0f;
+			texels[t * 4 + 2] = (sqrt(max(1.0f - nx * nx - ny * ny, 0.0f)) + 1.0f) * 0.5f;
+			texels[t * 4 + 3] = 1.0f;
 		}
+	}
+}
+const float* SrTexture::fetchBlock(const textureData& td, const int bx, const int by, float* scratch) {
+	if (!blockCacheEnabled()) {
+		decodeBlock(td, bx, by, scratch);
+		return scratch;
+	}
+	blockCacheData& cache = blockCache();
+	if (cache.generation != blockCacheGeneration()) {
+		memset(cache.tags, 0, sizeof(cache.tags));
+		cache.generation = blockCacheGeneration();
+	}
+	int blockBytes = (format == BC1 || format == BC4) ? 8 : 16;
+	const unsigned char* tag = &td.blocks[(bx + by * ((td.width + 3) >> 2)) * blockBytes];
+	// 8x8 neighbouring blocks map to distinct slots, the level address picks one of four such tiles so that
+	// textures sampled at the same uv (albedo, normal, mro...) do not evict each other
+	unsigned int salt = (unsigned int)(((size_t)td.blocks >> 4) * 2654435761u) >> 30;
+	unsigned int slot = (bx & 7) | ((by & 7) << 3) | (salt << 6);
+	if (cache.tags[slot] == tag) {
+		cache.hits++;
+		return cache.texels[slot];
+	}
+	cache.misses++;
+	decodeBlock(td, bx, by, cache.texels[slot]);
+	cache.tags[slot] = tag;
+	return cache.texels[slot];
+}
+SrTexture::blockCacheData& SrTexture::blockCache() {
+	static thread_local blockCacheData cache = {};
+	return cache;
+}
+std::atomic<unsigned int>& SrTexture::blockCacheGeneration() {
+	static std::atomic<unsigned int> generation(1);
+	return generation;
+}
+bool& SrTexture::blockCacheEnabled() {
+	static bool enabled = true;
+	return enabled;
+}
+void SrTexture::setBlockCacheEnabled(const bool enabled) {
+	blockCacheEnabled() = enabled;
+}
+void SrTexture::getBlockCacheStats(size_t& hits, size_t& misses) {
+	hits = blockCache().hits;
+	misses = blockCache().misses;
+}
+void SrTexture::resetBlockCacheStats() {
+	blockCache().hits = 0;
+	blockCache().misses = 0;
+}
+void SrTexture::compress(const TextureFormat fmt, const bool gammaEncode) {
+	if (fmt == RGBA32F || format != RGBA32F || mipmaps.size() == 0 || virtualPages != NULL) return;
+	int blockBytes = (fmt == BC1 || fmt == BC4) ? 8 : 16;
+	for (size_t l = 0; l < mipmaps.size(); l++) {
+		textureData& td = mipmaps[l];
+		int bw = (td.width + 3) >> 2, bh = (td.height + 3) >> 2;
+		td.blocks = new unsigned char[bw * bh * blockBytes];
+		unsigned char rgba[16 * 4];
+		for (int by = 0; by < bh; by++)
+			for (int bx = 0; bx < bw; bx++) {
+				// Gather the 4x4 block clamping at the borders of levels smaller than a block
+				for (int t = 0; t < 16; t++) {
+					int x = min(bx * 4 + (t & 3), td.width - 1);
+					int y = min(by * 4 + (t >> 2), td.height - 1);
+					for (int k = 0; k < 4; k++) {
+						float v = clamp(td.data[x * 4 + y * td.width * 4 + k], 0.0f, 1.0f);
+						if (gammaEncode && k < 3) v = pow(v, 1.0f / 2.2f);
+						rgba[t * 4 + k] = (unsigned char)(v * 255.0f + 0.5f);
+					}
+				}
+				unsigned char* block = &td.blocks[(bx + by * bw) * blockBytes];
+				switch (fmt) {
+				case BC1: bc1EncodeBlock(rgba, block); break;
+				case BC4: bc4EncodeBlock(rgba, block); break;
+				case BC5: bc5EncodeBlock(rgba, block); break;
+				default: bc7EncodeBlock(rgba, block); break;
+				}
+			}
+		if (!isMapped(td.data)) delete[] td.data;
+		td.data = NULL;
+	}
+	format = fmt;
+	gammaEncoded = gammaEncode;
+	blockCacheGeneration()++;
+}
+SrTexture::TextureFormat SrTexture::getFormat() {
+	return format;
+}
+size_t SrTexture::getMemoryUsage() {
+	if (virtualPages != NULL) return virtualPages->cache.size() * sizeof(float);
+	size_t bytes = 0;
+	int blockBytes = (format == BC1 || format == BC4) ? 8 : 16;
+	for (size_t l = residentLevel; l < mipmaps.size(); l++) {
+		if (mipmaps[l].data != NULL) bytes += (size_t)mipmaps[l].width * mipmaps[l].height * 4 * sizeof(float);
+		else bytes += (size_t)((mipmaps[l].width + 3) >> 2) * ((mipmaps[l].height + 3) >> 2) * blockBytes;
+	}
+	for (size_t l = 0; l < cubemapMipmaps.size(); l++)
+		for (int face = 0; face < 6; face++)
+			bytes += (size_t)cubemapMipmaps[l][face].width * cubemapMipmaps[l][face].height * 4 * sizeof(float);
+	return bytes;
+}
+bool SrTexture::isMapped(const void* memory) {
+	return mapping.isOpen() && (const unsigned char*)memory >= mapping.data() && (const unsigned char*)memory < mapping.data() + mapping.size();
+}
+/* Container file layout (native little endian): 4 bytes "SRTX", int version, int format, int gammaEncoded,
+   int mipmap count, int cubemap mipmap count, int reserved, then a table with an entry for every mipmap level
+   followed by one for every face of every cubemap level: int width, int height, long long offset of the level data
+   from the beginning of the file. The data of every level (width*height RGBA32F texels, or the compressed blocks)
+   starts at a 64 bytes aligned offset, so it can be used in place once the file is mapped in memory. */
+static const int srContainerVersion = 1;
+bool SrTexture::saveContainer(const char* fname) {
+	if (virtualPages != NULL) return false; // the pages live in the .srvt file, the levels hold no data
+	int blockBytes = (format == BC1 || format == BC4) ? 8 : 16;
+	std::vector<textureData> levels(mipmaps);
+	for (size_t l = 0; l < cubemapMipmaps.size(); l++)
+		levels.insert(levels.end(), cubemapMipmaps[l], cubemapMipmaps[l] + 6);
+	if (levels.size() == 0 || residentLevel > 0) return false; // streamed textures miss their finer levels
+	FILE* pFile = srOpenFile(fname, "wb");
+	if (pFile == NULL) return false;
+	int header[6] = { srContainerVersion, (int)format, gammaEncoded ? 1 : 0, (int)mipmaps.size(), (int)cubemapMipmaps.size(), 0 };
+	bool success = fwrite("SRTX", 1, 4, pFile) == 4 && fwrite(header, sizeof(int), 6, pFile) == 6;
+	// Table of the levels
+	std::vector<size_t> sizes(levels.size());
+	long long offset = 4 + sizeof(header) + (long long)levels.size() * (2 * sizeof(int) + sizeof(long long));
+	for (size_t l = 0; success && l < levels.size(); l++) {
+		const textureData& td = levels[l];
+		sizes[l] = td.data != NULL ? (size_t)td.width * td.height * 4 * sizeof(float) :
+			(size_t)((td.width + 3) >> 2) * ((td.height + 3) >> 2) * blockBytes;
+		offset = (offset + 63) & ~63LL;
+		int size[2] = { td.width, td.height };
+		success = fwrite(size, sizeof(int), 2, pFile) == 2 && fwrite(&offset, sizeof(long long), 1, pFile) == 1;
+		offset += sizes[l];
+	}
+	// Data of the levels
+	static const unsigned char padding[64] = { 0 };
+	long long position = 4 + sizeof(header) + (long long)levels.size() * (2 * sizeof(int) + sizeof(long long));
+	for (size_t l = 0; success && l < levels.size(); l++) {
+		size_t pad = (size_t)(((position + 63) & ~63LL) - position);
+		const void* data = levels[l].data != NULL ? (const void*)levels[l].data : (const void*)levels[l].blocks;
+		success = fwrite(padding, 1, pad, pFile) == pad && fwrite(data, 1, sizes[l], pFile) == sizes[l];
+		position += pad + sizes[l];
+	}
+	fclose(pFile);
+	return success;
+}
+std::future<bool> SrTexture::textureFromContainerAsync(const char* fname) {
+	std::string name = fname;
+	return srAsync([this, name] { return textureFromContainer(name.c_str()); });
+}
+bool SrTexture::readContainerTable(const unsigned char* file, const size_t tableBytes, const size_t fileBytes, int& mipmapCount, std::vector<textureData>& levels, std::vector<long long>& offsets) {
+	int header[6];
+	bool success = tableBytes >= 4 + sizeof(header) && memcmp(file, "SRTX", 4) == 0;
+	if (success) {
+		memcpy(header, file + 4, sizeof(header));
+		success = header[0] == srContainerVersion && header[1] >= RGBA32F && header[1] <= BC7 && header[3] >= 0 && header[4] >= 0 &&
+			tableBytes >= 4 + sizeof(header) + ((size_t)header[3] + (size_t)header[4] * 6) * (2 * sizeof(int) + sizeof(long long));
+	}
+	if (!success) return false;
+	format = (TextureFormat)header[1];
+	gammaEncoded = header[2] != 0;
+	mipmapCount = header[3];
+	const unsigned char* table = file + 4 + sizeof(header);
+	for (int l = 0; l < header[3] + header[4] * 6; l++, table += 2 * sizeof(int) + sizeof(long long)) {
+		textureData td;
+		long long offset;
+		memcpy(&td.width, table, sizeof(int));
+		memcpy(&td.height, table + sizeof(int), sizeof(int));
+		memcpy(&offset, table + 2 * sizeof(int), sizeof(long long));
+		if (td.width <= 0 || td.height <= 0 || offset < 0 || (offset & 3) != 0) return false;
+		// cubemap levels are always RGBA32F
+		if ((size_t)offset + levelBytes(td.width, td.height, l < header[3] && format != RGBA32F) > fileBytes) return false;
+		levels.push_back(td);
+		offsets.push_back(offset);
+	}
+	return true;
+}
+bool SrTexture::textureFromContainer(const char* fname) {
+	disposeData();
+	if (!mapping.open(fname, true)) return false;
+	int mipmapCount;
+	std::vector<textureData> levels;
+	std::vector<long long> offsets;
+	bool success = readContainerTable(mapping.data(), mapping.size(), mapping.size(), mipmapCount, levels, offsets);
+	for (int l = 0; success && l < (int)levels.size(); l++) {
+		textureData td = levels[l];
+		if (l < mipmapCount && format != RGBA32F) td.blocks = mapping.data() + offsets[l];
+		else td.data = (float*)(mapping.data() + offsets[l]);
+		if (l < mipmapCount) mipmaps.push_back(td);
 		else {
-			cfi = CubemapFaceIndex::RIGHT;
-			uv = vec2(0.5f - eyePos.y / eyePos.x, 0.5f + eyePos.z / eyePos.x);
+			int level = (l - mipmapCount) / 6;
+			if ((size_t)level >= cubemapMipmaps.size()) cubemapMipmaps.push_back(new textureData[6]);
+			cubemapMipmaps[level][(l - mipmapCount) % 6] = td;
 		}
 	}
-	else { // Back and front
-		if (spacePos.y > spacePos.x && spacePos.y >= spacePos.z) {
-			if (eyePos.y > 0.0) {
-				cfi = CubemapFaceIndex::BACK;
-				uv = vec2(0.5f + eyePos.x / eyePos.y , 0.5f-eyePos.z / eyePos.y);
-			}
-			else {
-				cfi = CubemapFaceIndex::FRONT;
-				uv = vec2(0.5f + eyePos.x / eyePos.y, 0.5f + eyePos.z / eyePos.y);
-			}
+	if (!success) {
+		std::cout << "Invalid texture container " << fname << std::endl;
+		disposeData();
+	}
+	return success;
+}
+bool SrTexture::textureFromContainerStreamed(const char* fname) {
+	disposeData();
+	FILE* pFile = srOpenFile(fname, "rb");
+	if (pFile == NULL) return false;
+	// Read the header, then the whole level table
+	std::vector<unsigned char> table(4 + 6 * sizeof(int));
+	bool success = fread(&table[0], 1, table.size(), pFile) == table.size();
+	long long fileBytes = 0;
+	if (success) {
+		int counts[2];
+		memcpy(counts, &table[4 + 3 * sizeof(int)], sizeof(counts));
+		success = counts[0] > 0 && counts[0] <= 32 && counts[1] == 0; // 2D textures only
+		size_t header = table.size();
+		if (success) table.resize(header + (size_t)counts[0] * (2 * sizeof(int) + sizeof(long long)));
+		success = success && fread(&table[header], 1, table.size() - header, pFile) == table.size() - header &&
+			srSeekFile(pFile, 0, SEEK_END) && (fileBytes = srTellFile(pFile)) > 0;
+	}
+	fclose(pFile);
+	int mipmapCount;
+	success = success && readContainerTable(&table[0], table.size(), (size_t)fileBytes, mipmapCount, mipmaps, levelOffsets);
+	if (!success) {
+		std::cout << "Invalid texture container " << fname << std::endl;
+		disposeData();
+		return false;
+	}
+	streamFile = fname;
+	residentLevel = (int)mipmaps.size();
+	pinnedLevel = 0;
+	while (pinnedLevel < (int)mipmaps.size() - 1 && (mipmaps[pinnedLevel].width > 64 || mipmaps[pinnedLevel].height > 64))
+		pinnedLevel++;
+	if (!streamLevels(pinnedLevel)) {
+		disposeData();
+		return false;
+	}
+	return true;
+}
+bool SrTexture::streamLevels(const int mipmapLevel) {
+	if (mipmapLevel >= residentLevel) return true;
+	FILE* pFile = srOpenFile(streamFile.c_str(), "rb");
+	if (pFile == NULL) return false;
+	// Read from the coarsest missing level so that the resident levels stay a contiguous tail of the chain
+	bool success = true;
+	while (success && residentLevel > max(mipmapLevel, 0)) {
+		textureData& td = mipmaps[residentLevel - 1];
+		bool compressed = format != RGBA32F;
+		size_t bytes = levelBytes(td.width, td.height, compressed);
+		if (compressed) td.blocks = new unsigned char[bytes];
+		else td.data = new float[bytes / sizeof(float)];
+		void* memory = compressed ? (void*)td.blocks : (void*)td.data;
+		success = srSeekFile(pFile, levelOffsets[residentLevel - 1], SEEK_SET) && fread(memory, 1, bytes, pFile) == bytes;
+		if (!success) {
+			delete[] td.blocks;
+			delete[] td.data;
+			td.blocks = NULL;
+			td.data = NULL;
+			break;
 		}
-		else { // Top and bottom
-			if (eyePos.z > 0.0) {
-				cfi = CubemapFaceIndex::TOP;
-				uv = vec2(0.5f - eyePos.x / eyePos.z , 0.5f - eyePos.y / eyePos.z );
-			}
-			else {
-				cfi = CubemapFaceIndex::BOTTOM;
-				uv = vec2(0.5f + eyePos.x / eyePos.z ,0.5f -eyePos.y / eyePos.z);
+		residentLevel--;
+	}
+	fclose(pFile);
+	if (!success) std::cout << "could not stream " << streamFile << std::endl;
+	return success;
+}
+size_t SrTexture::evictLevels(const int mipmapLevel) {
+	size_t bytes = 0;
+	for (int l = residentLevel; l < min(mipmapLevel, pinnedLevel); l++, residentLevel++) {
+		bytes += getLevelMemory(l);
+		delete[] mipmaps[l].data;
+		delete[] mipmaps[l].blocks;
+		mipmaps[l].data = NULL;
+		mipmaps[l].blocks = NULL;
+	}
+	if (bytes > 0) blockCacheGeneration()++; // the released blocks addresses may be reused
+	return bytes;
+}
+bool SrTexture::isStreamed() {
+	return !streamFile.empty();
+}
+int SrTexture::getResidentLevel() {
+	return residentLevel;
+}
+int SrTexture::getPinnedLevel() {
+	return pinnedLevel;
+}
+int SrTexture::getRequestedLevel() {
+	return min(requestedLevel.load(std::memory_order_relaxed), (int)mipmaps.size());
+}
+void SrTexture::resetLodFeedback() {
+	requestedLevel.store(INT_MAX, std::memory_order_relaxed);
+}
+void SrTexture::requestLevel(const int level) {
+	int requested = requestedLevel.load(std::memory_order_relaxed);
+	while (level < requested && !requestedLevel.compare_exchange_weak(requested, level, std::memory_order_relaxed));
+}
+size_t SrTexture::getLevelMemory(const int mipmapLevel) {
+	return levelBytes(mipmaps[mipmapLevel].width, mipmaps[mipmapLevel].height, format != RGBA32F);
+}
+size_t SrTexture::levelBytes(const int width, const int height, const bool compressed) {
+	int blockBytes = (format == BC1 || format == BC4) ? 8 : 16;
+	return compressed ? (size_t)((width + 3) >> 2) * ((height + 3) >> 2) * blockBytes : (size_t)width * height * 4 * sizeof(float);
+}
+/* Virtual texture file layout (native little endian): 4 bytes "SRVT", int version, int page size, int mipmap count,
+   int width and int height of every level, then the pages of every level row by row, each of (pageSize + 1)^2 RGBA32F
+   texels (the page texels and the first column and row of the next pages, clamped to the level edges) */
+static const int srVirtualVersion = 1;
+static const unsigned int srVirtualNoPage = 0xFFFFFFFF;
+bool SrTexture::saveVirtual(const char* fname, const int pageSize) {
+	if (mipmaps.size() == 0 || format != RGBA32F || residentLevel > 0 || virtualPages != NULL || pageSize < 8) return false;
+	FILE* pFile = srOpenFile(fname, "wb");
+	if (pFile == NULL) return false;
+	int header[3] = { srVirtualVersion, pageSize, (int)mipmaps.size() };
+	bool success = fwrite("SRVT", 1, 4, pFile) == 4 && fwrite(header, sizeof(int), 3, pFile) == 3;
+	for (size_t l = 0; success && l < mipmaps.size(); l++) {
+		int size[2] = { mipmaps[l].width, mipmaps[l].height };
+		success = fwrite(size, sizeof(int), 2, pFile) == 2;
+	}
+	int stride = pageSize + 1;
+	std::vector<float> page((size_t)stride * stride * 4);
+	for (size_t l = 0; success && l < mipmaps.size(); l++) {
+		const textureData& td = mipmaps[l];
+		for (int py = 0; success && py < (td.height + pageSize - 1) / pageSize; py++)
+			for (int px = 0; success && px < (td.width + pageSize - 1) / pageSize; px++) {
+				for (int y = 0; y < stride; y++)
+					for (int x = 0; x < stride; x++) {
+						int sx = min(px * pageSize + x, td.width - 1), sy = min(py * pageSize + y, td.height - 1);
+						memcpy(&page[(x + y * stride) * 4], &td.data[(sx + sy * td.width) * 4], 4 * sizeof(float));
+					}
+				success = fwrite(&page[0], sizeof(float), page.size(), pFile) == page.size();
 			}
+	}
+	fclose(pFile);
+	return success;
+}
+bool SrTexture::textureFromVirtual(const char* fname, const int cachePages) {
+	disposeData();
+	FILE* pFile = srOpenFile(fname, "rb");
+	if (pFile == NULL) return false;
+	char magic[4];
+	int header[3];
+	bool success = fread(magic, 1, 4, pFile) == 4 && memcmp(magic, "SRVT", 4) == 0 && fread(header, sizeof(int), 3, pFile) == 3 &&
+		header[0] == srVirtualVersion && header[1] >= 8 && header[1] <= 4096 && header[2] > 0 && header[2] <= 32;
+	virtualPages = new virtualData();
+	virtualData& vt = *virtualPages;
+	long long offset = 4 + 3 * sizeof(int) + (success ? header[2] * 2 * sizeof(int) : 0);
+	for (int l = 0; success && l < header[2]; l++) {
+		textureData td;
+		success = fread(&td.width, sizeof(int), 1, pFile) == 1 && fread(&td.height, sizeof(int), 1, pFile) == 1 &&
+			td.width > 0 && td.height > 0;
+		if (!success) break;
+		ivec2 pages((td.width + header[1] - 1) / header[1], (td.height + header[1] - 1) / header[1]);
+		success = pages.x <= 8192 && pages.y <= 8192;
+		mipmaps.push_back(td);
+		vt.pageCounts.push_back(pages);
+		vt.levelOffsets.push_back(offset);
+		vt.pageTable.push_back(std::vector<int>((size_t)pages.x * pages.y, -1));
+		offset += (long long)pages.x * pages.y * (header[1] + 1) * (header[1] + 1) * 4 * sizeof(float);
+	}
+	// The file must hold every page and the chain must end with levels fitting in a single page
+	success = success && srSeekFile(pFile, 0, SEEK_END) && srTellFile(pFile) >= offset && vt.pageCounts.back() == ivec2(1, 1);
+	if (success) {
+		vt.file = fname;
+		vt.pageSize = header[1];
+		vt.pinnedLevel = (int)mipmaps.size() - 1;
+		while (vt.pinnedLevel > 0 && vt.pageCounts[vt.pinnedLevel - 1] == ivec2(1, 1)) vt.pinnedLevel--;
+		int slots = max(cachePages, (int)mipmaps.size() - vt.pinnedLevel + 1);
+		vt.cache.resize((size_t)slots * (vt.pageSize + 1) * (vt.pageSize + 1) * 4);
+		vt.slotPages.assign(slots, srVirtualNoPage);
+		vt.slotFrames.assign(slots, -1);
+		vt.frame = 0;
+		vt.pagesLoaded = 0;
+		// The levels fitting in a single page are always resident
+		for (int l = vt.pinnedLevel; success && l < (int)mipmaps.size(); l++) {
+			success = loadVirtualPage(pFile, virtualPageId(l, 0, 0), l - vt.pinnedLevel);
+			vt.slotFrames[l - vt.pinnedLevel] = INT_MAX;
 		}
 	}
-	uv = (uv + vec2(0.5f)) * 0.5f;
-	// Not sure why i need this modification
-	if (cfi == BOTTOM) cfi = TOP;
-	else if (cfi == TOP) cfi = BOTTOM;
-	if (cfi != BOTTOM && cfi != TOP)
-		uv = vec2(1.0f - uv.y, uv.x);
-	if (cfi == TOP)
-		uv = vec2(1.0f - uv.x, 1.0f - uv.y);
-	#pragma endregion
+	fclose(pFile);
+	if (!success) {
+		std::cout << "Invalid virtual texture " << fname << std::endl;
+		disposeData();
+	}
+	return success;
+}
+bool SrTexture::loadVirtualPage(FILE* pFile, const unsigned int page, const int slot) {
+	virtualData& vt = *virtualPages;
+	if (vt.slotPages[slot] != srVirtualNoPage) {
+		unsigned int old = vt.slotPages[slot];
+		vt.pageTable[old >> 26][((old >> 13) & 8191) * vt.pageCounts[old >> 26].x + (old & 8191)] = -1;
+	}
+	int level = page >> 26, x = page & 8191, y = (page >> 13) & 8191;
+	size_t floats = (size_t)(vt.pageSize + 1) * (vt.pageSize + 1) * 4;
+	long long offset = vt.levelOffsets[level] + ((long long)y * vt.pageCounts[level].x + x) * floats * sizeof(float);
+	bool success = srSeekFile(pFile, offset, SEEK_SET) && fread(&vt.cache[slot * floats], sizeof(float), floats, pFile) == floats;
+	vt.slotPages[slot] = success ? page : srVirtualNoPage;
+	vt.slotFrames[slot] = success ? vt.frame : -1;
+	if (success) vt.pageTable[level][y * vt.pageCounts[level].x + x] = slot;
+	return success;
+}
+bool SrTexture::isVirtual() {
+	return virtualPages != NULL;
+}
+vec4 SrTexture::sampleVirtual(vec2 uv, const bool repeat, const bool bilinear, int mipmapLevel) {
+	virtualData& vt = *virtualPages;
+	if (repeat) uv -= floor(uv);
+	uv = clamp(uv, vec2(0.0f), vec2(1.0f));
+	// Find the page covering uv, going to the coarser levels until it is resident
+	vec2 p;
+	ivec2 page;
+	int slot = -1;
+	for (; slot < 0; mipmapLevel++) {
+		const textureData& td = mipmaps[mipmapLevel];
+		p = uv * vec2(td.width, td.height);
+		page = min(ivec2(p), ivec2(td.width - 1, td.height - 1)) / vt.pageSize;
+		slot = vt.pageTable[mipmapLevel][page.y * vt.pageCounts[mipmapLevel].x + page.x];
+	}
+	// Sample the slot like a (pageSize + 1)^2 level, the texel coordinates being relative to the page
+	int stride = vt.pageSize + 1;
+	const float* data = &vt.cache[(size_t)slot * stride * stride * 4];
+	p -= vec2(page * vt.pageSize);
+#ifdef SR_SSE
+	vec4 result;
+	_mm_storeu_ps(&result[0], bilinear ? srBilinearTexels(data, stride, stride, p.x, p.y) : srNearestTexel(data, stride, stride, p.x, p.y));
+	return result;
+#else
+	ivec2 q = min(ivec2(bilinear ? p : p + vec2(0.5f)), ivec2(stride - 1));
+	const float* t11 = &data[(q.x + q.y * stride) * 4];
+	if (!bilinear) return vec4(t11[0], t11[1], t11[2], t11[3]);
+	int dx = q.x < stride - 1 ? 4 : 0, dy = q.y < stride - 1 ? stride * 4 : 0;
+	vec2 f = p - vec2(q);
+	return lerp(
+		lerp(vec4(t11[0], t11[1], t11[2], t11[3]), vec4(t11[dx], t11[dx + 1], t11[dx + 2], t11[dx + 3]), f.x),
+		lerp(vec4(t11[dy], t11[dy + 1], t11[dy + 2], t11[dy + 3]), vec4(t11[dy + dx], t11[dy + dx + 1], t11[dy + dx + 2], t11[dy + dx + 3]), f.x),
+		f.y
+	);
+#endif
+}
+void SrTexture::clearVirtualFeedback(const int count) {
+	virtualPages->feedback.assign(count, srVirtualNoPage);
+}
+void SrTexture::writeVirtualFeedback(const int index, vec2 uv) {
+	virtualData& vt = *virtualPages;
+	if (index < 0 || index >= (int)vt.feedback.size()) return;
+	uv -= floor(uv); // the textures are usually sampled with repeat
+	int level = clamp((int)max(trilinearCoefficient, 0.0f), 0, (int)mipmaps.size() - 1);
+	ivec2 page = min(ivec2(uv * vec2(mipmaps[level].width, mipmaps[level].height)), ivec2(mipmaps[level].width - 1, mipmaps[level].height - 1)) / vt.pageSize;
+	vt.feedback[index] = virtualPageId(level, page.x, page.y);
+}
+int SrTexture::updateVirtualPages(const int maxPages) {
+	virtualData& vt = *virtualPages;
+	vt.frame++;
+	// The requested pages and the pages covering them at the coarser levels, so that a missing page falls back to the
+	// next level (and trilinear filtering finds both levels), sorted coarsest first without repetitions
+	std::vector<unsigned int> requests;
+	for (size_t i = 0; i < vt.feedback.size(); i++) {
+		unsigned int page = vt.feedback[i];
+		if (page == srVirtualNoPage || (i > 0 && page == vt.feedback[i - 1])) continue;
+		int x = page & 8191, y = (page >> 13) & 8191;
+		for (int level = page >> 26; level < vt.pinnedLevel; level++, x >>= 1, y >>= 1)
+			requests.push_back(virtualPageId(level, min(x, vt.pageCounts[level].x - 1), min(y, vt.pageCounts[level].y - 1)));
+	}
+	std::sort(requests.begin(), requests.end(), std::greater<unsigned int>());
+	requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+	// Keep the resident pages requested in this frame, collect the missing ones
+	std::vector<unsigned int> missing;
+	for (size_t i = 0; i < requests.size(); i++) {
+		unsigned int page = requests[i];
+		int slot = vt.pageTable[page >> 26][((page >> 13) & 8191) * vt.pageCounts[page >> 26].x + (page & 8191)];
+		if (slot < 0) missing.push_back(page);
+		else if (vt.slotFrames[slot] != INT_MAX) vt.slotFrames[slot] = vt.frame;
+	}
+	if (missing.size() == 0) return 0;
+	FILE* pFile = srOpenFile(vt.file.c_str(), "rb");
+	if (pFile == NULL) return 0;
+	// Read them to the free slots or to the least recently requested ones, never replacing a page of this frame
+	int loaded = 0;
+	for (size_t i = 0; i < missing.size() && (maxPages <= 0 || loaded < maxPages); i++) {
+		int slot = -1;
+		for (int s = 0; s < (int)vt.slotFrames.size(); s++)
+			if (vt.slotFrames[s] < vt.frame && (slot < 0 || vt.slotFrames[s] < vt.slotFrames[slot])) slot = s;
+		if (slot < 0) break; // the cache is too small for the pages in view
+		if (!loadVirtualPage(pFile, missing[i], slot)) {
+			std::cout << "could not read virtual texture page from " << vt.file << std::endl;
+			break;
+		}
+		loaded++;
+	}
+	fclose(pFile);
+	vt.pagesLoaded += loaded;
+	return loaded;
+}
+void SrTexture::getVirtualStats(int& residentPages, size_t& pagesLoaded) {
+	residentPages = 0;
+	for (size_t s = 0; s < virtualPages->slotPages.size(); s++)
+		if (virtualPages->slotPages[s] != srVirtualNoPage) residentPages++;
+	pagesLoaded = virtualPages->pagesLoaded;
+}
+/* Compressed texture file layout (little endian):
+   4 bytes "SRBC", int format, int gammaEncoded, int mipmap count, then for every mipmap level
+   int width, int height followed by the ((width+3)/4)*((height+3)/4) blocks of the level */
+bool SrTexture::saveCompressed(const char* fname) {
+	if (format == RGBA32F) return false;
+	FILE* pFile = srOpenFile(fname, "wb");
+	if (pFile == NULL) return false;
+	int blockBytes = (format == BC1 || format == BC4) ? 8 : 16;
+	int header[3] = { (int)format, gammaEncoded ? 1 : 0, (int)mipmaps.size() };
+	bool success = fwrite("SRBC", 1, 4, pFile) == 4 && fwrite(header, sizeof(int), 3, pFile) == 3;
+	for (size_t l = 0; success && l < mipmaps.size(); l++) {
+		int size[2] = { mipmaps[l].width, mipmaps[l].height };
+		size_t count = (size_t)((size[0] + 3) >> 2) * ((size[1] + 3) >> 2) * blockBytes;
+		success = fwrite(size, sizeof(int), 2, pFile) == 2 && fwrite(mipmaps[l].blocks, 1, count, pFile) == count;
+	}
+	fclose(pFile);
+	return success;
+}
+bool SrTexture::textureFromCompressed(const char* fname) {
+	disposeData();
+	FILE* pFile = srOpenFile(fname, "rb");
+	if (pFile == NULL) return false;
+	char magic[4];
+	int header[3];
+	bool success = fread(magic, 1, 4, pFile) == 4 && memcmp(magic, "SRBC", 4) == 0 &&
+		fread(header, sizeof(int), 3, pFile) == 3 && header[0] > RGBA32F && header[0] <= BC7;
+	if (success) {
+		format = (TextureFormat)header[0];
+		gammaEncoded = header[1] != 0;
+	}
+	int blockBytes = (format == BC1 || format == BC4) ? 8 : 16;
+	for (int l = 0; success && l < header[2]; l++) {
+		textureData td;
+		success = fread(&td.width, sizeof(int), 1, pFile) == 1 && fread(&td.height, sizeof(int), 1, pFile) == 1 &&
+			td.width > 0 && td.height > 0;
+		if (!success) break;
+		size_t count = (size_t)((td.width + 3) >> 2) * ((td.height + 3) >> 2) * blockBytes;
+		td.blocks = new unsigned char[count];
+		mipmaps.push_back(td);
+		success = fread(td.blocks, 1, count, pFile) == count;
+	}
+	fclose(pFile);
+	if (!success) {
+		std::cout << "could not load compressed texture " << fname << std::endl;
+		disposeData();
+	}
+	return success;
+}
 
+vec4 SrTexture::sampleCubemap(vec3 eyePos, const bool bilinear, const bool trilinear, float trilinearCoefficient) {
+	CubemapFaceIndex cfi;
+	vec2 uv;
+	cubemapFaceUV(eyePos, cfi, uv);
 	int mipmapLow = floor(max(trilinearCoefficient, 0.0f));
-	if (mipmapLow >= cubemapMipmaps.size())
+	if (mipmapLow >= (int)cubemapMipmaps.size())
 		mipmapLow = cubemapMipmaps.size() - 1;
 	if (!trilinear) return sampleCubemapMipmap(uv, cfi, bilinear, mipmapLow);
 	int mipmapHigh = mipmapLow + 1;
-	if (mipmapHigh >= cubemapMipmaps.size())
+	if (mipmapHigh >= (int)cubemapMipmaps.size())
 		mipmapHigh = cubemapMipmaps.size() - 1;
 	return lerp(
 		sampleCubemapMipmap(uv, cfi, bilinear, mipmapLow),
@@ -465,4 +1748,175 @@ vec4 SrTexture::sampleCubemap(vec3 eyePos, const bool bilinear, const bool trili
 		fract(trilinearCoefficient)
 	);
 }
+void SrTexture::sampleCubemapMany(const vec3* eyeViews, vec4* results, const int count, const bool bilinear, const bool trilinear, float trilinearCoefficient) {
+	int mipmapLow = clamp((int)floor(max(trilinearCoefficient, 0.0f)), 0, (int)cubemapMipmaps.size() - 1);
+	int mipmapHigh = min(mipmapLow + 1, (int)cubemapMipmaps.size() - 1);
+	bool blendLevels = trilinear && mipmapHigh != mipmapLow;
+	float t = fract(trilinearCoefficient);
+	for (int i = 0; i < count; i += 4) {
+		int n = min(count - i, 4);
+		int faces[4];
+		float us[4], vs[4];
+#ifdef SR_SSE
+		// Face selection and projection of 4 directions at once: the face basis axes are signed coordinate axes,
+		// so the uv numerators are selected with masks instead of the table dot products
+		const vec3* d = &eyeViews[i];
+		__m128 x = _mm_set_ps(d[min(3, n - 1)].x, d[min(2, n - 1)].x, d[min(1, n - 1)].x, d[0].x);
+		__m128 y = _mm_set_ps(d[min(3, n - 1)].y, d[min(2, n - 1)].y, d[min(1, n - 1)].y, d[0].y);
+		__m128 z = _mm_set_ps(d[min(3, n - 1)].z, d[min(2, n - 1)].z, d[min(1, n - 1)].z, d[0].z);
+		__m128 signMask = _mm_set1_ps(-0.0f);
+		__m128 ax = _mm_andnot_ps(signMask, x), ay = _mm_andnot_ps(signMask, y), az = _mm_andnot_ps(signMask, z);
+		__m128 xMajor = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+		__m128 yMajor = _mm_andnot_ps(xMajor, _mm_cmpge_ps(ay, az));
+		__m128 zMajor = _mm_andnot_ps(_mm_or_ps(xMajor, yMajor), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+		__m128 ma = _mm_or_ps(_mm_and_ps(xMajor, ax), _mm_or_ps(_mm_and_ps(yMajor, ay), _mm_and_ps(zMajor, az)));
+		// sc: z for the x/y major faces, -x*sign(z) for the z major ones
+		__m128 sc = _mm_or_ps(_mm_andnot_ps(zMajor, z), _mm_and_ps(zMajor, _mm_xor_ps(x, _mm_andnot_ps(_mm_and_ps(z, signMask), signMask))));
+		// tc: -y*sign(x) for the x major faces, x*sign(y) for the y major ones, -y for the z major ones
+		__m128 tc = _mm_or_ps(_mm_and_ps(xMajor, _mm_xor_ps(y, _mm_andnot_ps(_mm_and_ps(x, signMask), signMask))),
+			_mm_or_ps(_mm_and_ps(yMajor, _mm_xor_ps(x, _mm_and_ps(y, signMask))), _mm_and_ps(zMajor, _mm_xor_ps(y, signMask))));
+		__m128 half = _mm_set1_ps(0.5f), scale = _mm_div_ps(half, ma);
+		_mm_storeu_ps(us, _mm_add_ps(_mm_mul_ps(sc, scale), half));
+		_mm_storeu_ps(vs, _mm_add_ps(_mm_mul_ps(tc, scale), half));
+		int xm = _mm_movemask_ps(xMajor), ym = _mm_movemask_ps(yMajor);
+		int xp = _mm_movemask_ps(_mm_cmpgt_ps(x, _mm_setzero_ps())), yp = _mm_movemask_ps(_mm_cmpgt_ps(y, _mm_setzero_ps()));
+		int zp = _mm_movemask_ps(_mm_cmpgt_ps(z, _mm_setzero_ps()));
+		for (int k = 0; k < n; k++)
+			faces[k] = (xm >> k) & 1 ? cubemapAxisFaces[0][(xp >> k) & 1] : ((ym >> k) & 1 ? cubemapAxisFaces[1][(yp >> k) & 1] : cubemapAxisFaces[2][(zp >> k) & 1]);
+#else
+		for (int k = 0; k < n; k++) {
+			CubemapFaceIndex cfi;
+			vec2 uv;
+			cubemapFaceUV(eyeViews[i + k], cfi, uv);
+			faces[k] = cfi;
+			us[k] = uv.x;
+			vs[k] = uv.y;
+		}
+#endif
+		for (int k = 0; k < n; k++) {
+			vec2 uv(us[k], vs[k]);
+			CubemapFaceIndex cfi = (CubemapFaceIndex)faces[k];
+			results[i + k] = sampleCubemapMipmap(uv, cfi, bilinear, mipmapLow);
+			if (blendLevels) results[i + k] = lerp(results[i + k], sampleCubemapMipmap(uv, cfi, bilinear, mipmapHigh), t);
+		}
+	}
+}
+vec2 SrTexture::octahedralEncode(vec3 dir) {
+	vec2 p = vec2(dir.x, dir.y) * (1.0f / (abs(dir.x) + abs(dir.y) + abs(dir.z)));
+	if (dir.z < 0.0f) // fold the lower hemisphere over the corners
+		p = vec2((1.0f - abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+	return p * 0.5f + vec2(0.5f);
+}
+vec3 SrTexture::octahedralDecode(vec2 uv) {
+	vec2 p = uv * 2.0f - vec2(1.0f);
+	vec3 dir(p.x, p.y, 1.0f - abs(p.x) - abs(p.y));
+	if (dir.z < 0.0f)
+		dir = vec3((1.0f - abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f), dir.z);
+	return normalize(dir);
+}
+void SrTexture::cubemapToSH(vec3 coefficients[9], const int mipmapLevel) {
+	textureData* faces = cubemapMipmaps[mipmapLevel];
+	int size = faces[0].width;
+	// Every worker accumulates its own coefficients (and total solid angle), summed once all the rows are done
+	std::vector<vec3> partial(srThreadCount() * 9, vec3(0.0f));
+	std::vector<float> partialWeight(srThreadCount(), 0.0f);
+	srParallelFor(6 * size, [&](int begin, int end, int worker) {
+		float basis[9];
+		for (int row = begin; row < end; row++) {
+			int face = row / size, y = row % size;
+			const float* data = faces[face].data;
+			float v0 = (float)y / (float)size * 2.0f - 1.0f, v1 = (float)(y + 1) / (float)size * 2.0f - 1.0f;
+			for (int x = 0; x < size; x++) {
+				float u0 = (float)x / (float)size * 2.0f - 1.0f, u1 = (float)(x + 1) / (float)size * 2.0f - 1.0f;
+				// Solid angle of the texel: the projected area of the face rectangle [u0,u1]x[v0,v1] on the sphere
+				float weight = atan2(u0 * v0, sqrt(u0 * u0 + v0 * v0 + 1.0f)) - atan2(u0 * v1, sqrt(u0 * u0 + v1 * v1 + 1.0f)) -
+					atan2(u1 * v0, sqrt(u1 * u1 + v0 * v0 + 1.0f)) + atan2(u1 * v1, sqrt(u1 * u1 + v1 * v1 + 1.0f));
+				vec3 dir = normalize(cubemapFaceBasis[face][0] +
+					cubemapFaceBasis[face][1] * ((u0 + u1) * 0.5f) + cubemapFaceBasis[face][2] * ((v0 + v1) * 0.5f));
+				const float* texel = &data[(x + y * size) * 4];
+				vec3 color = vec3(texel[0], texel[1], texel[2]) * weight;
+				shBasis(dir, basis);
+				for (int i = 0; i < 9; i++)
+					partial[worker * 9 + i] += color * basis[i];
+				partialWeight[worker] += weight;
+			}
+		}
+	});
+	float totalWeight = 0.0f;
+	for (int i = 0; i < 9; i++) coefficients[i] = vec3(0.0f);
+	for (int w = 0; w < srThreadCount(); w++) {
+		for (int i = 0; i < 9; i++) coefficients[i] += partial[w * 9 + i];
+		totalWeight += partialWeight[w];
+	}
+	// The texel solid angles sum to 4pi up to rounding: normalize so that a constant cubemap is reproduced exactly
+	for (int i = 0; i < 9; i++) coefficients[i] *= 4.0f * 3.14159265359f / totalWeight;
+}
+void SrTexture::octahedralFromCubemap(SrTexture& cubemap, const int size) {
+	disposeData();
+	for (int level = 0; level < (int)cubemap.cubemapMipmaps.size() && (size >> level) > 0; level++) {
+		int n = size >> level, width = n + 2;
+		textureData td;
+		td.width = td.height = width;
+		td.data = new float[width * width * 4];
+		// Interior texel (x,y) is stored at (x+1,y+1) and holds the direction at the center of its cell
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++) {
+				vec3 dir = octahedralDecode(vec2(x + 0.5f, y + 0.5f) / (float)n);
+				vec4 color = cubemap.sampleCubemap(dir, true, false, (float)level);
+				memcpy(&td.data[(x + 1 + (y + 1) * width) * 4], &color[0], 4 * sizeof(float));
+			}
+		// Border: crossing an edge of the square folds back on the same edge mirrored, the corners meet diagonally
+		for (int by = 0; by < width; by++)
+			for (int bx = 0; bx < width; bx += (by == 0 || by == width - 1) ? 1 : width - 1) {
+				int x = bx - 1, y = by - 1;
+				if (y < 0 || y >= n) { y = y < 0 ? 0 : n - 1; x = n - 1 - x; }
+				if (x < 0 || x >= n) { x = x < 0 ? 0 : n - 1; y = n - 1 - y; }
+				memcpy(&td.data[(bx + by * width) * 4], &td.data[(x + 1 + (y + 1) * width) * 4], 4 * sizeof(float));
+			}
+		mipmaps.push_back(td);
+	}
+}
+vec2 SrTexture::octahedralLevelUv(vec2 uv, const int mipmapLevel) {
+	// Texel i is sampled at uv = i / width (see sampleMipmap), interior texel x is centered at (x + 0.5) / n
+	float width = (float)mipmaps[mipmapLevel].width;
+	return (uv * (width - 2.0f) + vec2(0.5f)) / width;
+}
+vec4 SrTexture::sampleOctahedral(vec3 eyeView, const bool bilinear, const bool trilinear, float trilinearCoefficient) {
+	vec2 uv = octahedralEncode(eyeView);
+	int mipmapLow = clamp((int)floor(max(trilinearCoefficient, 0.0f)), 0, (int)mipmaps.size() - 1);
+	if (!trilinear) return sampleMipmap(octahedralLevelUv(uv, mipmapLow), false, bilinear, mipmapLow);
+	int mipmapHigh = min(mipmapLow + 1, (int)mipmaps.size() - 1);
+	return lerp(
+		sampleMipmap(octahedralLevelUv(uv, mipmapLow), false, bilinear, mipmapLow),
+		sampleMipmap(octahedralLevelUv(uv, mipmapHigh), false, bilinear, mipmapHigh),
+		fract(trilinearCoefficient)
+	);
+}
+void SrTexture::sampleOctahedralMany(const vec3* eyeViews, vec4* results, const int count, const bool bilinear, const bool trilinear, float trilinearCoefficient) {
+#ifdef SR_SSE
+	if (format == RGBA32F) { // encode the directions and do the vectorized 2D lookups, one level at a time
+		int mipmapLow = clamp((int)floor(max(trilinearCoefficient, 0.0f)), 0, (int)mipmaps.size() - 1);
+		int mipmapHigh = min(mipmapLow + 1, (int)mipmaps.size() - 1);
+		bool blendLevels = trilinear && mipmapHigh != mipmapLow;
+		float t = fract(trilinearCoefficient);
+		vec2 uvs[64], uvsHigh[64];
+		vec4 high[64];
+		for (int i = 0; i < count; i += 64) {
+			int n = min(count - i, 64);
+			for (int k = 0; k < n; k++) {
+				vec2 uv = octahedralEncode(eyeViews[i + k]);
+				uvs[k] = octahedralLevelUv(uv, mipmapLow);
+				if (blendLevels) uvsHigh[k] = octahedralLevelUv(uv, mipmapHigh);
+			}
+			sampleManySse(uvs, &results[i], n, false, bilinear, false, (float)mipmapLow);
+			if (!blendLevels) continue;
+			sampleManySse(uvsHigh, high, n, false, bilinear, false, (float)mipmapHigh);
+			for (int k = 0; k < n; k++) results[i + k] = lerp(results[i + k], high[k], t);
+		}
+		return;
+	}
+#endif
+	for (int i = 0; i < count; i++)
+		results[i] = sampleOctahedral(eyeViews[i], bilinear, trilinear, trilinearCoefficient);
+}
 #endif
\ No newline at end of file
@@ -407,102 +407,354 @@ The vertex structure is assumed to be as follows:
 3xfloat (12 bytes) model space tangent
 3xfloat (12 bytes) model space bitangent
 This is 60 bytes per vertex, not the best in terms of memory efficiency.
-I plan do add assimp library in the future to support standard 3D model formats.
+The standard Wavefront OBJ and binary glTF formats are loaded by loadObj and loadGlb (see meshfile.h).
+The file is mapped in memory and its triangles are converted in parallel straight into the mesh. Returns an empty
+mesh (reporting the reason) if the file is missing or its size is not a whole number of triangles.
 */
+static const size_t srMeshBufferVertexBytes = 60;
+// Converts a 60 bytes vertex record of a mesh buffer file (see loadMeshBuffer)
+static inline void decodeMeshBufferVertex(const unsigned char* record, SrVertex& v) {
+	float data[14];
+	memcpy(data, record, 3 * sizeof(float));
+	memcpy(&data[3], record + 16, 11 * sizeof(float));
+	const unsigned char* rgba = record + 12;
+	v.position = vec4(data[0], data[1], data[2], 1.0f);
+	v.color = vec4(rgba[0], rgba[1], rgba[2], rgba[3]) / 255.0f;
+	v.normal = vec4(data[3], data[4], data[5], 0.0f);
+	v.uv = vec2(data[6], data[7]);
+	v.tangent = vec4(data[8], data[9], data[10], 0.0f);
+	v.bitangent = vec4(data[11], data[12], data[13], 0.0f);
+}
 SrMesh loadMeshBuffer(const char* filename) {
-	FILE* pFile;
-	fopen_s(&pFile, filename, "rb");
-	fseek(pFile, 0, SEEK_END);
-	size_t numBytes = ftell(pFile);
-	fseek(pFile, 0, SEEK_SET);
-	SrVertex v;
-	SrMesh retMesh;
-	SrTriangle tris;
-	float data[11];
-	unsigned char rgba[4];
-	for (int i = 0; i < numBytes / 180; i++) {
-		// read tris by tris
-		fread(data, 4, 3, pFile);
-		fread(rgba, 1, 4, pFile);
-		tris.a.position.x = data[0];
-		tris.a.position.y = data[1];
-		tris.a.position.z = data[2];
-		tris.a.position.w = 1.0f;
-		tris.a.color.r = (float)rgba[0] / 255.0f;
-		tris.a.color.g = (float)rgba[1] / 255.0f;
-		tris.a.color.b = (float)rgba[2] / 255.0f;
-		tris.a.color.a = (float)rgba[3] / 255.0f;
-		fread(data, 4, 11, pFile);
-		tris.a.normal.x = data[0];
-		tris.a.normal.y = data[1];
-		tris.a.normal.z = data[2];
-		tris.a.normal.w = 0.0f;
-		tris.a.uv.x = data[3];
-		tris.a.uv.y = data[4];
-		tris.a.tangent.x = data[5];
-		tris.a.tangent.y = data[6];
-		tris.a.tangent.z = data[7];
-		tris.a.tangent.w = 0.0f;
-		tris.a.bitangent.x = data[8];
-		tris.a.bitangent.y = data[9];
-		tris.a.bitangent.z = data[10];
-		tris.a.bitangent.w = 0.0f;
-
-		fread(data, 4, 3, pFile);
-		fread(rgba, 1, 4, pFile);
-		tris.b.position.x = data[0];
-		tris.b.position.y = data[1];
-		tris.b.position.z = data[2];
-		tris.b.position.w = 1.0f;
-		tris.b.color.r = (float)rgba[0] / 255.0f;
-		tris.b.color.g = (float)rgba[1] / 255.0f;
-		tris.b.color.b = (float)rgba[2] / 255.0f;
-		tris.b.color.a = (float)rgba[3] / 255.0f;
-		fread(data, 4, 11, pFile);
-		tris.b.normal.x = data[0];
-		tris.b.normal.y = data[1];
-		tris.b.normal.z = data[2];
-		tris.b.normal.w = 0.0f;
-		tris.b.uv.x = data[3];
-		tris.b.uv.y = data[4];
-		tris.b.tangent.x = data[5];
-		tris.b.tangent.y = data[6];
-		tris.b.tangent.z = data[7];
-		tris.b.tangent.w = 0.0f;
-		tris.b.bitangent.x = data[8];
-		tris.b.bitangent.y = data[9];
-		tris.b.bitangent.z = data[10];
-		tris.b.bitangent.w = 0.0f;
-
-		fread(data, 4, 3, pFile);
-		fread(rgba, 1, 4, pFile);
-		tris.c.position.x = data[0];
-		tris.c.position.y = data[1];
-		tris.c.position.z = data[2];
-		tris.c.position.w = 1.0f;
-		tris.c.color.r = (float)rgba[0] / 255.0f;
-		tris.c.color.g = (float)rgba[1] / 255.0f;
-		tris.c.color.b = (float)rgba[2] / 255.0f;
-		tris.c.color.a = (float)rgba[3] / 255.0f;
-		fread(data, 4, 11, pFile);
-		tris.c.normal.x = data[0];
-		tris.c.normal.y = data[1];
-		tris.c.normal.z = data[2];
-		tris.c.normal.w = 0.0f;
-		tris.c.uv.x = data[3];
-		tris.c.uv.y = data[4];
-		tris.c.tangent.x = data[5];
-		tris.c.tangent.y = data[6];
-		tris.c.tangent.z = data[7];
-		tris.c.tangent.w = 0.0f;
-		tris.c.bitangent.x = data[8];
-		tris.c.bitangent.y = data[9];
-		tris.c.bitangent.z = data[10];
-		tris.c.bitangent.w = 0.0f;
-
-		retMesh.push_back(tris);
+	SrMesh mesh;
+	SrFileMapping file;
+	if (!file.open(filename)) {
+		std::cout << "could not open mesh buffer " << filename << std::endl;
+		return mesh;
+	}
+	if (file.size() % (3 * srMeshBufferVertexBytes) != 0) {
+		std::cout << "invalid mesh buffer " << filename << " (" << file.size() << " bytes are not a whole number of triangles)" << std::endl;
+		return mesh;
+	}
+	mesh.resize(file.size() / (3 * srMeshBufferVertexBytes));
+	const unsigned char* records = file.data();
+	srParallelFor((int)mesh.size(), [&](int begin, int end, int worker) {
+		for (int i = begin; i < end; i++) {
+			const unsigned char* record = records + (size_t)i * 3 * srMeshBufferVertexBytes;
+			decodeMeshBufferVertex(record, mesh[i].a);
+			decodeMeshBufferVertex(record + srMeshBufferVertexBytes, mesh[i].b);
+			decodeMeshBufferVertex(record + 2 * srMeshBufferVertexBytes, mesh[i].c);
+		}
+	});
+	return mesh;
+}
+// Welding key of a vertex: the bits of its 22 attributes (-0 made 0), or the attributes rounded to multiples of epsilon
+static inline void weldKey(const SrVertex& v, const float epsilon, unsigned int key[22]) {
+	const float* attributes[6] = { &v.position[0], &v.normal[0], &v.tangent[0], &v.bitangent[0], &v.color[0], &v.uv[0] };
+	for (int a = 0, k = 0; a < 6; a++)
+		for (int c = 0; c < (a < 5 ? 4 : 2); c++, k++) {
+			float x = attributes[a][c] + 0.0f;
+			if (epsilon > 0.0f) key[k] = (unsigned int)(int)floor(x / epsilon + 0.5f);
+			else memcpy(&key[k], &x, sizeof(float));
+		}
+}
+static inline unsigned int weldHash(const unsigned int key[22]) {
+	unsigned int hash = 0; // MurmurHash3 over the key words: every bit of the hash depends on every key bit
+	for (int k = 0; k < 22; k++) {
+		unsigned int word = key[k] * 0xcc9e2d51u;
+		word = (word << 15 | word >> 17) * 0x1b873593u;
+		hash ^= word;
+		hash = (hash << 13 | hash >> 19) * 5 + 0xe6546b64u;
 	}
-	fclose(pFile);
-	return retMesh;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	return hash ^ (hash >> 16);
+}
+/* Turns a triangle list into unique vertices and indices (see SrIndexedMesh). With epsilon 0 only vertices with
+   exactly the same attributes are welded, otherwise the ones whose attributes round to the same multiples of
+   epsilon. The vertices keep the order of their first occurrence. The vertices are hashed, grouped by hash
+   partitions that are welded in parallel with one hash table each, and compacted in parallel. */
+SrIndexedMesh weldMesh(const SrMesh& mesh, const float epsilon = 0.0f) {
+	SrIndexedMesh indexed;
+	const int count = (int)mesh.size() * 3;
+	if (count == 0) return indexed;
+	static_assert(sizeof(SrTriangle) == 3 * sizeof(SrVertex), "SrTriangle must be three consecutive SrVertex");
+	const SrVertex* vertices = &mesh[0].a;
+	std::vector<unsigned int> hashes(count);
+	srParallelFor(count, [&](int begin, int end, int worker) {
+		unsigned int key[22];
+		for (int i = begin; i < end; i++) {
+			weldKey(vertices[i], epsilon, key);
+			hashes[i] = weldHash(key);
+		}
+	});
+	/* representative[i] is the first vertex equal to vertex i. Every worker welds the vertices whose hash falls in
+	   its share with its own hash table, scanning them in order: the vertices are read almost sequentially and the
+	   earlier duplicates of a vertex, usually in the neighbouring triangles, are still in the cache. */
+	std::vector<int> representative(count);
+	const int workers = srThreadCount();
+	// Vertices of every share in order (counting sort by share)
+	std::vector<int> shareStart(workers + 1, 0), shared(count);
+	for (int i = 0; i < count; i++) shareStart[(hashes[i] >> 16) % (unsigned int)workers + 1]++;
+	for (int w = 0; w < workers; w++) shareStart[w + 1] += shareStart[w];
+	std::vector<int> fill(shareStart.begin(), shareStart.end() - 1);
+	for (int i = 0; i < count; i++) shared[fill[(hashes[i] >> 16) % (unsigned int)workers]++] = i;
+	srParallelFor(workers, [&](int begin, int end, int worker) {
+		unsigned int key[22], other[22];
+		for (int w = begin; w < end; w++) {
+			int owned = shareStart[w + 1] - shareStart[w];
+			unsigned int size = 16;
+			while (size <= (unsigned int)owned) size *= 2;
+			// Open addressing table of (hash, vertex) pairs: the vertices are only compared when the hashes match
+			std::vector<std::pair<unsigned int, int> > table(size, std::pair<unsigned int, int>(0, -1));
+			for (int s = shareStart[w]; s < shareStart[w + 1]; s++) {
+				int i = shared[s];
+				unsigned int hash = hashes[i];
+				bool keyed = false;
+				for (unsigned int slot = hash & (size - 1);; slot = (slot + 1) & (size - 1)) {
+					if (table[slot].second < 0) { // first occurrence
+						table[slot] = std::pair<unsigned int, int>(hash, i);
+						representative[i] = i;
+						break;
+					}
+					if (table[slot].first != hash) continue;
+					if (!keyed) weldKey(vertices[i], epsilon, key);
+					keyed = true;
+					weldKey(vertices[table[slot].second], epsilon, other);
+					if (memcmp(key, other, sizeof(key)) == 0) {
+						representative[i] = table[slot].second;
+						break;
+					}
+				}
+			}
+		}
+	});
+	// Number the unique vertices in order: count them per chunk, then every chunk numbers its own from its offset
+	const int chunks = srThreadCount() * 4;
+	std::vector<int> chunkOffset(chunks + 1, 0);
+	std::vector<int> remap(count);
+	srParallelFor(chunks, [&](int begin, int end, int worker) {
+		for (int c = begin; c < end; c++)
+			for (int i = (int)((long long)count * c / chunks); i < (int)((long long)count * (c + 1) / chunks); i++)
+				if (representative[i] == i) chunkOffset[c + 1]++;
+	});
+	for (int c = 0; c < chunks; c++) chunkOffset[c + 1] += chunkOffset[c];
+	indexed.vertices.resize(chunkOffset[chunks]);
+	srParallelFor(chunks, [&](int begin, int end, int worker) {
+		for (int c = begin; c < end; c++) {
+			int next = chunkOffset[c];
+			for (int i = (int)((long long)count * c / chunks); i < (int)((long long)count * (c + 1) / chunks); i++)
+				if (representative[i] == i) {
+					remap[i] = next;
+					indexed.vertices[next++] = vertices[i];
+				}
+		}
+	});
+	bool shortIndices = indexed.vertices.size() <= 65536;
+	if (shortIndices) indexed.indices16.resize(count);
+	else indexed.indices32.resize(count);
+	srParallelFor(count, [&](int begin, int end, int worker) {
+		for (int i = begin; i < end; i++) {
+			if (shortIndices) indexed.indices16[i] = (unsigned short)remap[representative[i]];
+			else indexed.indices32[i] = (unsigned int)remap[representative[i]];
+		}
+	});
+	return indexed;
+}
+/* Computes the tangents and bitangents of an indexed mesh from its uv, following MikkTSpace (the tangent space of
+   most bakers): every triangle gives the direction of increasing u, oriented by the sign of its uv area; at every
+   vertex the directions of its triangles are projected on the normal plane and summed weighted by the angle of the
+   triangle at the vertex. The bitangent is cross(normal, tangent), flipped on the triangles with mirrored uv. The
+   vertices shared by mirrored and not mirrored triangles are split in two (a uv mirroring seam), so the vertex count
+   may grow. Triangles with degenerate uv take the tangents of their vertices; the vertices with no other triangle get
+   any direction orthogonal to the normal. The triangles and then the vertices are processed in parallel. */
+void generateTangents(SrIndexedMesh& mesh) {
+	const size_t triangles = mesh.getIndexCount() / 3, vertexCount = mesh.vertices.size();
+	if (triangles == 0) return;
+	// Orientation of every triangle (1, -1 when mirrored, 0 degenerate) and angle weighted tangent of its corners
+	std::vector<vec3> cornerTangents(triangles * 3, vec3(0.0f));
+	std::vector<signed char> orientations(triangles);
+	srParallelFor((int)triangles, [&](int begin, int end, int worker) {
+		for (int t = begin; t < end; t++) {
+			const SrVertex* v[3] = { &mesh.vertices[mesh.getIndex(t * 3)], &mesh.vertices[mesh.getIndex(t * 3 + 1)], &mesh.vertices[mesh.getIndex(t * 3 + 2)] };
+			vec3 e1 = vec3(v[1]->position.xyz - v[0]->position.xyz), e2 = vec3(v[2]->position.xyz - v[0]->position.xyz);
+			vec2 duv1 = v[1]->uv - v[0]->uv, duv2 = v[2]->uv - v[0]->uv;
+			float area = duv1.x * duv2.y - duv1.y * duv2.x; // twice the signed uv area
+			vec3 triangleTangent = e1 * duv2.y - e2 * duv1.y;
+			orientations[t] = area > 0.0f ? 1 : (area < 0.0f ? -1 : 0);
+			if (orientations[t] == 0 || length(triangleTangent) <= 0.0f) {
+				orientations[t] = 0;
+				continue;
+			}
+			triangleTangent = normalize(triangleTangent) * (float)orientations[t];
+			// Projected on the normal plane of the corner vertex, weighted by the angle of the projected edges
+			for (int c = 0; c < 3; c++) {
+				vec3 normal = vec3(v[c]->normal.xyz), p = vec3(v[c]->position.xyz);
+				vec3 tangent = triangleTangent - normal * dot(normal, triangleTangent);
+				vec3 edge1 = vec3(v[(c + 1) % 3]->position.xyz) - p, edge2 = vec3(v[(c + 2) % 3]->position.xyz) - p;
+				edge1 -= normal * dot(normal, edge1);
+				edge2 -= normal * dot(normal, edge2);
+				if (length(tangent) <= 0.0f || length(edge1) <= 0.0f || length(edge2) <= 0.0f) continue;
+				float angle = acos(clamp(dot(normalize(edge1), normalize(edge2)), -1.0f, 1.0f));
+				cornerTangents[t * 3 + c] = normalize(tangent) * angle;
+			}
+		}
+	});
+	// Corners of every vertex, in triangle order
+	std::vector<unsigned int> cornerStart(vertexCount + 1, 0), corners(triangles * 3);
+	for (size_t i = 0; i < triangles * 3; i++) cornerStart[mesh.getIndex(i) + 1]++;
+	for (size_t v = 0; v < vertexCount; v++) cornerStart[v + 1] += cornerStart[v];
+	std::vector<unsigned int> fill(cornerStart.begin(), cornerStart.end() - 1);
+	for (size_t i = 0; i < triangles * 3; i++) corners[fill[mesh.getIndex(i)]++] = (unsigned int)i;
+	std::vector<unsigned int>().swap(fill);
+	// Sums per vertex and orientation; the vertex keeps the orientation of its first triangle
+	std::vector<vec3> sums(vertexCount * 2, vec3(0.0f));
+	std::vector<signed char> vertexOrientations(vertexCount, 0);
+	std::vector<char> mirrored(vertexCount, 0); // has triangles of both orientations
+	srParallelFor((int)vertexCount, [&](int begin, int end, int worker) {
+		for (int v = begin; v < end; v++)
+			for (unsigned int k = cornerStart[v]; k < cornerStart[v + 1]; k++) {
+				signed char orientation = orientations[corners[k] / 3];
+				if (orientation == 0) continue;
+				if (vertexOrientations[v] == 0) vertexOrientations[v] = orientation;
+				else if (vertexOrientations[v] != orientation) mirrored[v] = 1;
+				sums[v * 2 + (orientation == vertexOrientations[v] ? 0 : 1)] += cornerTangents[corners[k]];
+			}
+	});
+	std::vector<vec3>().swap(cornerTangents);
+	// Split the vertices on mirroring seams: the corners of the other orientation move to a copy of the vertex
+	std::vector<unsigned int> copies(vertexCount, 0);
+	size_t splitCount = 0;
+	for (size_t v = 0; v < vertexCount; v++)
+		if (mirrored[v]) copies[v] = (unsigned int)(vertexCount + splitCount++);
+	if (splitCount > 0) {
+		std::vector<unsigned int> indices(triangles * 3);
+		for (size_t i = 0; i < triangles * 3; i++) indices[i] = mesh.getIndex(i);
+		mesh.vertices.resize(vertexCount + splitCount);
+		sums.resize((vertexCount + splitCount) * 2, vec3(0.0f));
+		vertexOrientations.resize(vertexCount + splitCount, 0);
+		for (size_t v = 0; v < vertexCount; v++) {
+			if (!mirrored[v]) continue;
+			unsigned int copy = copies[v];
+			mesh.vertices[copy] = mesh.vertices[v];
+			sums[copy * 2] = sums[v * 2 + 1];
+			vertexOrientations[copy] = -vertexOrientations[v];
+			for (unsigned int k = cornerStart[v]; k < cornerStart[v + 1]; k++)
+				if (orientations[corners[k] / 3] == -vertexOrientations[v]) indices[corners[k]] = copy;
+		}
+		if (mesh.vertices.size() <= 65536) {
+			mesh.indices16.assign(indices.begin(), indices.end());
+			std::vector<unsigned int>().swap(mesh.indices32);
+		}
+		else {
+			std::vector<unsigned short>().swap(mesh.indices16);
+			mesh.indices32.swap(indices);
+		}
+	}
+	srParallelFor((int)mesh.vertices.size(), [&](int begin, int end, int worker) {
+		for (int v = begin; v < end; v++) {
+			vec3 normal = vec3(mesh.vertices[v].normal.xyz), tangent = sums[v * 2];
+			if (length(tangent) <= 0.0f) tangent = abs(normal.x) < 0.9f ? cross(normal, vec3(1, 0, 0)) : cross(normal, vec3(0, 1, 0));
+			tangent = normalize(tangent);
+			mesh.vertices[v].tangent = vec4(tangent, 0.0f);
+			mesh.vertices[v].bitangent = vec4(cross(normal, tangent) * (vertexOrientations[v] < 0 ? -1.0f : 1.0f), 0.0f);
+		}
+	});
+}
+// Converts a float to the nearest half float (IEEE 754 binary16, ties to even), see srHalfToFloat
+static inline unsigned short srFloatToHalf(const float f) {
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(float));
+	unsigned int sign = (bits >> 16) & 0x8000, mantissa = bits & 0x7FFFFF;
+	int exponent = (int)((bits >> 23) & 0xFF) - 112;
+	if (exponent == 143) return (unsigned short)(sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0)); // inf, nan
+	if (exponent >= 31) return (unsigned short)(sign | 0x7C00); // too large, inf
+	unsigned int half, rest, halfway;
+	if (exponent <= 0) { // subnormal
+		if (exponent < -10) return (unsigned short)sign;
+		unsigned int shift = 14 - exponent;
+		mantissa |= 0x800000;
+		half = mantissa >> shift;
+		rest = mantissa & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
+	}
+	else {
+		half = (unsigned int)exponent << 10 | mantissa >> 13;
+		rest = mantissa & 0x1FFF;
+		halfway = 0x1000;
+	}
+	if (rest > halfway || (rest == halfway && (half & 1))) half++; // the carry may round up to the next exponent
+	return (unsigned short)(sign | half);
+}
+/* Converts an indexed mesh to packed vertices (see SrPackedVertex), 24 bytes instead of 88. The positions are
+   quantized in the mesh bounds (1/65535 of the bounds size), the normal and tangent directions keep about 0.005
+   degrees, the uv 11 significant bits and the color 8 bits per channel. The indices, the clusters (optional, see
+   buildMeshClusters) and the levels of detail (optional, see buildMeshLods, their indices follow the ones of the
+   mesh) are copied. */
+SrPackedMesh packMesh(const SrIndexedMesh& mesh, const std::vector<SrMeshCluster>& clusters = std::vector<SrMeshCluster>(),
+	const std::vector<SrMeshLod>& lods = std::vector<SrMeshLod>(), const std::vector<unsigned int>& lodIndices = std::vector<unsigned int>()) {
+	struct packedStorage {
+		std::vector<SrPackedVertex> vertices;
+		std::vector<unsigned short> indices16;
+		std::vector<unsigned int> indices32;
+		std::vector<SrMeshCluster> clusters;
+		std::vector<SrMeshLod> lods;
+	};
+	std::shared_ptr<packedStorage> storage = std::make_shared<packedStorage>();
+	storage->indices16 = mesh.indices16;
+	storage->indices32 = mesh.indices32;
+	if (mesh.indices16.size() > 0) storage->indices16.insert(storage->indices16.end(), lodIndices.begin(), lodIndices.end());
+	else storage->indices32.insert(storage->indices32.end(), lodIndices.begin(), lodIndices.end());
+	storage->clusters = clusters;
+	storage->lods = lods;
+	storage->vertices.resize(mesh.vertices.size());
+	SrPackedMesh packed;
+	packed.storage = storage;
+	packed.vertices = storage->vertices.size() > 0 ? &storage->vertices[0] : NULL;
+	packed.vertexCount = storage->vertices.size();
+	packed.indices16 = storage->indices16.size() > 0 ? &storage->indices16[0] : NULL;
+	packed.indices32 = storage->indices32.size() > 0 ? &storage->indices32[0] : NULL;
+	packed.indexCount = storage->indices16.size() + storage->indices32.size();
+	packed.clusters = clusters.size() > 0 ? &storage->clusters[0] : NULL;
+	packed.clusterCount = clusters.size();
+	packed.lods = lods.size() > 0 ? &storage->lods[0] : NULL;
+	packed.lodCount = lods.size();
+	if (mesh.vertices.size() == 0) return packed;
+	vec3 low(mesh.vertices[0].position.xyz), high = low;
+	for (size_t i = 1; i < mesh.vertices.size(); i++) {
+		low = min(low, vec3(mesh.vertices[i].position.xyz));
+		high = max(high, vec3(mesh.vertices[i].position.xyz));
+	}
+	packed.boundsMin = low;
+	packed.boundsScale = (high - low) / 65535.0f;
+	packed.boundsCenter = (low + high) * 0.5f;
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+		packed.boundsRadius = max(packed.boundsRadius, length(vec3(mesh.vertices[i].position.xyz) - packed.boundsCenter));
+	packed.boundsRadius += length(packed.boundsScale) * 0.5f; // quantization error
+	vec3 invScale;
+	for (int c = 0; c < 3; c++) invScale[c] = packed.boundsScale[c] > 0.0f ? 1.0f / packed.boundsScale[c] : 0.0f;
+	srParallelFor((int)mesh.vertices.size(), [&](int begin, int end, int worker) {
+		for (int i = begin; i < end; i++) {
+			const SrVertex& v = mesh.vertices[i];
+			SrPackedVertex& p = storage->vertices[i];
+			vec3 q = (vec3(v.position.xyz) - low) * invScale;
+			for (int c = 0; c < 3; c++) p.position[c] = (unsigned short)min(floor(q[c] + 0.5f), 65535.0f);
+			srOctahedralEncode(vec3(v.normal.xyz), p.normal);
+			srOctahedralEncode(vec3(v.tangent.xyz), p.tangent);
+			// The bitangent direction is rebuilt from the normal and the tangent, only its handedness is stored
+			p.bitangentSign = dot(cross(vec3(v.tangent.xyz), vec3(v.normal.xyz)), vec3(v.bitangent.xyz)) < 0.0f ? -1 : 1;
+			p.uv[0] = srFloatToHalf(v.uv.x);
+			p.uv[1] = srFloatToHalf(v.uv.y);
+			for (int c = 0; c < 4; c++) p.color[c] = (unsigned char)floor(clamp(v.color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+	});
+	return packed;
+}
+// Loads a mesh buffer file (see loadMeshBuffer) on the asset loading pool (see srAsync)
+std::future<SrMesh> loadMeshBufferAsync(const char* filename) {
+	std::string name = filename; // the caller's string may not outlive the task
+	return srAsync([name] { return loadMeshBuffer(name.c_str()); });
 }
 #endif
\ No newline at end of file